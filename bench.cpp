@@ -0,0 +1,465 @@
+/*
+ * Time the host-side mirrors of the transport kernels, one at a time, and
+ * report the cost of each per call and per random number.  "make bench"
+ * runs this and writes the results as JSON so that they can be compared
+ * between commits.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include "host-kernels.h"
+
+namespace {
+
+// Each kernel is timed over this many independent inputs.
+const size_t batch_n = 4096;
+
+// Keep the compiler from discarding results that nothing else reads.
+volatile double sink;
+
+// Describe the timing of one form of one kernel.
+struct BenchResult {
+  std::string kernel;   // Name of the S1 kernel the code mirrors or ports
+  std::string form;     // "scalar" or "batched"
+  double ns_per_op;     // Nanoseconds per call (per particle, per block)
+  double randoms_per_op;  // 16-bit random numbers produced or consumed
+};
+
+// Return the nanoseconds one of ops operations takes when run() performs
+// all of them.  run() is repeated until a trial lasts at least min_time
+// seconds, and the fastest of five trials is reported.
+double time_ns(const std::function<void ()>& run, size_t ops, double min_time)
+{
+  typedef std::chrono::steady_clock clock;
+  run();
+  long reps = 1;
+  while (true) {
+    auto start = clock::now();
+    for (long i = 0; i < reps; ++i)
+      run();
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    if (elapsed.count() >= min_time)
+      break;
+    reps *= 2;
+  }
+  double best = 0.0;
+  for (int trial = 0; trial < 5; ++trial) {
+    auto start = clock::now();
+    for (long i = 0; i < reps; ++i)
+      run();
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    if (trial == 0 || elapsed.count() < best)
+      best = elapsed.count();
+  }
+  return best*1.0e9/(double(reps)*ops);
+}
+
+// Hold the particles of the event-dispatch benchmark as a structure of
+// arrays, as run_apes_by_event() does.  Particles that die are sourced
+// again in place so that every step has batch_n particles to move.
+struct DispatchBank {
+  const IMCParams& p;
+  const std::vector<int>& draws;          // Four random numbers per draw
+  std::vector<double> pos_x, pos_y, angle_x, angle_y, d_remain;
+  std::vector<int> x_cell, y_cell, cross_face;
+  std::vector<char> redirect;
+  std::vector<unsigned> steps;            // Draws each particle has taken
+  std::vector<double> tally;              // Absorptions per cell, x major
+
+  DispatchBank(const IMCParams& p, const std::vector<int>& draws)
+    : p(p), draws(draws), pos_x(batch_n), pos_y(batch_n), angle_x(batch_n),
+      angle_y(batch_n), d_remain(batch_n), x_cell(batch_n), y_cell(batch_n),
+      cross_face(batch_n), redirect(batch_n), steps(batch_n, 0),
+      tally(size_t(p.max_x_cell)*p.max_y_cell, 0.0) {
+    for (size_t i = 0; i < batch_n; ++i)
+      source(i);
+  }
+
+  // Start a new particle in slot i.
+  void source(size_t i) {
+    pos_x[i] = 0.5;
+    pos_y[i] = 0.5;
+    d_remain[i] = p.dt*p.c;
+    x_cell[i] = p.start_x;
+    y_cell[i] = p.start_y;
+    redirect[i] = true;
+  }
+
+  // Return particle i's next draw.  Each particle walks the shared table
+  // from its own offset, so both dispatch orders see the same numbers.
+  const int* next_draw(size_t i) {
+    size_t n_draws = draws.size()/4;
+    return &draws[4*((i*7919 + steps[i]++)%n_draws)];
+  }
+
+  // Move particle i and return the event that ends its step.
+  event_t move(size_t i) {
+    const int* r = next_draw(i);
+    if (redirect[i]) {
+      double angle[2];
+      get_angle(r + 2, angle);
+      angle_x[i] = angle[0];
+      angle_y[i] = angle[1];
+      redirect[i] = false;
+    }
+    const double sig_s = 1.0/p.mfp;
+    const double ratio = p.dx;
+    double pos[2] = {pos_x[i], pos_y[i]};
+    double angle[2] = {angle_x[i], angle_y[i]};
+    double d_scatter = -ln_of_int(r[0])/sig_s/ratio;
+    double d_absorb = -ln_of_int(r[1])/p.sig_a/ratio;
+    double d_boundary = get_distance_to_boundary(&cross_face[i], pos, angle);
+    double d_census = d_remain[i]/ratio;
+    double d_move = std::min(d_boundary,
+                             std::min(d_census, std::min(d_scatter, d_absorb)));
+    pos_x[i] = pos[0] + angle[0]*d_move;
+    pos_y[i] = pos[1] + angle[1]*d_move;
+    d_remain[i] -= d_move*ratio;
+    return classify_event(d_move, d_census, d_absorb, d_scatter);
+  }
+
+  // Move particle i across its boundary, sourcing a new particle if it
+  // leaves the domain.
+  void cross(size_t i) {
+    double pos[2] = {pos_x[i], pos_y[i]};
+    if (cross_boundary(p, cross_face[i], &x_cell[i], &y_cell[i], pos)) {
+      pos_x[i] = pos[0];
+      pos_y[i] = pos[1];
+    }
+    else
+      source(i);
+  }
+
+  // Step every particle, processing each one's event where it occurs, as
+  // history-based transport does.
+  void history_step() {
+    for (size_t i = 0; i < batch_n; ++i)
+      switch (move(i)) {
+        case CensusEvent:
+          source(i);
+          break;
+        case AbsorbEvent:
+          tally[x_cell[i]*p.max_y_cell + y_cell[i]] += 1.0;
+          source(i);
+          break;
+        case ScatterEvent:
+          redirect[i] = true;
+          break;
+        default:
+          cross(i);
+          break;
+      }
+  }
+
+  // Step every particle, first queueing the particles by event and then
+  // running each event's code over its queue, as event-based transport
+  // does.
+  void event_step(std::vector<int> queue[BoundaryEvent + 1]) {
+    for (size_t i = 0; i < batch_n; ++i)
+      queue[move(i)].push_back(int(i));
+    for (int i : queue[AbsorbEvent])
+      tally[x_cell[i]*p.max_y_cell + y_cell[i]] += 1.0;
+    for (int i : queue[CensusEvent])
+      source(i);
+    for (int i : queue[AbsorbEvent])
+      source(i);
+    for (int i : queue[ScatterEvent])
+      redirect[i] = true;
+    for (int i : queue[BoundaryEvent])
+      cross(i);
+    for (int e = 0; e <= BoundaryEvent; ++e)
+      queue[e].clear();
+  }
+};
+
+// Time every kernel in each of its forms.  A scalar form makes each call
+// depend on the one before it, as in the transport loop of a single
+// particle, so it measures latency.  A batched form makes batch_n
+// independent calls, as event-based transport does over a bank of
+// particles, so the compiler and the CPU can overlap or vectorize them;
+// Threefry's batched form is threefry4x32_host_batch(), which uses AVX2 or
+// AVX-512 where available.
+std::vector<BenchResult> run_benchmarks(double min_time)
+{
+  std::vector<BenchResult> results;
+  auto add = [&](const char* kernel, const char* form, double ns,
+                 double randoms) {
+    results.push_back(BenchResult{kernel, form, ns, randoms});
+    std::printf("%-26s %-8s %10.2f ns/op", kernel, form, ns);
+    if (randoms > 0)
+      std::printf(" %10.3f ns/random", ns/randoms);
+    std::printf("\n");
+  };
+
+  // Generate the inputs: Threefry counters, 16-bit random numbers, and
+  // positions and directions within a cell.
+  const uint64_t history = 12345;
+  const unsigned long long seed = 1;
+  uint32_t key[4];
+  threefry_key_host(history, seed, key);
+  std::vector<uint32_t> ctr(4*batch_n, 0), blocks(4*batch_n);
+  for (size_t i = 0; i < batch_n; ++i)
+    ctr[4*i] = uint32_t(i);
+  auto ctr4 = reinterpret_cast<const uint32_t (*)[4]>(ctr.data());
+  auto blocks4 = reinterpret_cast<uint32_t (*)[4]>(blocks.data());
+  threefry4x32_host_batch(batch_n, ctr4, key, blocks4);
+  std::vector<int> draws(4*batch_n);
+  for (size_t i = 0; i < 4*batch_n; ++i)
+    draws[i] = int(blocks[i/2] >> (i%2 == 0 ? 16 : 0) & 0xFFFF);
+  std::vector<double> pos(2*batch_n), angle(2*batch_n), out(2*batch_n);
+  for (size_t i = 0; i < batch_n; ++i) {
+    get_angle(&draws[4*i], &angle[2*i]);
+    pos[2*i] = int_to_01(draws[4*i + 2]);
+    pos[2*i + 1] = int_to_01(draws[4*i + 3]);
+  }
+
+  // Threefry and Philox each produce a block of eight 16-bit numbers.
+  // Check that the batched Threefry matches the scalar one.
+  std::vector<uint32_t> check(4*batch_n);
+  auto check4 = reinterpret_cast<uint32_t (*)[4]>(check.data());
+  add("threefry4x32", "scalar", time_ns([&]() {
+    uint32_t c[4] = {0, 0, 0, 0}, prev = 0;
+    for (size_t i = 0; i < batch_n; ++i) {
+      c[0] = ctr4[i][0] ^ (prev & 0x80000000u);
+      threefry4x32_host(c, key, check4[i]);
+      prev = check4[i][3];
+    }
+  }, batch_n, min_time), 8);
+  add("threefry4x32", "batched", time_ns([&]() {
+    threefry4x32_host_batch(batch_n, ctr4, key, blocks4);
+  }, batch_n, min_time), 8);
+  for (size_t i = 0; i < batch_n; ++i)
+    threefry4x32_host(ctr4[i], key, check4[i]);
+  if (check != blocks) {
+    std::fprintf(stderr, "threefry4x32_host_batch() disagrees with threefry4x32_host()\n");
+    std::exit(EXIT_FAILURE);
+  }
+
+  // The CPU engine's batches serve several histories, each under its own
+  // key; check those against the scalar Threefry too.
+  std::vector<uint32_t> keys(4*batch_n), keyed(4*batch_n);
+  auto keys4 = reinterpret_cast<uint32_t (*)[4]>(keys.data());
+  auto keyed4 = reinterpret_cast<uint32_t (*)[4]>(keyed.data());
+  for (size_t i = 0; i < batch_n; ++i)
+    threefry_key_host(history + i, seed, keys4[i]);
+  add("threefry4x32", "keyed", time_ns([&]() {
+    threefry4x32_host_batch_keys(batch_n, ctr4, keys4, keyed4);
+  }, batch_n, min_time), 8);
+  for (size_t i = 0; i < batch_n; ++i)
+    threefry4x32_host(ctr4[i], keys4[i], check4[i]);
+  if (check != keyed) {
+    std::fprintf(stderr, "threefry4x32_host_batch_keys() disagrees with threefry4x32_host()\n");
+    std::exit(EXIT_FAILURE);
+  }
+  add("philox4x32", "scalar", time_ns([&]() {
+    uint32_t c[4] = {0, 0, 0, 0}, prev = 0;
+    for (size_t i = 0; i < batch_n; ++i) {
+      c[0] = ctr4[i][0] ^ (prev & 0x80000000u);
+      philox4x32_host(c, key, check4[i]);
+      prev = check4[i][3];
+    }
+  }, batch_n, min_time), 8);
+  add("philox4x32", "batched", time_ns([&]() {
+    for (size_t i = 0; i < batch_n; ++i)
+      philox4x32_host(ctr4[i], key, blocks4[i]);
+  }, batch_n, min_time), 8);
+
+  // A draw delivers four numbers from the stream of one history.
+  HostRandom rng(seed, 1);
+  rng.start(0, history);
+  add("get_random_draw", "scalar", time_ns([&]() {
+    int r[4], acc = 0;
+    for (size_t i = 0; i < batch_n; ++i) {
+      rng.next_draw(0, r);
+      acc += r[0];
+    }
+    sink = acc;
+  }, batch_n, min_time), 4);
+
+  // The rest consume random numbers rather than producing them.  The CPU
+  // engine converts them with division and libm; the S1 uses its own
+  // algorithms, whose host ports are timed alongside.
+  auto add_int_kernel = [&](const char* kernel, auto f) {
+    add(kernel, "scalar", time_ns([&]() {
+      double v = 0.0;
+      for (size_t i = 0; i < batch_n; ++i)
+        v = f(draws[i] + int(v > 1.0));
+      sink = v;
+    }, batch_n, min_time), 1);
+    add(kernel, "batched", time_ns([&]() {
+      for (size_t i = 0; i < batch_n; ++i)
+        out[i] = f(draws[i]);
+      sink = out[batch_n - 1];
+    }, batch_n, min_time), 1);
+  };
+  add_int_kernel("int_to_01_divide", [](int r) { return int_to_01(r); });
+  add_int_kernel("int_to_approx01", [](int r) { return int_to_approx01_s1(r); });
+  add_int_kernel("ln_libm", [](int r) { return ln_of_int(r); });
+  add_int_kernel("ln_of_int_table",
+                 [](int r) { return ln_of_int_table_s1(r); });
+  add_int_kernel("ln_of_int_chebyshev",
+                 [](int r) { return ln_of_int_chebyshev_s1(r); });
+  add_int_kernel("ln_of_int_shift_subtract",
+                 [](int r) { return ln_of_int_shift_subtract_s1(r); });
+
+  // Time a kernel that maps u in [0, 1) to cos(2*pi*u) and sin(2*pi*u).
+  auto add_cos_sin_kernel = [&](const char* kernel, auto f) {
+    add(kernel, "scalar", time_ns([&]() {
+      double c = 0.0, s = 0.0;
+      for (size_t i = 0; i < batch_n; ++i)
+        f(int_to_01(draws[i] + int(c + s > 2.0)), &c, &s);
+      sink = c + s;
+    }, batch_n, min_time), 1);
+    add(kernel, "batched", time_ns([&]() {
+      for (size_t i = 0; i < batch_n; ++i)
+        f(int_to_01(draws[i]), &out[2*i], &out[2*i + 1]);
+      sink = out[2*batch_n - 1];
+    }, batch_n, min_time), 1);
+  };
+  add_cos_sin_kernel("cos_sin_libm", [](double u, double* c, double* s) {
+    *c = std::cos(u*two_pi);
+    *s = std::sin(u*two_pi);
+  });
+  add_cos_sin_kernel("cos_sin_2pi", [](double u, double* c, double* s) {
+    cos_sin_2pi_s1(u, c, s);
+  });
+
+  add("get_angle", "scalar", time_ns([&]() {
+    double a[2] = {0.0, 0.0};
+    for (size_t i = 0; i < batch_n; ++i) {
+      int r[2] = {draws[2*i] + int(a[0] > 1.0), draws[2*i + 1]};
+      get_angle(r, a);
+    }
+    sink = a[0];
+  }, batch_n, min_time), angle_randoms);
+  add("get_angle", "batched", time_ns([&]() {
+    for (size_t i = 0; i < batch_n; ++i)
+      get_angle(&draws[2*i], &out[2*i]);
+    sink = out[2*batch_n - 1];
+  }, batch_n, min_time), angle_randoms);
+
+  add("get_distance_to_boundary", "scalar", time_ns([&]() {
+    double d = 0.0;
+    int face = 0;
+    for (size_t i = 0; i < batch_n; ++i) {
+      double p[2] = {pos[2*i] + double(d > 1.0e7), pos[2*i + 1]};
+      d = get_distance_to_boundary(&face, p, &angle[2*i]);
+    }
+    sink = d + face;
+  }, batch_n, min_time), 0);
+  add("get_distance_to_boundary", "batched", time_ns([&]() {
+    int face = 0;
+    for (size_t i = 0; i < batch_n; ++i)
+      out[i] = get_distance_to_boundary(&face, &pos[2*i], &angle[2*i]);
+    sink = out[batch_n - 1] + face;
+  }, batch_n, min_time), 0);
+
+  // The dispatch benchmarks run complete transport steps, processing
+  // events in history order (scalar) or event order (batched).  Particles
+  // draw the same numbers either way, so check first that the tallies
+  // agree.
+  IMCParams params;
+  std::vector<int> queue[BoundaryEvent + 1];
+  for (auto& q : queue)
+    q.reserve(batch_n);
+  DispatchBank history_bank(params, draws), event_bank(params, draws);
+  for (int step = 0; step < 16; ++step) {
+    history_bank.history_step();
+    event_bank.event_step(queue);
+  }
+  if (history_bank.tally != event_bank.tally) {
+    std::fprintf(stderr, "History and event dispatch tallies disagree\n");
+    std::exit(EXIT_FAILURE);
+  }
+  add("event_dispatch", "scalar", time_ns([&]() {
+    history_bank.history_step();
+  }, batch_n, min_time), 2 + angle_randoms);
+  add("event_dispatch", "batched", time_ns([&]() {
+    event_bank.event_step(queue);
+  }, batch_n, min_time), 2 + angle_randoms);
+  return results;
+}
+
+// Write the results, and the build settings that affect them, as JSON.
+bool write_json(const char* path, const char* label,
+                const std::vector<BenchResult>& results)
+{
+  FILE* file = std::fopen(path, "w");
+  if (file == nullptr)
+    return false;
+  std::fprintf(file, "{\n  \"label\": \"%s\",\n", label);
+  std::fprintf(file, "  \"rng\": \"%s\",\n",
+               RNG_METHOD == RNG_PHILOX ? "philox" : "threefry");
+  std::fprintf(file, "  \"threefry_rounds\": %d,\n", THREEFRY_ROUNDS);
+  std::fprintf(file, "  \"philox_rounds\": %d,\n", PHILOX_ROUNDS);
+  std::fprintf(file, "  \"direction\": \"%s\",\n",
+               DIRECTION_METHOD == DIRECTION_2D ? "2d" : "3d");
+  std::fprintf(file, "  \"threefry_isa\": \"%s\",\n", threefry_host_isa());
+  std::fprintf(file, "  \"batch_size\": %zu,\n", batch_n);
+  std::fprintf(file, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& r = results[i];
+    std::fprintf(file, "    {\"kernel\": \"%s\", \"form\": \"%s\", "
+                 "\"ns_per_op\": %.4f, \"randoms_per_op\": %g",
+                 r.kernel.c_str(), r.form.c_str(), r.ns_per_op,
+                 r.randoms_per_op);
+    if (r.randoms_per_op > 0)
+      std::fprintf(file, ", \"ns_per_random\": %.4f",
+                   r.ns_per_op/r.randoms_per_op);
+    std::fprintf(file, "}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(file, "  ]\n}\n");
+  return std::fclose(file) == 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+  const char* json_path = nullptr;
+  const char* label = "";
+  double min_time = 0.05;
+  struct option long_options[] =
+    {{"json", required_argument, nullptr, 'j'},
+     {"label", required_argument, nullptr, 'l'},
+     {"min-time", required_argument, nullptr, 't'},
+     {"help", no_argument, nullptr, 'h'},
+     {nullptr, 0, nullptr, 0}};
+  int c;
+  while ((c = getopt_long(argc, argv, "j:l:t:h", long_options, nullptr)) != -1) {
+    switch (c) {
+      case 'j':
+        json_path = optarg;
+        break;
+
+      case 'l':
+        label = optarg;
+        break;
+
+      case 't':
+        min_time = std::atof(optarg);
+        break;
+
+      case 'h':
+        std::printf("Usage: %s [--json=<file>] [--label=<text>] [--min-time=<seconds>] [--help]\n",
+                    argv[0]);
+        return EXIT_SUCCESS;
+
+      default:
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::printf("Threefry batches use %s\n", threefry_host_isa());
+  std::vector<BenchResult> results = run_benchmarks(min_time);
+  if (json_path != nullptr && !write_json(json_path, label, results)) {
+    std::fprintf(stderr, "%s: cannot write %s\n", argv[0], json_path);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
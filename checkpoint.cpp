@@ -0,0 +1,134 @@
+/*
+ * Save and restore the progress of a run that launches its kernel several
+ * times, so that a long run can be split into chunks and resumed
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include "host.h"
+
+namespace {
+
+// Identify a checkpoint and the version of its layout.
+const char checkpoint_magic[8] = {'b', 'c', 'm', 'c', 'c', 'k', 'p', 't'};
+const uint32_t checkpoint_version = 1;
+
+// Describe a checkpoint.  The tally, max_x_cell*max_y_cell doubles, x
+// major, follows the header.
+struct CheckpointHeader {
+  char magic[8];            // checkpoint_magic
+  uint32_t version;         // checkpoint_version
+  uint32_t decompose;       // 1 if each APE owned a tile of the mesh
+  uint32_t ape_rows;        // Rows of APEs across all chips
+  uint32_t ape_cols;        // Columns of APEs across all chips
+  uint64_t seed;            // Random-number seed
+  int64_t n_particles;      // Particles per APE (in total, if decomposed)
+  double c, dx, dt, mfp, sig_a;   // Physical parameters
+  int32_t start_x, start_y;       // Source cell
+  int32_t max_x_cell, max_y_cell; // Number of cells
+  int64_t next_particle;    // Checkpoint contents (see host.h)
+  double busy_iterations;
+  double iterations;
+};
+
+// Describe the run that a checkpoint belongs to.
+CheckpointHeader describe_run(const S1State& s1, const IMCParams& params,
+                              unsigned long long seed)
+{
+  CheckpointHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, checkpoint_magic, sizeof(h.magic));
+  h.version = checkpoint_version;
+  h.decompose = s1.decompose ? 1 : 0;
+  h.ape_rows = uint32_t(s1.ape_rows*s1.chip_rows);
+  h.ape_cols = uint32_t(s1.ape_cols*s1.chip_cols);
+  h.seed = seed;
+  h.n_particles = params.n_particles;
+  h.c = params.c;
+  h.dx = params.dx;
+  h.dt = params.dt;
+  h.mfp = params.mfp;
+  h.sig_a = params.sig_a;
+  h.start_x = params.start_x;
+  h.start_y = params.start_y;
+  h.max_x_cell = params.max_x_cell;
+  h.max_y_cell = params.max_y_cell;
+  return h;
+}
+
+} // anonymous namespace
+
+// Write the checkpoint under a temporary name and rename it, so that a run
+// killed while saving leaves the previous checkpoint intact.
+bool save_checkpoint(const char* path, const S1State& s1,
+                     const IMCParams& params, unsigned long long seed,
+                     const Checkpoint& ckpt)
+{
+  CheckpointHeader h = describe_run(s1, params, seed);
+  h.next_particle = ckpt.next_particle;
+  h.busy_iterations = ckpt.busy_iterations;
+  h.iterations = ckpt.iterations;
+  std::string tmp_path = std::string(path) + '.' + std::to_string(getpid());
+  FILE* file = std::fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr)
+    return false;
+  bool ok = std::fwrite(&h, sizeof(h), 1, file) == 1 &&
+    std::fwrite(ckpt.tally.data(), sizeof(double), ckpt.tally.size(), file) ==
+      ckpt.tally.size();
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok || std::rename(tmp_path.c_str(), path) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Read a checkpoint, and check that it was saved by a run that transports
+// the same histories.  Without --decompose, history numbering depends on
+// the shape of the APE grid; with it, any shape will do.  The transport
+// mode and --refill don't change any history's outcome, so they may differ.
+Checkpoint load_checkpoint(const char* path, const S1State& s1,
+                           const IMCParams& params, unsigned long long seed)
+{
+  FILE* file = std::fopen(path, "rb");
+  if (file == nullptr)
+    throw std::runtime_error(std::string("cannot read ") + path);
+  CheckpointHeader h;
+  Checkpoint ckpt;
+  bool ok = std::fread(&h, sizeof(h), 1, file) == 1 &&
+    std::memcmp(h.magic, checkpoint_magic, sizeof(h.magic)) == 0 &&
+    h.version == checkpoint_version;
+  if (ok) {
+    ckpt.tally.resize(size_t(params.max_x_cell)*params.max_y_cell);
+    ok = std::fread(ckpt.tally.data(), sizeof(double), ckpt.tally.size(), file) ==
+      ckpt.tally.size();
+  }
+  std::fclose(file);
+  if (!ok)
+    throw std::runtime_error(std::string(path) + " is not a checkpoint");
+
+  CheckpointHeader want = describe_run(s1, params, seed);
+  const char* mismatch = nullptr;
+  if (h.decompose != want.decompose)
+    mismatch = "--decompose setting";
+  else if (!s1.decompose &&
+           (h.ape_rows != want.ape_rows || h.ape_cols != want.ape_cols))
+    mismatch = "number of APE rows or columns";
+  else if (h.seed != want.seed)
+    mismatch = "seed";
+  else if (h.n_particles != want.n_particles || h.c != want.c ||
+           h.dx != want.dx || h.dt != want.dt || h.mfp != want.mfp ||
+           h.sig_a != want.sig_a || h.start_x != want.start_x ||
+           h.start_y != want.start_y || h.max_x_cell != want.max_x_cell ||
+           h.max_y_cell != want.max_y_cell)
+    mismatch = "problem";
+  if (mismatch != nullptr)
+    throw std::runtime_error(std::string(path) + " was saved by a run with a different " + mismatch);
+  ckpt.next_particle = h.next_particle;
+  ckpt.busy_iterations = h.busy_iterations;
+  ckpt.iterations = h.iterations;
+  return ckpt;
+}
@@ -0,0 +1,314 @@
+/*
+ * Run a simple billion-core Monte Carlo simulation natively on the host's
+ * CPU cores.  The physics mirrors emit_nova_code() in imc.cpp, with each
+ * "virtual APE" running its own share of the particles.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "host-kernels.h"
+#include "tally-file.h"
+
+namespace {
+
+// Accumulate results from one thread's share of the APEs.
+struct ThreadResult {
+  std::vector<double> tally;   // Absorbed energy per cell, x major
+  unsigned long long histories = 0;   // Particles transported
+  unsigned long long steps = 0;       // Iterations of the transport loop
+  unsigned long long ape_steps = 0;   // APE-iterations, busy or idle, in
+                                      // event-based transport
+};
+
+// Transport all of one APE's particles, histories first_history onward,
+// tallying into a thread's result.  History n draws from stream n modulo
+// the number of streams, and each history starts on its stream as soon as
+// the one before it there finishes, so that the random-number batches
+// serve the histories that follow as well as the current one.
+void run_one_ape(const IMCParams& p, uint64_t first_history,
+                 HostRandom& rng, ThreadResult& res)
+{
+  const double start_weight = 1.0/p.n_particles;
+  const double sig_s = 1.0/p.mfp;
+  const double ratio = p.dx;
+  const int n_streams = rng.size();
+  for (int n = 0; n < std::min(n_streams, p.n_particles); ++n)
+    rng.start(n, first_history + n);
+  for (int n = 0; n < p.n_particles; ++n) {
+    // Initialize the per-particle work.
+    double weight = start_weight;
+    double d_remain = p.dt*p.c;
+    int x_cell = p.start_x;
+    int y_cell = p.start_y;
+    double pos[2] = {0.5, 0.5};
+    double angle[2];
+    bool redirect = true;
+    const int stream = n%n_streams;
+
+    // Iterate until the particle dies.
+    bool alive = true;
+    while (alive) {
+      // Point a new or scattered particle in a random direction, and
+      // compute the distance the particle will move.
+      int r[4];
+      rng.next_draw(stream, r);
+      if (redirect) {
+        get_angle(r + 2, angle);
+        redirect = false;
+      }
+      double d_scatter = -ln_of_int(r[0])/sig_s/ratio;
+      double d_absorb = -ln_of_int(r[1])/p.sig_a/ratio;
+      int cross_face;
+      double d_boundary = get_distance_to_boundary(&cross_face, pos, angle);
+      double d_census = d_remain/ratio;
+      double d_move = std::min(d_boundary,
+                               std::min(d_census,
+                                        std::min(d_scatter, d_absorb)));
+
+      // Move the particle, subtracting the distance remaining.
+      pos[0] += angle[0]*d_move;
+      pos[1] += angle[1]*d_move;
+      d_remain -= d_move*ratio;
+      ++res.steps;
+
+      // Process the event.
+      if (d_move == d_census)
+        alive = false;
+      else if (d_move == d_absorb) {
+        alive = false;
+        res.tally[x_cell*p.max_y_cell + y_cell] += weight;
+      }
+      else if (d_move == d_scatter)
+        redirect = true;
+      else if (d_move == d_boundary)
+        alive = cross_boundary(p, cross_face, &x_cell, &y_cell, pos);
+    }
+    ++res.histories;
+    if (n + n_streams < p.n_particles)
+      rng.start(stream, first_history + n + n_streams);
+    else
+      rng.stop(stream);
+  }
+}
+
+// Store the particles of a group of APEs, one per APE, as a structure of
+// arrays.
+struct ParticleBank {
+  std::vector<double> pos_x, pos_y;       // Position within the cell
+  std::vector<double> angle_x, angle_y;   // Direction of travel
+  std::vector<double> d_remain;           // Distance remaining to census
+  std::vector<int> x_cell, y_cell;        // Current cell
+  std::vector<int> cross_face;            // Face crossed by a boundary event
+  std::vector<char> redirect;             // Needs a new direction
+
+  explicit ParticleBank(size_t n)
+    : pos_x(n), pos_y(n), angle_x(n), angle_y(n), d_remain(n),
+      x_cell(n), y_cell(n), cross_face(n), redirect(n)
+  {
+  }
+};
+
+// Transport all of a group of APEs' particles event by event, tallying
+// into a thread's result.  Each step first moves every live particle and
+// classifies the event that ends its step, compacting the particle into a
+// per-event queue; each event kernel then runs over only its own queue.
+// The APEs step in lockstep, as on the S1: without refill, every APE waits
+// for the group's slowest particle before starting its next one; with
+// refill, an APE starts its next particle as soon as one dies.  Because
+// each history draws from its own random stream, the tallies match
+// run_one_ape()'s either way.  APE i runs histories first_history[i]
+// onward, drawing from stream i of rng.
+void run_apes_by_event(const IMCParams& p, bool refill,
+                       const std::vector<uint64_t>& first_history,
+                       HostRandom& rng, ThreadResult& res)
+{
+  const double start_weight = 1.0/p.n_particles;
+  const double sig_s = 1.0/p.mfp;
+  const double ratio = p.dx;
+  const size_t n_apes = first_history.size();
+  ParticleBank bank(n_apes);
+  std::vector<int> remaining(n_apes, p.n_particles);  // Particles not yet started
+  std::vector<int> active;                // Indices of live particles
+  std::vector<int> queue[BoundaryEvent + 1];  // Particles awaiting each event
+  active.reserve(n_apes);
+  for (auto& q : queue)
+    q.reserve(n_apes);
+
+  // Start a new particle on APE i.
+  auto source = [&](int i) {
+    rng.start(i, first_history[i] + (p.n_particles - remaining[i]));
+    bank.pos_x[i] = 0.5;
+    bank.pos_y[i] = 0.5;
+    bank.redirect[i] = true;
+    bank.d_remain[i] = p.dt*p.c;
+    bank.x_cell[i] = p.start_x;
+    bank.y_cell[i] = p.start_y;
+    --remaining[i];
+    active.push_back(i);
+  };
+
+  // End the history of the particle on APE i.
+  auto retire = [&](int i) {
+    ++res.histories;
+    rng.stop(i);
+    if (refill && remaining[i] > 0)
+      source(i);
+  };
+
+  while (true) {
+    // Source one particle on every APE that has any left.
+    for (size_t i = 0; i < n_apes; ++i)
+      if (remaining[i] > 0)
+        source(int(i));
+    if (active.empty())
+      break;
+
+    // Iterate until every particle dies.
+    while (!active.empty()) {
+      // Move each live particle and classify the event that ends its step.
+      for (int i : active) {
+        int r[4];
+        rng.next_draw(i, r);
+        if (bank.redirect[i]) {
+          double angle[2];
+          get_angle(r + 2, angle);
+          bank.angle_x[i] = angle[0];
+          bank.angle_y[i] = angle[1];
+          bank.redirect[i] = false;
+        }
+        double pos[2] = {bank.pos_x[i], bank.pos_y[i]};
+        double angle[2] = {bank.angle_x[i], bank.angle_y[i]};
+        double d_scatter = -ln_of_int(r[0])/sig_s/ratio;
+        double d_absorb = -ln_of_int(r[1])/p.sig_a/ratio;
+        double d_boundary =
+          get_distance_to_boundary(&bank.cross_face[i], pos, angle);
+        double d_census = bank.d_remain[i]/ratio;
+        double d_move = std::min(d_boundary,
+                                 std::min(d_census,
+                                          std::min(d_scatter, d_absorb)));
+        bank.pos_x[i] = pos[0] + angle[0]*d_move;
+        bank.pos_y[i] = pos[1] + angle[1]*d_move;
+        bank.d_remain[i] -= d_move*ratio;
+        queue[classify_event(d_move, d_census, d_absorb, d_scatter)]
+          .push_back(i);
+      }
+      res.steps += active.size();
+      res.ape_steps += n_apes;
+      active.clear();
+
+      // Census and absorption end a particle's history.
+      for (int i : queue[AbsorbEvent])
+        res.tally[bank.x_cell[i]*p.max_y_cell + bank.y_cell[i]] += start_weight;
+      for (int i : queue[CensusEvent])
+        retire(i);
+      for (int i : queue[AbsorbEvent])
+        retire(i);
+
+      // Scattered particles change direction at their next step.
+      for (int i : queue[ScatterEvent]) {
+        bank.redirect[i] = true;
+        active.push_back(i);
+      }
+
+      // Particles that reach a boundary move to the neighboring cell unless
+      // they leave the domain.
+      for (int i : queue[BoundaryEvent]) {
+        double pos[2] = {bank.pos_x[i], bank.pos_y[i]};
+        if (cross_boundary(p, bank.cross_face[i],
+                           &bank.x_cell[i], &bank.y_cell[i], pos)) {
+          bank.pos_x[i] = pos[0];
+          bank.pos_y[i] = pos[1];
+          active.push_back(i);
+        }
+        else
+          retire(i);
+      }
+      for (auto& q : queue)
+        q.clear();
+    }
+  }
+}
+
+} // anonymous namespace
+
+// Run the entire simulation on the host.  Each thread claims APEs (one at a
+// time for history-based transport or in groups for event-based transport)
+// and tallies into private storage; the tallies are reduced at the end.
+bool run_cpu_engine(const S1State& s1, const IMCParams& params,
+                    unsigned long long seed)
+{
+  const int total_rows = s1.ape_rows*s1.chip_rows;
+  const int total_cols = s1.ape_cols*s1.chip_cols;
+  const int n_apes = total_rows*total_cols;
+  const size_t n_cells = size_t(params.max_x_cell)*params.max_y_cell;
+  int n_threads = int(std::thread::hardware_concurrency());
+  if (n_threads < 1)
+    n_threads = 1;
+  n_threads = std::min(n_threads, n_apes);
+  const int ape_group = 64;   // APEs per group in event-based transport
+
+  // Transport particles on all threads.
+  auto start_time = std::chrono::steady_clock::now();
+  std::atomic<int> next_ape(0);
+  std::vector<ThreadResult> results(n_threads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < n_threads; ++t)
+    threads.emplace_back([&, t]() {
+      ThreadResult& res = results[t];
+      res.tally.assign(n_cells, 0.0);
+      if (s1.transport == EventTransport)
+        for (int a0 = next_ape.fetch_add(ape_group); a0 < n_apes;
+             a0 = next_ape.fetch_add(ape_group)) {
+          std::vector<uint64_t> first_history;
+          for (int a = a0; a < std::min(a0 + ape_group, n_apes); ++a)
+            first_history.push_back(uint64_t(a)*params.n_particles);
+          HostRandom rng(seed, int(first_history.size()));
+          run_apes_by_event(params, s1.refill, first_history, rng, res);
+        }
+      else
+        for (int a = next_ape++; a < n_apes; a = next_ape++) {
+          HostRandom rng(seed, HostRandom::batch_blocks);
+          run_one_ape(params, uint64_t(a)*params.n_particles, rng, res);
+        }
+    });
+  for (auto& th : threads)
+    th.join();
+
+  // Reduce the per-thread results.
+  std::vector<double> tally(n_cells, 0.0);
+  unsigned long long histories = 0;
+  unsigned long long steps = 0;
+  unsigned long long ape_steps = 0;
+  for (const auto& res : results) {
+    for (size_t i = 0; i < n_cells; ++i)
+      tally[i] += res.tally[i];
+    histories += res.histories;
+    steps += res.steps;
+    ape_steps += res.ape_steps;
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start_time;
+
+  // Report the tallies and the performance.
+  double total = print_tally(params, tally.data());
+  std::cout << "Total absorbed energy: " << total << '\n'
+            << "Histories:             " << histories << '\n'
+            << "Transport steps:       " << steps << '\n'
+            << "Threads:               " << n_threads << '\n';
+  if (ape_steps > 0)
+    std::cout << "APE occupancy:         " << double(steps)/ape_steps << '\n';
+  std::cout << "Elapsed seconds:       " << elapsed.count() << '\n'
+            << "Histories/second:      " << histories/elapsed.count()
+            << std::endl;
+  if (s1.tally_output != nullptr)
+    return write_tally_file(s1.tally_output, CPUBackend,
+                            params.max_x_cell, params.max_y_cell,
+                            histories, seed, tally.data(),
+                            total_rows, total_cols, nullptr);
+  return true;
+}
@@ -32,6 +32,19 @@ parser.add_argument('--generate', default='c', choices=['c', 'c++', 'nova'],
                     help='Type of code to generate (C, C++, or Nova)')
 parser.add_argument('--datatype', default='double',
                     help='C numeric datatype to use when generating C code')
+parser.add_argument('--fit', default='chebyshev', choices=['chebyshev', 'minimax'],
+                    help='Interpolate at the Chebyshev nodes or minimize the maximum error (Remez)')
+parser.add_argument('--eval', dest='scheme', default='chebyshev',
+                    choices=['chebyshev', 'clenshaw', 'horner'],
+                    help='Evaluate the polynomials explicitly, by Clenshaw recurrence, or by Horner\'s rule')
+parser.add_argument('--drop-below', type=float, default=1e-6,
+                    help='Omit terms whose coefficients are smaller than this fraction of the largest')
+parser.add_argument('--bits', type=int, default=10,
+                    help='Fraction bits to which to round each operation when measuring error')
+parser.add_argument('--tolerance', type=float,
+                    help='Greatest acceptable absolute error (default: four units in the last place of the function\'s largest value)')
+parser.add_argument('--search', action='store_true',
+                    help='Generate the cheapest approximation, with at most NUM_POLYS polynomials, that meets the tolerance')
 cl_args = parser.parse_args()
 fname = cl_args.name
 func = eval('lambda x: %s' % cl_args.function)
@@ -40,115 +53,356 @@ a = cl_args.lb
 b = cl_args.ub
 dtype = cl_args.datatype
 
-# Find the Chebyshev nodes.
-us = []
-for i in range(1, n + 1):
-    us.append(cos(pi*(2*i - 1)/(2*n)))
-us.sort()
-xs = [u*(b - a)/2 + (b + a)/2 for u in us]
-ys = [func(x) for x in xs]
+def quantize(v):
+    'Round v to the precision of an Approx.'
+    if v == 0.0 or not isfinite(v):
+        return v
+    m, e = frexp(v)
+    scale = 2.0**(cl_args.bits + 1)
+    return ldexp(floor(m*scale + 0.5)/scale, e)
+
+# Sample the range densely to fit and to measure errors.  Errors are
+# measured at inputs an Approx can represent.
+grid = [a + (b - a)*i/4096 for i in range(4097)]
+qgrid = [quantize(x) for x in grid if a <= quantize(x) <= b]
+fmax = max([abs(func(x)) for x in grid])
+tolerance = cl_args.tolerance
+if tolerance is None:
+    # Rounding each operation alone costs an ulp or two, so allow a few.
+    ulp = 2.0**(floor(log2(fmax)) - cl_args.bits) if fmax > 0 else 2.0**-cl_args.bits
+    tolerance = 4*ulp
 
 def cheb_poly(i, x):
-    return cos(i*acos(x))
-
-# Find the Chebyshev coefficients.
-cs = []
-cs.append(sum(ys)/n)
-uys = list(zip(us, ys))
-for i in range(1, n):
-    cs.append(2*sum([cheb_poly(i, u)*y for u, y in uys])/n)
-
-def generate_c(w, cs):
-    'Generate C code using a given datatype.'
-    make_num = lambda x: '%s(%.20g)' % (dtype, x)
-    w.write('// Approximate %s on [%.5g, %.5g] using %d Chebyshev polynomials.\n' %
-            (cl_args.function, a, b, n))
-    w.write('%s %s(%s num)\n' % (dtype, fname, dtype))
-    w.write('{\n')
-    w.write('  // Scale num from [%.5g, %.5g] to [-1, 1].\n' % (a, b))
-    w.write('  num = (%s*num - %s - %s)/(%s - %s);\n' %
-            (make_num(2), make_num(a), make_num(b), make_num(b), make_num(a)))
-    w.write('\n')
-    w.write('  // Instantiate the Chebyshev polynomials.\n')
-    w.write('  %s num2 = num*%s;\n' % (dtype, make_num(2)))
-    for i in range(n):
-        if i == 0:
-            w.write('  %s t0 = %s;\n' % (dtype, make_num(1)))
-        elif i == 1:
-            w.write('  %s t1 = num;\n' % dtype)
-        else:
-            w.write('  %s t%d = num2*t%d - t%d;\n' % (dtype, i, i - 1, i - 2))
-    w.write('\n')
-    w.write('  // Compute a linear combination of the Chebyshev polynomials.\n')
-    w.write('  %s sum = %s*t0;\n' % (dtype, make_num(cs[0])))
+    return cos(i*acos(max(-1.0, min(1.0, x))))
+
+def to_u(x):
+    'Scale x from [a, b] to [-1, 1].'
+    return (2*x - a - b)/(b - a)
+
+def fit_chebyshev(n):
+    'Interpolate func at the n Chebyshev nodes.'
+    us = []
+    for i in range(1, n + 1):
+        us.append(cos(pi*(2*i - 1)/(2*n)))
+    us.sort()
+    xs = [u*(b - a)/2 + (b + a)/2 for u in us]
+    ys = [func(x) for x in xs]
+    cs = []
+    cs.append(sum(ys)/n)
+    uys = list(zip(us, ys))
     for i in range(1, n):
-        w.write('  sum += %s*t%d;\n' % (make_num(cs[i]), i))
-    w.write('  return sum;\n')
-    w.write('}\n')
+        cs.append(2*sum([cheb_poly(i, u)*y for u, y in uys])/n)
+    return cs
+
+def solve(m, v):
+    'Solve the linear system m*x = v by Gaussian elimination.'
+    size = len(v)
+    m = [row[:] + [v[i]] for i, row in enumerate(m)]
+    for c in range(size):
+        p = max(range(c, size), key=lambda r: abs(m[r][c]))
+        m[c], m[p] = m[p], m[c]
+        for r in range(c + 1, size):
+            f = m[r][c]/m[c][c]
+            for k in range(c, size + 1):
+                m[r][k] -= f*m[c][k]
+    x = [0.0]*size
+    for r in reversed(range(size)):
+        x[r] = (m[r][size] - sum([m[r][k]*x[k] for k in range(r + 1, size)]))/m[r][r]
+    return x
+
+def fit_minimax(n):
+    'Minimize the maximum absolute error of n Chebyshev polynomials by the Remez exchange algorithm.'
+    us = [-cos(pi*i/n) for i in range(n + 1)]
+    grid_us = [to_u(x) for x in grid]
+    grid_ys = [func(x) for x in grid]
+    cs = fit_chebyshev(n)
+    for iteration in range(50):
+        # Level the error at the reference points.
+        m = [[cheb_poly(j, u) for j in range(n)] + [(-1)**i] for i, u in enumerate(us)]
+        sol = solve(m, [func(u*(b - a)/2 + (b + a)/2) for u in us])
+        cs, level = sol[:n], abs(sol[n])
+
+        # Find the extrema of the error, alternating in sign.
+        errs = [sum([c*cheb_poly(j, u) for j, c in enumerate(cs)]) - y
+                for u, y in zip(grid_us, grid_ys)]
+        ext = []
+        for i, e in enumerate(errs):
+            if 0 < i < len(errs) - 1 and \
+               not (abs(e) >= abs(errs[i - 1]) and abs(e) >= abs(errs[i + 1])):
+                continue
+            if ext and (e >= 0) == (errs[ext[-1]] >= 0):
+                if abs(e) > abs(errs[ext[-1]]):
+                    ext[-1] = i
+            else:
+                ext.append(i)
+        while len(ext) > n + 1:
+            if abs(errs[ext[0]]) < abs(errs[ext[-1]]):
+                ext.pop(0)
+            else:
+                ext.pop()
+        if len(ext) < n + 1:
+            break
+        us = [grid_us[i] for i in ext]
+        if max([abs(e) for e in errs]) <= level*(1 + 1e-6):
+            break
+    return cs
+
+def power_coeffs(cs):
+    'Convert coefficients of Chebyshev polynomials to coefficients of powers.'
+    ts = [[1], [0, 1]]
+    while len(ts) < len(cs):
+        t = [0] + [2*c for c in ts[-1]]
+        for i, c in enumerate(ts[-2]):
+            t[i] -= c
+        ts.append(t)
+    ps = [0.0]*len(cs)
+    for c, t in zip(cs, ts):
+        for i, k in enumerate(t):
+            ps[i] += c*k
+    return ps
+
+# Represent the generated code as statements over expression trees so that
+# every language, the operation counts, and the error measurements agree.
+# An expression is ('const', value), ('var', name), or (op, lhs, rhs) with
+# op one of 'add', 'sub', or 'mul'.
+
+def const(v):
+    return ('const', v)
+
+def var(name):
+    return ('var', name)
+
+def is_const(e, v=None):
+    return e[0] == 'const' and (v is None or e[1] == v)
+
+def add(x, y):
+    if is_const(x, 0.0):
+        return y
+    if is_const(y, 0.0):
+        return x
+    if is_const(x):
+        x, y = y, x
+    if is_const(y) and x[0] == 'add' and is_const(x[2]):
+        return add(x[1], const(x[2][1] + y[1]))
+    return ('add', x, y)
+
+def sub(x, y):
+    if is_const(y, 0.0):
+        return x
+    if is_const(y):
+        return ('add', x, const(-y[1]))
+    return ('sub', x, y)
+
+def mul(x, y):
+    if is_const(x, 0.0) or is_const(y, 0.0):
+        return const(0.0)
+    if is_const(x, 1.0):
+        return y
+    if is_const(y, 1.0):
+        return x
+    if is_const(x):
+        x, y = y, x
+    return ('mul', x, y)
 
-def generate_cpp(w, cs):
-    'Generate C++ code using a given datatype.'
-    make_num = lambda x: '%s(%.20g)' % (dtype, x)
-    w.write('// Approximate %s on [%.5g, %.5g] using %d Chebyshev polynomials.\n' %
-            (cl_args.function, a, b, n))
-    w.write('%s %s(%s num)\n' % (dtype, fname, dtype))
+def count_ops(e):
+    if e[0] in ('const', 'var'):
+        return 0
+    return 1 + count_ops(e[1]) + count_ops(e[2])
+
+def keep_terms(cs):
+    'Zero coefficients too small to matter.'
+    big = max([abs(c) for c in cs])
+    return [c if abs(c) >= cl_args.drop_below*big else 0.0 for c in cs]
+
+def scale_input(stmts):
+    'Scale x from [a, b] to [-1, 1] in num.'
+    if a == -1.0 and b == 1.0:
+        return var('x')
+    stmts.append(('def', 'num', add(mul(var('x'), const(2.0/(b - a))), const(-(a + b)/(b - a)))))
+    return var('num')
+
+def emit_chebyshev(cs):
+    'Instantiate the Chebyshev polynomials and sum the terms that matter.'
+    stmts = []
+    num = scale_input(stmts)
+    last = max([i for i, c in enumerate(cs) if c != 0.0] + [0])
+    ts = [const(1.0), num]
+    if last >= 2:
+        stmts.append(('def', 'num2', mul(num, const(2.0))))
+    for i in range(2, last + 1):
+        stmts.append(('def', 't%d' % i, sub(mul(var('num2'), ts[i - 1]), ts[i - 2])))
+        ts.append(var('t%d' % i))
+    terms = [mul(ts[i], const(c)) for i, c in enumerate(cs) if c != 0.0]
+    stmts.append(('def', 'sum', terms[0] if terms else const(0.0)))
+    for t in terms[1:]:
+        stmts.append(('set', 'sum', add(var('sum'), t)))
+    stmts.append(('ret', var('sum')))
+    return stmts
+
+def emit_clenshaw(cs):
+    'Sum the Chebyshev series by Clenshaw\'s recurrence.'
+    stmts = []
+    y = scale_input(stmts)
+    odd = [c for i, c in enumerate(cs) if i%2 == 1 and c != 0.0]
+    if not odd and len(cs) > 2:
+        # An even series in num is a series in T_2(num) = 2*num^2 - 1.
+        stmts.append(('def', 'y', add(mul(mul(y, y), const(2.0)), const(-1.0))))
+        y = var('y')
+        cs = cs[::2]
+    while len(cs) > 1 and cs[-1] == 0.0:
+        cs = cs[:-1]
+    if len(cs) > 2:
+        stmts.append(('def', 'y2', mul(y, const(2.0))))
+    b1, b2 = const(0.0), const(0.0)
+    for k in range(len(cs) - 1, 0, -1):
+        bk = add(sub(mul(var('y2'), b1), b2), const(cs[k]))
+        if not is_const(bk):
+            stmts.append(('def', 'b%d' % k, bk))
+            bk = var('b%d' % k)
+        b1, b2 = bk, b1
+    stmts.append(('ret', add(sub(mul(y, b1), b2), const(cs[0]))))
+    return stmts
+
+def emit_horner(cs):
+    'Evaluate the equivalent power series by Horner\'s rule.'
+    stmts = []
+    u = scale_input(stmts)
+    ps = keep_terms(power_coeffs(cs))
+    while len(ps) > 1 and ps[-1] == 0.0:
+        ps = ps[:-1]
+    even = all([p == 0.0 for i, p in enumerate(ps) if i%2 == 1])
+    odd = all([p == 0.0 for i, p in enumerate(ps) if i%2 == 0])
+    factor = None
+    v = u
+    if len(ps) > 2 and (even or odd):
+        # Evaluate a series in num^2, times num if the series is odd.
+        stmts.append(('def', 'u2', mul(u, u)))
+        v = var('u2')
+        if odd:
+            factor = u
+            ps = ps[1::2]
+        else:
+            ps = ps[::2]
+    p = const(ps[-1])
+    for k in range(len(ps) - 2, -1, -1):
+        p = add(mul(p, v), const(ps[k]))
+        if k > 0:
+            stmts.append(('def' if not any(s[1] == 'p' for s in stmts) else 'set', 'p', p))
+            p = var('p')
+    if factor is not None:
+        p = mul(p, factor)
+    stmts.append(('ret', p))
+    return stmts
+
+def run(stmts, x):
+    'Evaluate the statements for an Approx x, rounding every operation.'
+    env = {'x': x}
+    def ev(e):
+        if e[0] == 'const':
+            return quantize(e[1])
+        if e[0] == 'var':
+            return env[e[1]]
+        lhs, rhs = ev(e[1]), ev(e[2])
+        if e[0] == 'add':
+            return quantize(lhs + rhs)
+        if e[0] == 'sub':
+            return quantize(lhs - rhs)
+        return quantize(lhs*rhs)
+    for s in stmts:
+        if s[0] == 'ret':
+            return ev(s[1])
+        env[s[1]] = ev(s[2])
+
+def candidate(n):
+    'Fit, trim, and emit n Chebyshev polynomials; return the code, its cost, and its error.'
+    cs = fit_minimax(n) if cl_args.fit == 'minimax' else fit_chebyshev(n)
+    cs = keep_terms(cs)
+    stmts = {'chebyshev': emit_chebyshev,
+             'clenshaw': emit_clenshaw,
+             'horner': emit_horner}[cl_args.scheme](cs)
+    ops = sum([count_ops(s[-1]) for s in stmts])
+    err = max([abs(run(stmts, x) - func(x)) for x in qgrid])
+    terms = len([c for c in cs if c != 0.0])
+    return stmts, ops, err, terms
+
+# Report every candidate, and choose the cheapest that is accurate enough,
+# or the most accurate if none is.
+sys.stderr.write('Tolerance: %.3g\n' % tolerance)
+sys.stderr.write('%5s %5s %4s %12s\n' % ('Polys', 'Terms', 'Ops', 'Max error'))
+cands = []
+for i in (range(1, n + 1) if cl_args.search else [n]):
+    stmts, ops, err, terms = candidate(i)
+    sys.stderr.write('%5d %5d %4d %12.4g%s\n' %
+                     (i, terms, ops, err, '' if err <= tolerance else '  (too inaccurate)'))
+    cands.append((err > tolerance, ops if err <= tolerance else err, i, stmts, ops, err))
+cands.sort(key=lambda c: c[:3])
+_, _, n, stmts, ops, err = cands[0]
+
+def render_c(e, prec=0):
+    'Render an expression in C or C++ syntax.'
+    if e[0] == 'const':
+        return '%.20g' % e[1] if cl_args.generate == 'c++' else '%s(%.20g)' % (dtype, e[1])
+    if e[0] == 'var':
+        return e[1]
+    if e[0] == 'mul':
+        return '%s*%s' % (render_c(e[1], 2), render_c(e[2], 2))
+    op = ' + ' if e[0] == 'add' else ' - '
+    rhs = e[2]
+    if e[0] == 'add' and is_const(rhs) and rhs[1] < 0:
+        op, rhs = ' - ', const(-rhs[1])
+    text = render_c(e[1], 1) + op + render_c(rhs, 2 if e[0] == 'sub' else 1)
+    return '(%s)' % text if prec > 1 else text
+
+def render_nova(e):
+    'Render an expression as Nova macro calls.'
+    if e[0] == 'const':
+        return 'AConst(%.20g)' % e[1]
+    if e[0] == 'var':
+        return e[1]
+    return '%s(%s, %s)' % ({'add': 'Add', 'sub': 'Sub', 'mul': 'Mul'}[e[0]],
+                           render_nova(e[1]), render_nova(e[2]))
+
+def describe():
+    return ('// Approximate %s on [%.5g, %.5g] using %d Chebyshev polynomials\n'
+            '// (%s fit, %s evaluation, %d operations, max error %.3g).\n' %
+            (cl_args.function, a, b, n, cl_args.fit, cl_args.scheme, ops, err))
+
+def generate_c(w, stmts):
+    'Generate C or C++ code using a given datatype.'
+    w.write(describe())
+    w.write('%s %s(%s x)\n' % (dtype, fname, dtype))
     w.write('{\n')
-    w.write('  // Scale num from [%.5g, %.5g] to [-1, 1].\n' % (a, b))
-    w.write('  num = (%s*num - %s - %s)/(%s - %s);\n' %
-            (make_num(2), make_num(a), make_num(b), make_num(b), make_num(a)))
-    w.write('\n')
-    w.write('  // Instantiate the Chebyshev polynomials.\n')
-    w.write('  %s num2(num*%s);\n' % (dtype, make_num(2)))
-    for i in range(n):
-        if i == 0:
-            w.write('  %s t0(%s);\n' % (dtype, make_num(1)))
-        elif i == 1:
-            w.write('  %s t1(num);\n' % dtype)
+    for s in stmts:
+        if s[0] == 'ret':
+            w.write('  return %s;\n' % render_c(s[1]))
+        elif s[0] == 'set' and s[2][0] == 'add' and s[2][1] == var(s[1]):
+            w.write('  %s += %s;\n' % (s[1], render_c(s[2][2])))
+        elif s[0] == 'set':
+            w.write('  %s = %s;\n' % (s[1], render_c(s[2])))
+        elif cl_args.generate == 'c++':
+            w.write('  %s %s(%s);\n' % (dtype, s[1], render_c(s[2])))
         else:
-            w.write('  %s t%d(num2*t%d - t%d);\n' % (dtype, i, i - 1, i - 2))
-    w.write('\n')
-    w.write('  // Compute a linear combination of the Chebyshev polynomials.\n')
-    w.write('  %s sum(t0*%s);\n' % (dtype, make_num(cs[0])))
-    for i in range(1, n):
-        w.write('  sum += t%d*%s;\n' % (i, make_num(cs[i])))
-    w.write('  return sum;\n')
+            w.write('  %s %s = %s;\n' % (dtype, s[1], render_c(s[2])))
     w.write('}\n')
 
-def generate_nova(w, cs):
+def generate_nova(w, stmts):
     'Generate Nova code using approxes as the datatype.'
-    make_num = lambda x: 'AConst(%.20g)' % x
-    w.write('// Approximate %s on [%.5g, %.5g] using %d Chebyshev polynomials.\n' %
-            (cl_args.function, a, b, n))
+    w.write(describe())
     w.write('void %s(scExpr x, scExpr result)\n' % fname)
     w.write('{\n')
-    w.write('  // Scale num from [%.5g, %.5g] to [-1, 1].\n' % (a, b))
-    w.write('  DeclareApeVar(num, Approx);\n')
-    w.write('  Set(num, Div(Sub(Mul(%s, x), %s), %s))\n' %
-            (make_num(2), make_num(a + b), make_num(b - a)))
-    w.write('\n')
-    w.write('  // Instantiate the Chebyshev polynomials.\n')
-    w.write('  DeclareApeVar(num2, Approx);\n')
-    w.write('  Set(num2, Mul(num, %s));\n' % make_num(2))
-    t = [make_num(1), 'num'] + ['t%d' % i for i in range(2, n)]
-    for i in range(2, n):
-        w.write('  DeclareApeVar(t%d, Approx);\n' % i)
-        w.write('  Set(%s, Sub(Mul(num2, %s), %s));\n' %
-                (t[i], t[i - 1], t[i - 2]))
-    w.write('\n')
-    w.write('  // Compute a linear combination of the Chebyshev polynomials.\n')
-    w.write('  DeclareApeVar(sum, Approx);\n')
-    w.write('  Set(sum, %s);\n' % make_num(cs[0]))
-    for i in range(1, n):
-        w.write('  Set(sum, Add(sum, Mul(%s, %s)));\n' % (make_num(cs[i]), t[i]))
-    w.write('  Set(result, sum);\n')
+    for s in stmts:
+        if s[0] == 'def':
+            w.write('  DeclareApeVar(%s, Approx);\n' % s[1])
+        if s[0] == 'ret':
+            w.write('  Set(result, %s);\n' % render_nova(s[1]))
+        else:
+            w.write('  Set(%s, %s);\n' % (s[1], render_nova(s[2])))
     w.write('}\n')
 
 # Write a function to a file.
-if cl_args.generate == 'c':
-    generate_c(cl_args.output, cs)
-elif cl_args.generate == 'c++':
-    generate_cpp(cl_args.output, cs)
+if cl_args.generate in ('c', 'c++'):
+    generate_c(cl_args.output, stmts)
 elif cl_args.generate == 'nova':
-    generate_nova(cl_args.output, cs)
+    generate_nova(cl_args.output, stmts)
 else:
     sys.exit('Unexpected generation type %s' % repr(cl_args.generate))
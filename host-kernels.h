@@ -0,0 +1,370 @@
+/*
+ * Host-side mirrors of the kernels emit_nova_code() runs on each APE.  The
+ * CPU engine transports particles with them, and the micro-benchmarks in
+ * bench.cpp time them.
+ */
+
+#ifndef _HOST_KERNELS_H_
+#define _HOST_KERNELS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "host.h"
+
+const double two_pi = 2*M_PI;
+
+// Number of random numbers get_angle() consumes
+#if DIRECTION_METHOD == DIRECTION_2D
+const int angle_randoms = 1;
+#else
+const int angle_randoms = 2;
+#endif
+
+// Mirror get_random_draw() for a group of histories, one per stream: each
+// stream delivers, as draws of four 16-bit numbers, two per block, high
+// half of each word first, the stream of the history last started on it,
+// which the history's global index and the seed select.  A history takes
+// only four or five blocks on average, so rather than generating a batch
+// of one history's blocks and discarding most of them, each batch
+// generates the next block of every stream with a history in progress,
+// each under its own key, starting with the stream that ran dry.  Callers
+// that transport one history at a time should start the following
+// histories on other streams ahead of time to keep the batches full.
+class HostRandom {
+public:
+  static const int batch_blocks = 16;   // Blocks per batch
+
+private:
+  static const int max_ready = 32;      // Blocks a stream can hold
+
+  // Hold one history's key and its generated but unused blocks.
+  struct Stream {
+    uint32_t key[4];                    // Key (history index plus seed)
+    uint32_t next_block;                // Counter of the next block to generate
+    uint32_t blocks[max_ready][4];      // Ring of generated blocks
+    int head;                           // Index of the block to draw from
+    int n_ready;                        // Blocks generated but not used up
+    int half;                           // Half of the head block to draw next
+    bool active;                        // Whether a history is in progress
+  };
+
+  unsigned long long seed;              // Seed shared by every history
+  std::vector<Stream> streams;
+  uint32_t ctr[batch_blocks][4];        // Counters of a batch
+  uint32_t keys[batch_blocks][4];       // Keys of a batch
+  uint32_t out[batch_blocks][4];        // Blocks of a batch
+  uint32_t* dest[batch_blocks];         // Where each block of a batch goes
+
+  // Generate a batch of blocks, one for each active stream that has room,
+  // starting with stream s, and repeat until the batch is full or no
+  // stream has room.
+  void refill(int s) {
+    const int n_streams = int(streams.size());
+    int n = 0;
+    for (int added = 1; added > 0 && n < batch_blocks; ) {
+      added = 0;
+      for (int k = 0; k < n_streams && n < batch_blocks; ++k) {
+        Stream& st = streams[(s + k)%n_streams];
+        if (!st.active || st.n_ready == max_ready)
+          continue;
+        ctr[n][0] = st.next_block++;
+        std::copy(st.key, st.key + 4, keys[n]);
+        dest[n] = st.blocks[(st.head + st.n_ready++)%max_ready];
+        ++n;
+        ++added;
+      }
+    }
+    random4x32_host_batch_keys(n, ctr, keys, out);
+    for (int i = 0; i < n; ++i)
+      std::copy(out[i], out[i] + 4, dest[i]);
+  }
+
+public:
+  HostRandom(unsigned long long seed, int n_streams)
+    : seed(seed), streams(n_streams) {
+    for (Stream& st : streams)
+      st.active = false;
+    for (int b = 0; b < batch_blocks; ++b)
+      for (int i = 1; i < 4; ++i)
+        ctr[b][i] = 0;
+  }
+
+  // Return the number of streams.
+  int size() const {
+    return int(streams.size());
+  }
+
+  // Switch stream s to the given history, starting at its first block.
+  void start(int s, uint64_t history) {
+    Stream& st = streams[s];
+    threefry_key_host(history, seed, st.key);
+    st.next_block = 0;
+    st.head = 0;
+    st.n_ready = 0;
+    st.half = 0;
+    st.active = true;
+  }
+
+  // Stop generating blocks for stream s until another history starts on it.
+  void stop(int s) {
+    streams[s].active = false;
+  }
+
+  // Store stream s's next draw in r, as numbers in [0, 65535].
+  void next_draw(int s, int r[4]) {
+    Stream& st = streams[s];
+    if (st.n_ready == 0)
+      refill(s);
+    const uint32_t* block = st.blocks[st.head];
+    for (int i = 0; i < 2; ++i) {
+      r[2*i] = int(block[2*st.half + i] >> 16);
+      r[2*i + 1] = int(block[2*st.half + i] & 0xFFFF);
+    }
+    st.half = 1 - st.half;
+    if (st.half == 0) {
+      st.head = (st.head + 1)%max_ready;
+      --st.n_ready;
+    }
+  }
+};
+
+// Mirror int_to_approx01(): convert an integer in [0, 65535] to [0, 1].
+inline double int_to_01(int i_val)
+{
+  return i_val/65536.0;
+}
+
+// Mirror ln_of_int(): compute ln(r/65535) for r in [0, 65535].  The S1
+// version treats 0 as 1.
+inline double ln_of_int(int r)
+{
+  return std::log(double(std::max(r, 1))) - std::log(65535.0);
+}
+
+// The functions below port the S1's own algorithms to the host, performing
+// the same arithmetic as the kernels in utils.cpp but in double precision.
+// The CPU engine uses the library versions above, but bench.cpp times both
+// to show what each S1 algorithm costs relative to libm.
+
+// Mirror the tables that init_math_tables() fills in.
+struct HostMathTables {
+  double ln_center[32];     // ln(c) for the center c of each subinterval
+  double ln_scale[32];      // 1/(65536*c) for each subinterval
+  double nibble_value[16];  // i as a double, for i in [0, 15]
+  double ln_factor[5];      // ln(1 + 2^-j), which the S1 kernel builds in
+
+  HostMathTables() {
+    for (int i = 0; i < 32; ++i) {
+      double center = (32 + i)*1024 + 511.5;  // Times 65536
+      ln_center[i] = std::log(center/65536.0);
+      ln_scale[i] = 1.0/center;
+    }
+    for (int i = 0; i < 16; ++i)
+      nibble_value[i] = double(i);
+    for (int j = 0; j < 5; ++j)
+      ln_factor[j] = std::log(1.0 + std::ldexp(1.0, -j));
+  }
+};
+inline const HostMathTables host_math_tables;
+
+// Port int_to_approx01(): convert an integer in [0, 65535] to [0, 1] by
+// looking up four bits at a time.
+inline double int_to_approx01_s1(int i_val)
+{
+  const double* nibble = host_math_tables.nibble_value;
+  double a_val = nibble[i_val & 15]*0.0625 + nibble[(i_val >> 4) & 15];
+  a_val = a_val*0.0625 + nibble[(i_val >> 8) & 15];
+  a_val = a_val*0.0625 + nibble[(i_val >> 12) & 15];
+  return a_val*0.0625;
+}
+
+// Port cos_sin_2pi(): approximate cos(2*pi*u) and sin(2*pi*u) for u in
+// [0, 1] using 6 Chebyshev polynomials, which the two functions share.
+inline void cos_sin_2pi_s1(double u, double* cos_val, double* sin_val)
+{
+  double num = u*2.0 - 1.0;
+  double num2 = num*2.0;
+  double t0 = 1.0;
+  double t1 = num;
+  double t2 = num2*t1 - t0;
+  double t3 = num2*t2 - t1;
+  double t4 = num2*t3 - t2;
+  double t5 = num2*t4 - t3;
+  *cos_val = t0*0.30420407768492924161 + t4*-0.33194352475813920789 +
+    t2*0.97226055289980561902;
+  *sin_val = t1*-0.56923064009501811444 + t3*0.66716913685894241315 +
+    t5*-0.11112410957439385062;
+}
+
+// Port ln_of_int_shift_subtract(): compute ln(r/65535) for r in
+// [0, 65535] as a sum of the logarithms of factors 1 + 2^-j, in 32-bit
+// unsigned arithmetic.  r = 0 is treated as 1.
+inline double ln_of_int_shift_subtract_s1(int r)
+{
+  uint32_t a = uint32_t(r & 0xFFFF);  // Numerator
+  uint32_t b = 1;                     // Denominator
+  double lg = 0.0;
+  for (int j = 0; j < 5; ++j) {
+    for (int k = 0; k < 16; ++k)
+      if (a >= b) {
+        lg += host_math_tables.ln_factor[j];
+        a = (a - b) << j;
+        b += b << j;
+      }
+    a <<= 1;
+  }
+  return lg - std::log(65535.0);
+}
+
+// Port normalize_for_ln(): shift m left until bit 15 is set, finding the
+// leading bit by binary search, and return the number of shifts.  m = 0 is
+// treated as 1.
+inline int normalize_for_ln_s1(int* m)
+{
+  int k = 0;
+  if (*m == 0)
+    *m = 1;
+  for (int s = 8; s >= 1; s /= 2)
+    if (((*m >> (16 - s)) & ((1 << s) - 1)) == 0) {
+      *m <<= s;
+      k += s;
+    }
+  return k;
+}
+
+// Port denormalize_ln(): return ln(r/65535) given ln(m/65536) for the m
+// and k to which normalize_for_ln_s1() reduced r.
+inline double denormalize_ln_s1(double ln_m, int k)
+{
+  return ln_m + std::log(65536.0/65535.0) -
+    host_math_tables.nibble_value[k]*std::log(2.0);
+}
+
+// Port ln_of_int_chebyshev(): compute ln(r/65535) by normalizing r to
+// [1/2, 1) and approximating ln(x) there with 6 Chebyshev polynomials.
+inline double ln_of_int_chebyshev_s1(int r)
+{
+  int m = r & 0xFFFF;
+  int k = normalize_for_ln_s1(&m);
+  double num = int_to_approx01_s1(m)*4.0 - 3.0;
+  double num2 = num*2.0;
+  double t0 = 1.0;
+  double t1 = num;
+  double t2 = num2*t1 - t0;
+  double t3 = num2*t2 - t1;
+  double t4 = num2*t3 - t2;
+  double t5 = num2*t4 - t3;
+  double sum = t0*-0.31669436753229918136 + t1*0.34314574980088347056 +
+    t2*-0.029437247099165869679 + t3*0.00336706062487532971 +
+    t4*-0.00043308816054383157679 + t5*5.8220244616304386799e-05;
+  return denormalize_ln_s1(sum, k);
+}
+
+// Port ln_of_int_table(): compute ln(r/65535) by normalizing r to m/65536
+// in [1/2, 1) and expanding ln(m/65536) about the center of its 1/64-wide
+// subinterval.
+inline double ln_of_int_table_s1(int r)
+{
+  int m = r & 0xFFFF;
+  int k = normalize_for_ln_s1(&m);
+  const double* nibble = host_math_tables.nibble_value;
+  int idx = (m >> 10) & 31;
+  double low = (nibble[(m >> 6) & 15]*16.0 + nibble[(m >> 2) & 15])*4.0 +
+    nibble[m & 3];
+  double t = (low - 511.5)*host_math_tables.ln_scale[idx];
+  return denormalize_ln_s1(host_math_tables.ln_center[idx] + (t - t*t*0.5), k);
+}
+
+// Port ln_of_int(): compute ln(r/65535) using the method selected at build
+// time.
+inline double ln_of_int_s1(int r)
+{
+#if LN_METHOD == LN_SHIFT_SUBTRACT
+  return ln_of_int_shift_subtract_s1(r);
+#elif LN_METHOD == LN_CHEBYSHEV
+  return ln_of_int_chebyshev_s1(r);
+#else
+  return ln_of_int_table_s1(r);
+#endif
+}
+
+// Mirror get_angle(): sample a simple 2-D angle from the random numbers
+// starting at r.
+inline void get_angle(const int* r, double angle[2])
+{
+  double phi = int_to_01(r[0])*two_pi;
+#if DIRECTION_METHOD == DIRECTION_2D
+  angle[0] = std::cos(phi);
+  angle[1] = std::sin(phi);
+#else
+  double mu = int_to_01(r[1])*2.0 - 1.0;
+  double eta = std::sqrt(1.0 - mu*mu);
+  angle[0] = eta*std::cos(phi);
+  angle[1] = eta*std::sin(phi);
+#endif
+}
+
+// Mirror get_distance_to_boundary(): return the distance to a boundary and
+// the face that will be crossed (4-7 signify a double crossing).
+inline double get_distance_to_boundary(int* cross_face,
+                                       const double pos[2],
+                                       const double angle[2])
+{
+  static const double vertices[4] = {0.0, 1.0, 0.0, 1.0};
+  double min_distance = 1.0e6;
+  double distances[2];
+  *cross_face = -1;
+  for (int i = 0; i < 2; ++i) {
+    int angle_sign = angle[i] < -1.0e-10 ? 0 : 1;
+    distances[i] = (vertices[angle_sign + i + i] - pos[i])/angle[i];
+    if (distances[i] < min_distance) {
+      *cross_face = angle_sign + i + i;
+      min_distance = distances[i];
+    }
+  }
+  if (distances[0] == distances[1]) {
+    if (angle[0] > 1.0e-19)
+      *cross_face = angle[1] > 1.0e-19 ? 4 : 5;
+    else
+      *cross_face = angle[1] > 1.0e-19 ? 6 : 7;
+  }
+  return min_distance;
+}
+
+// Mirror cross_boundary(): move a particle into the neighboring cell across
+// cross_face, returning false if it left the domain.
+inline bool cross_boundary(const IMCParams& p, int cross_face,
+                           int* x_cell, int* y_cell, double pos[2])
+{
+  switch (cross_face) {
+    case 0: --*x_cell; pos[0] = 1.0; break;
+    case 1: ++*x_cell; pos[0] = 0.0; break;
+    case 2: --*y_cell; pos[1] = 1.0; break;
+    case 3: ++*y_cell; pos[1] = 0.0; break;
+    case 4: ++*x_cell; ++*y_cell; pos[0] = 0.0; pos[1] = 0.0; break;
+    case 5: ++*x_cell; --*y_cell; pos[0] = 0.0; pos[1] = 1.0; break;
+    case 6: --*x_cell; ++*y_cell; pos[0] = 1.0; pos[1] = 0.0; break;
+    case 7: --*x_cell; --*y_cell; pos[0] = 1.0; pos[1] = 1.0; break;
+    default: break;
+  }
+  return *x_cell < p.max_x_cell && *x_cell >= 0 &&
+         *y_cell < p.max_y_cell && *y_cell >= 0;
+}
+
+// Mirror the event selection of transport_step(): classify the event that
+// ends a step of length d_move.  Ties go to census, then absorption, then
+// scattering, as on the S1.
+inline event_t classify_event(double d_move, double d_census,
+                              double d_absorb, double d_scatter)
+{
+  if (d_move == d_census)
+    return CensusEvent;
+  if (d_move == d_absorb)
+    return AbsorbEvent;
+  if (d_move == d_scatter)
+    return ScatterEvent;
+  return BoundaryEvent;
+}
+
+#endif
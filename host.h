@@ -0,0 +1,218 @@
+/*
+ * Host-side definitions for a simple billion-core Monte Carlo simulation.
+ * Nothing in this file depends on Nova, so it can be used by code that
+ * never touches the S1.
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Select how ln_of_int() computes logarithms.  check_ln_methods() reports
+// each method's cost and accuracy.
+#define LN_SHIFT_SUBTRACT 0  // Shift and subtract, one bit at a time
+#define LN_CHEBYSHEV      1  // Normalization, then a Chebyshev polynomial
+#define LN_TABLE          2  // Normalization, a table, then a short series
+#ifndef LN_METHOD
+# define LN_METHOD LN_TABLE
+#endif
+
+// Select how directions are sampled.
+#define DIRECTION_3D 0  // Project an isotropic 3-D direction onto the plane
+#define DIRECTION_2D 1  // Sample an isotropic direction in the plane
+#ifndef DIRECTION_METHOD
+# define DIRECTION_METHOD DIRECTION_3D
+#endif
+
+// Select the random-number generator behind get_random_draw() and the
+// number of rounds each generator performs.  Random123 recommends
+// Threefry-4x32-13 and Philox-4x32-10, and --check-rng tests any choice.
+#define RNG_THREEFRY 0  // Threefry-4x32: additions, rotations, and XORs
+#define RNG_PHILOX   1  // Philox-4x32: multiplications and XORs
+#ifndef RNG_METHOD
+# define RNG_METHOD RNG_THREEFRY
+#endif
+#ifndef THREEFRY_ROUNDS
+# define THREEFRY_ROUNDS 20
+#endif
+#ifndef PHILOX_ROUNDS
+# define PHILOX_ROUNDS 10
+#endif
+
+// Specify where the simulation runs.
+typedef enum {
+  S1Backend,   // S1 hardware or emulator
+  CPUBackend   // Native C++ on the host's cores
+} backend_t;
+
+// Specify how particles are transported.
+typedef enum {
+  HistoryTransport,  // Each particle's event is processed where it occurs
+  EventTransport     // Events are classified, then processed one type at a time
+} transport_t;
+
+// Enumerate the events that can end a particle's transport step.
+typedef enum {
+  NoEvent,           // The particle is dead
+  CensusEvent,
+  AbsorbEvent,
+  ScatterEvent,
+  BoundaryEvent
+} event_t;
+
+// Encapsulate machine state.
+struct S1State {
+  backend_t backend;  // Where to run the simulation
+  transport_t transport;  // How particles are transported
+  bool refill;      // true=start a new particle as soon as one dies
+  bool decompose;   // true=each APE owns a tile of the mesh
+  int bank_slots;   // Particles each APE can hold when decomposed
+  bool emulated;    // true=emulated; false=real hardware
+  int trace_flags;  // Trace flags for emulator
+  int chip_cols;    // Columns of chips
+  int chip_rows;    // Rows of chips
+  int ape_cols;     // APE columns per chip
+  int ape_rows;     // APE rows per chip
+  const char* kernel_cache;  // Directory of cached kernels, or nullptr
+  int max_mesh_x;   // Cells in x the kernel can tally (0=the problem's)
+  int max_mesh_y;   // Cells in y the kernel can tally (0=the problem's)
+  bool profile;     // true=report the kernel's cost by source region
+  bool count_events;  // true=count events and busy APEs on the S1
+  bool check_ln;    // true=check ln_of_int() instead of simulating
+  bool check_rng;   // true=test the random-number generators instead
+  const char* tally_output;  // Binary tally file to write, or nullptr
+  bool ape_diagnostics;  // true=also record each APE's diagnostics there
+  int segment;      // Particles per APE per kernel launch (0=all at once)
+  const char* checkpoint;  // File to record progress in after each launch
+  const char* restart;     // Checkpoint from which to resume, or nullptr
+
+  S1State() : backend(S1Backend), transport(HistoryTransport),
+              refill(false), decompose(false), bank_slots(8),
+              emulated(false), trace_flags(0),
+              chip_cols(1), chip_rows(1),
+              ape_cols(44), ape_rows(48),
+              kernel_cache(nullptr), max_mesh_x(0), max_mesh_y(0),
+              profile(false), count_events(false), check_ln(false),
+              check_rng(false), tally_output(nullptr), ape_diagnostics(false),
+              segment(0), checkpoint(nullptr), restart(nullptr)
+  {
+  }
+};
+
+// Encapsulate the physical problem being simulated.
+struct IMCParams {
+  int n_particles;  // Particles per APE (in total, if decomposed)
+  double c;         // Speed of light, in cm/shake
+  double dx;        // Cell size, square, in cm
+  double dt;        // Timestep size, in shakes (1e-8 seconds)
+  double mfp;       // Average distance, in cm, between scattering events
+  double sig_a;     // Absorption opacity
+  int start_x;      // Source cell in x
+  int start_y;      // Source cell in y
+  int max_x_cell;   // Number of cells in x
+  int max_y_cell;   // Number of cells in y
+
+  // The mesh size and source location were reduced from the original to
+  // fit in the S1's memory.
+  IMCParams() : n_particles(1000),  // Temporary -- should be 1000000
+                c(299.792), dx(0.01), dt(0.001), mfp(0.3), sig_a(10.0),
+                start_x(9), start_y(9),
+                max_x_cell(19), max_y_cell(19)
+  {
+  }
+};
+
+// Generate four 32-bit random numbers from a counter and a key exactly as
+// threefry4x32() does on the S1.
+extern void threefry4x32_host(const uint32_t ctr[4], const uint32_t key[4],
+                              uint32_t out[4], int rounds = THREEFRY_ROUNDS);
+
+// Generate n blocks of four 32-bit random numbers from n counters and a
+// shared key.  Each block is identical to what threefry4x32_host() returns,
+// but the blocks are computed 8 or 16 at a time on CPUs with AVX2 or
+// AVX-512.
+extern void threefry4x32_host_batch(size_t n, const uint32_t (*ctr)[4],
+                                    const uint32_t key[4], uint32_t (*out)[4],
+                                    int rounds = THREEFRY_ROUNDS);
+
+// Likewise, but with a key for each block, so that one batch can serve
+// several histories.
+extern void threefry4x32_host_batch_keys(size_t n, const uint32_t (*ctr)[4],
+                                         const uint32_t (*keys)[4],
+                                         uint32_t (*out)[4],
+                                         int rounds = THREEFRY_ROUNDS);
+
+// Return "scalar", "avx2", or "avx512": the instruction set
+// threefry4x32_host_batch() uses on this CPU.
+extern const char* threefry_host_isa();
+
+// Generate four 32-bit random numbers from a counter and a key exactly as
+// philox4x32() does on the S1.
+extern void philox4x32_host(const uint32_t ctr[4], const uint32_t key[4],
+                            uint32_t out[4], int rounds = PHILOX_ROUNDS);
+
+// Generate n blocks of four 32-bit random numbers from n counters and a
+// shared key (or, with the _keys form, n keys) using the generator
+// selected by RNG_METHOD.
+extern void random4x32_host_batch(size_t n, const uint32_t (*ctr)[4],
+                                  const uint32_t key[4], uint32_t (*out)[4]);
+extern void random4x32_host_batch_keys(size_t n, const uint32_t (*ctr)[4],
+                                       const uint32_t (*keys)[4],
+                                       uint32_t (*out)[4]);
+
+// Pack a history's global index and the seed into four 32-bit key words
+// in the same layout emit_nova_code() uses for key_3fry.
+extern void threefry_key_host(uint64_t history, unsigned long long seed,
+                              uint32_t key[4]);
+
+// Run statistical tests on the host's implementations of the generators,
+// returning true if the one RNG_METHOD selects passes them all.
+extern bool check_rng_battery(unsigned long long seed);
+
+// Record the progress of a run that launches its kernel several times.
+// Each launch runs a range of every APE's particles (of all particles, if
+// decomposed) to completion, and each history's random numbers depend
+// only on its index and the seed, so the tally and the index of the next
+// particle suffice to resume the run.
+struct Checkpoint {
+  long long next_particle;   // Particles each APE has run (in total, if
+                             //   decomposed)
+  double busy_iterations;    // Sum over launches of the mean occupancy
+                             //   times the transport iterations
+  double iterations;         // Transport iterations over all launches
+  std::vector<double> tally; // max_x_cell x max_y_cell tally, x major
+
+  Checkpoint() : next_particle(0), busy_iterations(0.0), iterations(0.0) { }
+};
+
+// Save a checkpoint to a file, returning false if it can't be written.
+// The file also records the settings that determine which histories the
+// run transports.
+extern bool save_checkpoint(const char* path, const S1State& s1,
+                            const IMCParams& params, unsigned long long seed,
+                            const Checkpoint& ckpt);
+
+// Read a checkpoint from a file, throwing std::runtime_error if it can't
+// be read or was saved by a run with different settings.
+extern Checkpoint load_checkpoint(const char* path, const S1State& s1,
+                                  const IMCParams& params,
+                                  unsigned long long seed);
+
+// Check that the problem parameters describe a problem either backend can
+// run, throwing std::invalid_argument if they don't.
+extern void check_params(const IMCParams& params);
+
+// Print a max_x_cell x max_y_cell tally, stored x major, one row of x per
+// line, and return its total.
+extern double print_tally(const IMCParams& params, const double* tally);
+
+// Run the simulation natively on the host, reporting the tallies and the
+// number of histories per second.  Return false if the tallies can't be
+// written to the file --tally-output names.
+extern bool run_cpu_engine(const S1State& s1, const IMCParams& params,
+                           unsigned long long seed);
+
+#endif
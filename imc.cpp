@@ -3,18 +3,36 @@
  */
 
 #include "simple-bcmc.h"
-#include <cassert>
+#include <cstdint>
+#include <stdexcept>
 
-// Sample a simple 2-D angle.  (The third dimension is not used for now.)
-NovaExpr get_angle()
+// Number of random numbers get_angle() consumes
+#if DIRECTION_METHOD == DIRECTION_2D
+const int angle_randoms = 1;
+#else
+const int angle_randoms = 2;
+#endif
+
+// Sample a simple 2-D angle into a 2-element APE vector from the
+// angle_randoms random numbers starting at randoms[first].  By default,
+// this is the projection of an isotropic 3-D direction onto the plane; the
+// third dimension is not used for now.  DIRECTION_2D instead samples an
+// isotropic direction in the plane, which takes one random number rather
+// than two and needs no square root.
+void get_angle(NovaExpr& angle, const std::vector<NovaExpr>& randoms, int first)
 {
-  NovaExpr phi(int_to_approx01(get_random_int())*TWO_PI);
-  NovaExpr mu(int_to_approx01(get_random_int())*2.0 - 1.0);
+  NovaProfileRegion profile("get_angle");
+  NovaExpr cos_phi, sin_phi;
+  cos_sin_2pi(int_to_approx01(randoms[first]), cos_phi, sin_phi);
+#if DIRECTION_METHOD == DIRECTION_2D
+  angle[0] = cos_phi;
+  angle[1] = sin_phi;
+#else
+  NovaExpr mu(int_to_approx01(randoms[first + 1])*2.0 - 1.0);
   NovaExpr eta(sqrt(NovaExpr(1.0) - mu*mu));
-  NovaExpr angle(0.0, NovaExpr::NovaApeMemVector, 2);
-  angle[0] = eta*cos_0_2pi(phi);
-  angle[1] = eta*sin_0_2pi(phi);
-  return angle;
+  angle[0] = eta*cos_phi;
+  angle[1] = eta*sin_phi;
+#endif
 }
 
 // Return the distance to a boundary.
@@ -23,8 +41,9 @@ NovaExpr get_distance_to_boundary(NovaExpr* cross_face,
                                   const NovaExpr& angle,
                                   const NovaExpr& x_cell,
                                   const NovaExpr& y_cell) {
+  NovaProfileRegion profile("get_distance_to_boundary");
   // Initialize the distance to each edge.
-  NovaExpr min_distance(1e-6);
+  NovaExpr min_distance(1.0e6);
   *cross_face = -1;
   NovaExpr vertices(0.0, NovaExpr::NovaApeMemVector, 4);
   vertices[0] = 0.0;
@@ -59,20 +78,156 @@ NovaExpr get_distance_to_boundary(NovaExpr* cross_face,
       *cross_face = 6;
     });
     NovaApeIf(angle[0] < 1.0e-19 && angle[1] < 1.0e-19, [&]() {
-      *cross_face = 6;
+      *cross_face = 7;
     });
   });
   return min_distance;
 }
 
+// Move a particle into the neighboring cell across cross_face (4-7 signify
+// a double crossing), killing it if it leaves the domain.
+void cross_boundary(const NovaExpr& max_x_cell, const NovaExpr& max_y_cell,
+                    const NovaExpr& cross_face,
+                    NovaExpr& x_cell, NovaExpr& y_cell,
+                    NovaExpr& pos, NovaExpr& alive)
+{
+  NovaProfileRegion profile("cross_boundary");
+  NovaApeIf (cross_face == 0, [&]() {
+    --x_cell;
+    pos[0] = 1.0;
+  });
+  NovaApeIf (cross_face == 1, [&]() {
+    ++x_cell;
+    pos[0] = 0.0;
+  });
+  NovaApeIf (cross_face == 2, [&]() {
+    --y_cell;
+    pos[1] = 1.0;
+  });
+  NovaApeIf (cross_face == 3, [&]() {
+    ++y_cell;
+    pos[1] = 0.0;
+  });
+  // Special event for double crossing: +x +y
+  NovaApeIf (cross_face == 4, [&]() {
+    ++x_cell;
+    ++y_cell;
+    pos[0] = 0.0;
+    pos[1] = 0.0;
+  });
+  // Special event for double crossing: +x -y
+  NovaApeIf (cross_face == 5, [&]() {
+    ++x_cell;
+    --y_cell;
+    pos[0] = 0.0;
+    pos[1] = 1.0;
+  });
+  // Special event for double crossing: -x, +y
+  NovaApeIf (cross_face == 6, [&]() {
+    --x_cell;
+    ++y_cell;
+    pos[0] = 1.0;
+    pos[1] = 0.0;
+  });
+  // Special event for double crossing: -x, -y
+  NovaApeIf (cross_face == 7, [&]() {
+    --x_cell;
+    --y_cell;
+    pos[0] = 1.0;
+    pos[1] = 1.0;
+  });
+  // Check if the particle exited the domain.
+  NovaApeIf (x_cell >= max_x_cell || x_cell < 0, [&]() {
+    alive = false;
+  });
+  NovaApeIf (y_cell >= max_y_cell || y_cell < 0, [&]() {
+    alive = false;
+  });
+}
+
+// Compute the contents of a kernel's parameter blocks for a launch that
+// runs particles first_particle through first_particle + particles - 1 of
+// each APE's share (of all particles, if decomposed), throwing
+// std::invalid_argument if the kernel cannot run the given problem.  The
+// caller must already have passed the parameters to check_params().
+void kernel_param_values(const S1State& s1, const IMCParams& params,
+                         unsigned long long seed,
+                         long long first_particle, long long particles,
+                         double approx_values[NumApproxParams],
+                         double int_values[NumIntParams])
+{
+  // The particle loop counts a launch's particles in 32 bits, but with
+  // --refill or --decompose each APE counts them down in an Int.
+  const int n_particles = params.n_particles;
+  if (n_particles >= 32767*65536)
+    throw std::invalid_argument("n_particles must be at most 2147418111");
+  if (particles < 1 || first_particle < 0 ||
+      first_particle + particles > n_particles)
+    throw std::invalid_argument("a launch must run between 1 and n_particles particles");
+  if ((s1.refill || s1.decompose) && particles > 32767)
+    throw std::invalid_argument("a launch can run at most 32767 particles with --refill or --decompose; use --segment");
+
+  // Check that the mesh fits.
+  if (params.max_x_cell > s1.max_mesh_x || params.max_y_cell > s1.max_mesh_y)
+    throw std::invalid_argument("the mesh is larger than the kernel supports");
+
+  approx_values[ParamStartWeight] = 1.0/n_particles;
+  approx_values[ParamCensusDistance] = params.dt*params.c;
+  approx_values[ParamRatio] = params.dx;
+  approx_values[ParamSigS] = 1.0/params.mfp;
+  approx_values[ParamSigA] = params.sig_a;
+  int_values[ParamParticles] = int16_t(particles);
+  int_values[ParamParticlesHi] = int16_t(particles >> 16);
+  int_values[ParamParticlesLo] = int16_t(particles & 0xFFFF);
+  int_values[ParamFirstHi] = int16_t(first_particle >> 16);
+  int_values[ParamFirstLo] = int16_t(first_particle & 0xFFFF);
+  int_values[ParamShareHi] = int16_t(n_particles >> 16);
+  int_values[ParamShareLo] = int16_t(n_particles & 0xFFFF);
+  int_values[ParamStartX] = params.start_x;
+  int_values[ParamStartY] = params.start_y;
+  int_values[ParamMaxXCell] = params.max_x_cell;
+  int_values[ParamMaxYCell] = params.max_y_cell;
+  for (int i = 0; i < 4; ++i)
+    int_values[ParamSeed0 + i] = int16_t((seed >> 16*i)&0xFFFF);
+  const uint64_t row_histories =
+    uint64_t(s1.ape_cols*s1.chip_cols)*uint64_t(n_particles);
+  for (int i = 0; i < 4; ++i)
+    int_values[ParamRowHistories0 + i] =
+      int16_t((row_histories >> 16*(3 - i))&0xFFFF);
+}
+
 // Emit the entire S1 program to a low-level kernel.
-void emit_nova_code(S1State& s1, unsigned long long seed)
+void emit_nova_code(S1State& s1, const IMCParams& params, unsigned long long seed,
+                    KernelLayout* layout)
 {
+  // Allocate the parameter blocks, which the host fills in before
+  // launching the kernel.
+  NovaExpr approx_params(0.0, NovaExpr::NovaCUMemVector, NumApproxParams);
+  NovaExpr int_params(0, NovaExpr::NovaCUMemVector, NumIntParams);
+  layout->approx_params_addr = MemAddress(approx_params.expr);
+  layout->int_params_addr = MemAddress(int_params.expr);
+#ifndef S1EMU_CU_WRITE
+  // The host cannot write CU memory, so build the parameters into the
+  // kernel instead.
+  double approx_values[NumApproxParams];
+  double int_values[NumIntParams];
+  kernel_param_values(s1, params, seed, 0, params.n_particles,
+                      approx_values, int_values);
+  for (int i = 0; i < NumApproxParams; ++i)
+    approx_params[i] = approx_values[i];
+  for (int i = 0; i < NumIntParams; ++i)
+    int_params[i] = int(int_values[i]);
+#endif
+
   // Tell each APE its row and column.
   NovaExpr ape_row, ape_col;
   assign_ape_coords(s1, ape_row, ape_col);
 
-  // Initialize the random-number generator.
+  // Initialize the random-number generator.  Each history draws from a
+  // stream of its own, keyed by the history's global index (64 bits, most
+  // significant word first) and the seed, so its random numbers do not
+  // depend on where it runs.  source_particle() keys the stream, and draw
+  // k of the stream supplies the history's kth transport step.
   NovaExpr ci(0, NovaExpr::NovaCUVar);      // CU loop variable
   counter_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 8);
   NovaCUForLoop(ci, 0, 7, 1,
@@ -80,172 +235,736 @@ void emit_nova_code(S1State& s1, unsigned long long seed)
                   counter_3fry[ci] = 0;
                 });
   key_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 8);
-  key_3fry[0] = ape_row;
-  key_3fry[1] = ape_col;
-  for (int i = 2; i < 7; ++i) {
-    key_3fry[i] = int(seed&0xFFFF);
-    seed >>= 16;
+  for (int i = 0; i < 4; ++i)
+    key_3fry[i] = 0;
+  for (int i = 4; i < 8; ++i)
+    key_3fry[i] = int_params[ParamSeed0 + i - 4];
+  init_random_draw();
+  init_math_tables();
+
+  // Load the problem parameters into CU variables.
+  NovaExpr n_particles(int_params[ParamParticles]);
+  NovaCU32 n_particles32(int_params[ParamParticlesHi], int_params[ParamParticlesLo]);
+  NovaExpr start_weight(approx_params[ParamStartWeight]); // Starting energy weight of each particle
+  NovaExpr census_distance(approx_params[ParamCensusDistance]); // dt*c
+  NovaExpr sig_s(approx_params[ParamSigS]); // scattering opacity
+  NovaExpr sig_a(approx_params[ParamSigA]); // absorption opacity
+  NovaExpr ratio(approx_params[ParamRatio]); // converts real space to [0,1] space
+  NovaExpr start_x(int_params[ParamStartX]);
+  NovaExpr start_y(int_params[ParamStartY]);
+  NovaExpr max_x_cell(int_params[ParamMaxXCell]);
+  NovaExpr max_y_cell(int_params[ParamMaxYCell]);
+
+  // When the mesh is decomposed, each APE owns a tile_x by tile_y tile of
+  // the mesh, with x increasing across APE columns and y down APE rows,
+  // and tallies only that tile.  Otherwise, every APE tallies the entire
+  // mesh.
+  const int total_rows = s1.ape_rows*s1.chip_rows;
+  const int total_cols = s1.ape_cols*s1.chip_cols;
+  const int mesh_x = s1.max_mesh_x;
+  const int mesh_y = s1.max_mesh_y;
+  const int tile_x = s1.decompose ? (mesh_x + total_cols - 1)/total_cols : mesh_x;
+  const int tile_y = s1.decompose ? (mesh_y + total_rows - 1)/total_rows : mesh_y;
+  NovaExpr x_lo(0);   // First x cell this APE owns
+  NovaExpr y_lo(0);   // First y cell this APE owns
+  if (s1.decompose) {
+    NovaExpr ti(0, NovaExpr::NovaCUVar);
+    NovaCUForLoop(ti, 1, total_cols - 1, 1, [&]() {
+      NovaApeIf (ape_col >= ti, [&]() {
+        x_lo += tile_x;
+      });
+    });
+    NovaCUForLoop(ti, 1, total_rows - 1, 1, [&]() {
+      NovaApeIf (ape_row >= ti, [&]() {
+        y_lo += tile_y;
+      });
+    });
   }
+  auto in_tile = [&](const NovaExpr& x, const NovaExpr& y) {
+    return x >= x_lo && x < x_lo + tile_x && y >= y_lo && y < y_lo + tile_y;
+  };
 
-  // Define the number of particles.  Because the value is larger than
-  // 65535, we split it into A and B such that A*B equals the desired total.
-  const int n_particles = 1000;  // Temporary -- should be 1000000;
-  const int n_particles_a = 1000;
-  const int n_particles_b = n_particles/n_particles_a;
-  assert(n_particles_a*n_particles_b == n_particles);
-  const double start_weight = 1.0/n_particles; // Starting energy weight of each particle
-
-  // Define various other constants and parameters.
-  const double c = 299.792; // speed of light, in cm/shake
-  const double dx = 0.01;  // cell size, square, in cm
-  const double dt = 0.001; // timestep size, in shakes (1e-8 seconds)
-  const double mfp = 0.3; // average distance, in cm, between scattering events
-  const double sig_s = 1.0/mfp; // scattering opacity
-  const double sig_a = 10.0; // absorption opacity
-  const double ratio = dx; // converts real space to [0,1] space
-  // The following were reduced from the original to fit in the S1's memory.
-  const int start_x = 9; // 10th x cell
-  const int start_y = 9; // 10th y cell
-  const int max_x_cell = 19;
-  const int max_y_cell = 19;
+  // Number the histories.  APE (row, col) runs histories
+  // (row*total_cols + col)*n_particles onward, except that with
+  // --decompose the source cell's owner runs all of them from 0.  A launch
+  // that resumes a run starts that many particles further on.
+  NovaExpr next_history(0, NovaExpr::NovaApeMemVector, 4);  // 64 bits
+  NovaExpr one_history(0, NovaExpr::NovaCUMemVector, 4);
+  for (int i = 0; i < 4; ++i) {
+    next_history[i] = 0;
+    one_history[i] = i == 3 ? 1 : 0;
+  }
+  if (!s1.decompose) {
+    NovaExpr ape_histories(0, NovaExpr::NovaCUMemVector, 4);
+    NovaExpr row_histories(0, NovaExpr::NovaCUMemVector, 4);
+    ape_histories[0] = 0;
+    ape_histories[1] = 0;
+    ape_histories[2] = int_params[ParamShareHi];
+    ape_histories[3] = int_params[ParamShareLo];
+    for (int i = 0; i < 4; ++i)
+      row_histories[i] = int_params[ParamRowHistories0 + i];
+    NovaExpr ti(0, NovaExpr::NovaCUVar);
+    NovaCUForLoop(ti, 1, total_cols - 1, 1, [&]() {
+      NovaApeIf (ape_col >= ti, [&]() {
+        add_words(next_history, ape_histories, 4);
+      });
+    });
+    NovaCUForLoop(ti, 1, total_rows - 1, 1, [&]() {
+      NovaApeIf (ape_row >= ti, [&]() {
+        add_words(next_history, row_histories, 4);
+      });
+    });
+  }
+  NovaExpr first_particle(0, NovaExpr::NovaCUMemVector, 4);
+  first_particle[0] = 0;
+  first_particle[1] = 0;
+  first_particle[2] = int_params[ParamFirstHi];
+  first_particle[3] = int_params[ParamFirstLo];
+  add_words(next_history, first_particle, 4);
 
   // Allocate space for tallies, and initialize all tallies to zero.
-  NovaExpr local_tally(0.0, NovaExpr::NovaApeMemArray, max_x_cell, max_y_cell);
+  NovaExpr local_tally(0.0, NovaExpr::NovaApeMemArray, tile_x, tile_y);
  // x is the slow dimension
-  NovaExpr global_tally(0.0, NovaExpr::NovaCUMemArray, max_x_cell, max_y_cell);
+  NovaExpr global_tally(0.0, NovaExpr::NovaCUMemArray, mesh_x, mesh_y);
   NovaExpr x_iter(0, NovaExpr::NovaCUVar);
   NovaExpr y_iter(0, NovaExpr::NovaCUVar);
-  NovaCUForLoop(x_iter, 0, max_x_cell - 1, 1, [&]() {
-    NovaCUForLoop(y_iter, 0, max_y_cell - 1, 1, [&]() {
+  NovaCUForLoop(x_iter, 0, mesh_x - 1, 1, [&]() {
+    NovaCUForLoop(y_iter, 0, mesh_y - 1, 1, [&]() {
       global_tally[x_iter][y_iter] = 0.0;
+    });
+  });
+  NovaCUForLoop(x_iter, 0, tile_x - 1, 1, [&]() {
+    NovaCUForLoop(y_iter, 0, tile_y - 1, 1, [&]() {
       local_tally[x_iter][y_iter] = 0.0;
     });
   });
 
-  // Loop over the number of particles, split into two nested loops to work
-  // around the 16-bit integer limitation.
-  NovaExpr ci1(0, NovaExpr::NovaCUVar);
-  NovaExpr ci2(0, NovaExpr::NovaCUVar);
-  NovaCUForLoop(ci1, 0, n_particles_a - 1, 1, [&]() {
-    NovaCUForLoop(ci2, 0, n_particles_b - 1, 1, [&]() {
-      // Initialize the per-particle work.
-      NovaExpr weight(start_weight);
-      NovaExpr d_remain(dt*c);  // TODO: Multiply by a random number after census.
-      NovaExpr x_cell(start_x);
-      NovaExpr y_cell(start_y);
-      NovaExpr alive(1);   // Is the current APE alive?
-      NovaExpr all_alive(1, NovaExpr::NovaCUVar);  // Are all APEs alive?
-      NovaExpr pos(0.0, NovaExpr::NovaApeMemVector, 2);  // Particle position
-      pos[0] = 0.5;
-      pos[1] = 0.5;
-      NovaExpr angle = get_angle();  // Particle angle
-
-      // Iterate until no more particles are alive.
-      NovaExpr w_iter(0, NovaExpr::NovaCUVar);
-      NovaCUForLoop(w_iter, 0, 1, 0, [&]() {  // while (alive) {...}
-        // Compute the distance the particle will move.
-        NovaExpr d_scatter(-ln_of_int(get_random_int())/sig_s/ratio);
-        NovaExpr d_absorb(-ln_of_int(get_random_int())/sig_a/ratio);
-        NovaExpr cross_face(-1);
-        NovaExpr d_boundary =
-          get_distance_to_boundary(&cross_face,
-                                   pos, angle,
-                                   x_cell, y_cell);
-        NovaExpr d_census(d_remain/ratio);
-        NovaExpr d_move = ape_min(d_boundary,
-                                  ape_min(d_census,
-                                          ape_min(d_scatter,
-                                                  d_absorb)));
-
-        // Move the particle, subtracting the distance remaining.
-        pos[0] += angle[0]*d_move;
-        pos[1] += angle[1]*d_move;
-
-        // Reduce the distance to census, using the real distance.
-        d_remain -= d_move*ratio;
-
-        // Process the event.
-        NovaApeIf (d_move == d_census, [&]() {
+  // Define the state of the particle on each APE.
+  NovaExpr weight(0.0);
+  NovaExpr d_remain(0.0);
+  NovaExpr x_cell(0);
+  NovaExpr y_cell(0);
+  NovaExpr alive(0);   // Is the current APE alive?
+  NovaExpr redirect(0);  // Does the particle need a new direction?
+  NovaExpr all_alive(1, NovaExpr::NovaCUVar);  // Are all APEs alive?
+  NovaExpr pos(0.0, NovaExpr::NovaApeMemVector, 2);  // Particle position
+  NovaExpr angle(0.0, NovaExpr::NovaApeMemVector, 2);  // Particle angle
+
+  // Count, as 32-bit numbers split into two Ints, the transport iterations
+  // each APE has stepped through and the iterations in which it had a live
+  // particle.
+  NovaExpr iters_hi(0), iters_lo(0);
+  NovaExpr busy_hi(0), busy_lo(0);
+  auto increment32 = [](NovaExpr& hi, NovaExpr& lo) {
+    ++lo;
+    NovaApeIf (lo == 0, [&]() {
+      ++hi;
+    });
+  };
+
+  // With --count-events, each APE counts its events and the iterations in
+  // which it had a live particle in 32 bits, as high and low words, and
+  // the CU counts transport iterations.  A batch is a run of the transport
+  // loop: one per particle without --refill or --decompose, else one in
+  // all.
+  NovaExpr event_counts;     // NumEventCounters x (high, low) per APE
+  NovaCU32 iterations;       // Transport iterations in all batches
+  NovaExpr batch_iters;      // Iterations in this batch, saturating
+  NovaExpr longest_batch;    // Greatest batch_iters
+  NovaExpr samples;          // BusyIterations x (high, low) batch counts
+  NovaExpr sample_idx;       // Iteration's index into samples
+  NovaExpr busy_row;         // Iteration's row of event_counts
+  if (s1.count_events) {
+    event_counts = NovaExpr(0, NovaExpr::NovaApeMemArray, NumEventCounters, 2);
+    iterations = NovaCU32(0);
+    batch_iters = NovaExpr(0, NovaExpr::NovaCUVar);
+    longest_batch = NovaExpr(0, NovaExpr::NovaCUVar);
+    samples = NovaExpr(0, NovaExpr::NovaCUMemArray, BusyIterations, 2);
+    sample_idx = NovaExpr(0, NovaExpr::NovaCUVar);
+    busy_row = NovaExpr(0, NovaExpr::NovaCUVar);
+    NovaExpr ri(0, NovaExpr::NovaCUVar);
+    NovaCUForLoop(ri, 0, NumEventCounters - 1, 1, [&]() {
+      event_counts[ri][0] = 0;
+      event_counts[ri][1] = 0;
+    });
+    NovaCUForLoop(ri, 0, BusyIterations - 1, 1, [&]() {
+      samples[ri][0] = 0;
+      samples[ri][1] = 0;
+    });
+  }
+  auto count_event = [&](const auto& row) {
+    NovaExpr lo(event_counts[row][1]);
+    ++lo;
+    event_counts[row][1] = lo;
+    NovaApeIf (lo == 0, [&]() {
+      ++event_counts[row][0];
+    });
+  };
+  auto count_events_of = [&](const NovaExpr& event, const NovaExpr& cross_face) {
+    if (!s1.count_events)
+      return;
+    NovaApeIf (event == int(ScatterEvent), [&]() {
+      count_event(CountScatter);
+    });
+    NovaApeIf (event == int(AbsorbEvent), [&]() {
+      count_event(CountAbsorb);
+    });
+    NovaApeIf (event == int(CensusEvent), [&]() {
+      count_event(CountCensus);
+    });
+    NovaApeIf (event == int(BoundaryEvent), [&]() {
+      count_event(CountBoundary);
+      NovaApeIf (cross_face >= 4, [&]() {
+        count_event(CountDoubleCrossing);
+      });
+    });
+  };
+
+  // Count one iteration of the transport loop, in which APEs for which
+  // busy holds had a live particle.  This must not be called within an
+  // ApeIf.
+  auto count_iteration = [&](const NovaTerm& busy) {
+    if (!s1.count_events)
+      return;
+    ++iterations;
+    sample_idx = batch_iters;
+    NovaCUIf (sample_idx > BusyIterations - 1, [&]() {
+      sample_idx = BusyIterations - 1;
+    });
+    NovaCU32 reached(samples[sample_idx][0], samples[sample_idx][1]);
+    ++reached;
+    samples[sample_idx][0] = reached.hi;
+    samples[sample_idx][1] = reached.lo;
+    busy_row = sample_idx + int(CountBusy);
+    NovaApeIf (busy, [&]() {
+      count_event(busy_row);
+    });
+    NovaCUIf (batch_iters < 32767, [&]() {
+      ++batch_iters;
+    });
+  };
+  auto end_batch = [&]() {
+    if (!s1.count_events)
+      return;
+    NovaCUIf (batch_iters > longest_batch, [&]() {
+      longest_batch = batch_iters;
+    });
+    batch_iters = 0;
+  };
+
+  // Each transport step takes one draw from every particle's stream: two
+  // numbers for the distances to scattering and absorption, then
+  // angle_randoms for a new direction, which a particle takes at the start
+  // of its step if it has just started or scattered.  Every APE samples
+  // the direction, and those that need it copy it.  (Masked-off APEs step
+  // through the same instructions anyway.)  Unless --refill or --decompose
+  // starts particles at different times, every APE's stream is at the same
+  // half block, which draw_half tracks on the CU.
+  std::vector<NovaExpr> randoms;
+  randoms.reserve(2 + angle_randoms);
+  for (int i = 0; i < 2 + angle_randoms; ++i)
+    randoms.emplace_back(0);
+  NovaExpr new_angle(0.0, NovaExpr::NovaApeMemVector, 2);
+  NovaExpr draw_half(0, NovaExpr::NovaCUVar);
+  const bool lockstep = !s1.refill && !s1.decompose;
+
+  // Start a new particle, with the next history index, on every APE in the
+  // current mask.
+  auto source_particle = [&]() {
+    NovaProfileRegion profile("source_particle");
+    weight = start_weight;
+    d_remain = census_distance;  // TODO: Multiply by a random number after census.
+    x_cell = start_x;
+    y_cell = start_y;
+    pos[0] = 0.5;
+    pos[1] = 0.5;
+    for (int i = 0; i < 4; ++i)
+      key_3fry[i] = next_history[i];
+    add_words(next_history, one_history, 4);
+    counter_3fry[0] = 0;
+    counter_3fry[1] = 0;
+    half_3fry = 0;
+    redirect = 1;
+    alive = 1;
+  };
+
+  // Deposit a particle's weight in the tally for its cell.
+  auto tally_weight = [&]() {
+    NovaProfileRegion profile("tally_weight");
+    if (s1.decompose)
+      local_tally[x_cell - x_lo][y_cell - y_lo] += weight;
+    else
+      local_tally[x_cell][y_cell] += weight;
+  };
+
+  // Move every live particle to its next event and process the event.
+  auto transport_step = [&]() {
+    NovaProfileRegion profile("transport_step");
+    NovaExpr event((int) NoEvent);  // Event that ends the current step
+    NovaExpr cross_face(-1);
+    increment32(iters_hi, iters_lo);
+
+    // Only live particles advance their streams.  (A particle in transit
+    // keeps its place until it reaches its new APE.)
+    NovaApeIf (alive == 1, [&]() {
+      get_random_draw(randoms, lockstep ? &draw_half : nullptr);
+    });
+
+    // Point new and scattered particles in a random direction.  With
+    // event-based transport, this is skipped when no APE needs it.
+    auto redirect_particles = [&]() {
+      get_angle(new_angle, randoms, 2);
+      NovaApeIf (redirect == 1, [&]() {
+        angle[0] = new_angle[0];
+        angle[1] = new_angle[1];
+        redirect = 0;
+      });
+    };
+    if (s1.transport == HistoryTransport)
+      redirect_particles();
+    else {
+      NovaExpr any_redirect(0, NovaExpr::NovaCUVar);
+      or_reduce_apes_to_cu(s1, &any_redirect, redirect == 1);
+      NovaCUIf (any_redirect != 0, redirect_particles);
+    }
+
+    // Sample the distances to scattering and absorption.
+    NovaExpr d_scatter(-ln_of_int(randoms[0])/sig_s/ratio);
+    NovaExpr d_absorb(-ln_of_int(randoms[1])/sig_a/ratio);
+
+    // Only particles that are still alive move.
+    NovaApeIf (alive == 1, [&]() {
+      increment32(busy_hi, busy_lo);
+
+      // Compute the distance the particle will move.
+      NovaExpr d_boundary =
+        get_distance_to_boundary(&cross_face,
+                                 pos, angle,
+                                 x_cell, y_cell);
+      NovaExpr d_census(d_remain/ratio);
+      NovaExpr d_move = ape_min(d_boundary,
+                                ape_min(d_census,
+                                        ape_min(d_scatter,
+                                                d_absorb)));
+
+      // Move the particle, subtracting the distance remaining.
+      pos[0] += angle[0]*d_move;
+      pos[1] += angle[1]*d_move;
+
+      // Reduce the distance to census, using the real distance.
+      d_remain -= d_move*ratio;
+
+      // Classify the event.  Later tests take precedence over earlier
+      // ones.
+      event = int(BoundaryEvent);
+      NovaApeIf (d_move == d_scatter, [&]() {
+        event = int(ScatterEvent);
+      });
+      NovaApeIf (d_move == d_absorb, [&]() {
+        event = int(AbsorbEvent);
+      });
+      NovaApeIf (d_move == d_census, [&]() {
+        event = int(CensusEvent);
+      });
+    });  // Particle is alive
+    count_events_of(event, cross_face);
+
+    if (s1.transport == HistoryTransport) {
+      // Process each particle's event in a single nested conditional,
+      // through which every APE steps.
+      NovaApeIf (event == int(CensusEvent), [&]() {
+        alive = false;
+      }, [&]() {
+        NovaApeIf (event == int(AbsorbEvent), [&]() {
           alive = false;
+          tally_weight();
         }, [&]() {
-          NovaApeIf (d_move == d_absorb, [&]() {
-            alive = false;
-            local_tally[x_cell][y_cell] += weight;
+          NovaApeIf (event == int(ScatterEvent), [&]() {
+            redirect = 1;
           }, [&]() {
-            NovaApeIf (d_move == d_scatter, [&]() {
-              angle = get_angle();
-            }, [&]() {
-              NovaApeIf (d_move == d_boundary, [&]() {
-                NovaApeIf (cross_face == 0, [&]() {
-                  --x_cell;
-                  pos[0] = 1.0;
-                });
-                NovaApeIf (cross_face == 1, [&]() {
-                  ++x_cell;
-                  pos[0] = 0.0;
-                });
-                NovaApeIf (cross_face == 2, [&]() {
-                  --y_cell;
-                  pos[1] = 1.0;
-                });
-                NovaApeIf (cross_face == 3, [&]() {
-                  ++y_cell;
-                  pos[1] = 1.0;
-                });
-                // Special event for double crossing: +x +y
-                NovaApeIf (cross_face == 4, [&]() {
-                  ++x_cell;
-                  ++y_cell;
-                  pos[0] = 0.0;
-                  pos[1] = 0.0;
-                });
-                // Special event for double crossing: +x -y
-                NovaApeIf (cross_face == 5, [&]() {
-                  ++x_cell;
-                  --y_cell;
-                  pos[0] = 0.0;
-                  pos[1] = 1.0;
-                });
-                // Special event for double crossing: -x, +y
-                NovaApeIf (cross_face == 6, [&]() {
-                  --x_cell;
-                  ++y_cell;
-                  pos[0] = 1.0;
-                  pos[1] = 0.0;
-                });
-                // Special event for double crossing: -x, -y
-                NovaApeIf (cross_face == 7, [&]() {
-                  --x_cell;
-                  --y_cell;
-                  pos[0] = 1.0;
-                  pos[1] = 1.0;
-                });
-                // Check if the particle exited the domain.
-                NovaApeIf (x_cell >= max_x_cell || x_cell < 0, [&]() {
-                  alive = false;
-                });
-                NovaApeIf (y_cell >= max_y_cell || y_cell < 0, [&]() {
-                  alive = false;
-                });
-              });  // Event == boundary
-            });  // Event == scatter
-          });  // Event == absorb
-        });  // Event == census
+            NovaApeIf (event == int(BoundaryEvent), [&]() {
+              cross_boundary(max_x_cell, max_y_cell, cross_face, x_cell, y_cell, pos, alive);
+            });  // Event == boundary
+          });  // Event == scatter
+        });  // Event == absorb
+      });  // Event == census
+    }
+    else {
+      // Process one event type at a time.  The expensive event kernels
+      // are skipped entirely when no APE needs them.
+      NovaApeIf (event == int(CensusEvent), [&]() {
+        alive = false;
+      });
+      NovaApeIf (event == int(AbsorbEvent), [&]() {
+        alive = false;
+        tally_weight();
+      });
+      NovaApeIf (event == int(ScatterEvent), [&]() {
+        redirect = 1;
+      });
+      NovaExpr any_event(0, NovaExpr::NovaCUVar);
+      or_reduce_apes_to_cu(s1, &any_event, event == int(BoundaryEvent));
+      NovaCUIf (any_event != 0, [&]() {
+        NovaApeIf (event == int(BoundaryEvent), [&]() {
+          cross_boundary(max_x_cell, max_y_cell, cross_face, x_cell, y_cell, pos, alive);
+        });
+      });
+    }
+  };
+
+  if (s1.decompose) {
+    // Each APE holds a bank of particle slots.  A particle that crosses
+    // into a cell another APE owns is marked as in transit (alive == 2)
+    // and shipped to the neighboring APE in the direction it left, one hop
+    // at a time, once that APE has a free slot.  The APE owning the source
+    // cell starts all n_particles particles, one per iteration.  Each
+    // particle carries its random-number stream's key and counter with it.
+    const int slots = s1.bank_slots;
+    NovaExpr bank_state(0, NovaExpr::NovaApeMemArray, slots, 11);   // alive, x_cell, y_cell, redirect, history, block, half
+    NovaExpr bank_motion(0.0, NovaExpr::NovaApeMemArray, slots, 6); // weight, d_remain, pos, angle
+    NovaExpr si(0, NovaExpr::NovaCUVar);  // Slot index
+    NovaCUForLoop(si, 0, slots - 1, 1, [&]() {
+      bank_state[si][0] = 0;
+    });
+    auto load_particle = [&](const NovaExpr& slot) {
+      alive = bank_state[slot][0];
+      x_cell = bank_state[slot][1];
+      y_cell = bank_state[slot][2];
+      redirect = bank_state[slot][3];
+      for (int i = 0; i < 4; ++i)
+        key_3fry[i] = bank_state[slot][4 + i];
+      counter_3fry[0] = bank_state[slot][8];
+      counter_3fry[1] = bank_state[slot][9];
+      half_3fry = bank_state[slot][10];
+      weight = bank_motion[slot][0];
+      d_remain = bank_motion[slot][1];
+      pos[0] = bank_motion[slot][2];
+      pos[1] = bank_motion[slot][3];
+      angle[0] = bank_motion[slot][4];
+      angle[1] = bank_motion[slot][5];
+    };
+    auto store_particle = [&](const NovaExpr& slot) {
+      bank_state[slot][0] = alive;
+      bank_state[slot][1] = x_cell;
+      bank_state[slot][2] = y_cell;
+      bank_state[slot][3] = redirect;
+      for (int i = 0; i < 4; ++i)
+        bank_state[slot][4 + i] = key_3fry[i];
+      bank_state[slot][8] = counter_3fry[0];
+      bank_state[slot][9] = counter_3fry[1];
+      bank_state[slot][10] = half_3fry;
+      bank_motion[slot][0] = weight;
+      bank_motion[slot][1] = d_remain;
+      bank_motion[slot][2] = pos[0];
+      bank_motion[slot][3] = pos[1];
+      bank_motion[slot][4] = angle[0];
+      bank_motion[slot][5] = angle[1];
+    };
+
+    // Ship at most one in-transit particle per APE to its neighbor in one
+    // direction.  leaves(x, y) tells whether a particle in cell (x, y)
+    // must move in that direction.  The neighbor gets the particle from
+    // from_dir if has_sender is true; the sender then gets from ack_dir
+    // whether the neighbor had room for it.
+    auto migrate = [&](const std::function<NovaTerm(const NovaExpr&, const NovaExpr&)>& leaves,
+                       int from_dir, int ack_dir, const NovaExpr& has_sender) {
+      NovaProfileRegion profile("migrate");
+      // Find a particle to send and a free slot in which to receive one.
+      NovaExpr out_slot(-1);
+      NovaExpr free_slot(-1);
+      NovaCUForLoop(si, 0, slots - 1, 1, [&]() {
+        NovaApeIf (bank_state[si][0] == 2 &&
+                   leaves(bank_state[si][1], bank_state[si][2]), [&]() {
+          out_slot = si;
+        });
+        NovaApeIf (bank_state[si][0] == 0, [&]() {
+          free_slot = si;
+        });
+      });
+
+      // Pass every APE's outgoing particle to its neighbor.
+      NovaExpr sending(0);
+      NovaApeIf (out_slot >= 0, [&]() {
+        sending = 1;
+        load_particle(out_slot);
+      });
+      NovaExpr receiving(0);
+      global_get(receiving, sending, from_dir);
+      global_get(x_cell, x_cell, from_dir);
+      global_get(y_cell, y_cell, from_dir);
+      global_get(weight, weight, from_dir);
+      global_get(d_remain, d_remain, from_dir);
+      for (int i = 0; i < 2; ++i) {
+        NovaExpr p(pos[i]);
+        NovaExpr a(angle[i]);
+        global_get(p, p, from_dir);
+        global_get(a, a, from_dir);
+        pos[i] = p;
+        angle[i] = a;
+      }
+      for (int i = 0; i < 4; ++i) {
+        NovaExpr k(key_3fry[i]);
+        global_get(k, k, from_dir);
+        key_3fry[i] = k;
+      }
+      for (int i = 0; i < 2; ++i) {
+        NovaExpr c(counter_3fry[i]);
+        global_get(c, c, from_dir);
+        counter_3fry[i] = c;
+      }
+      global_get(half_3fry, half_3fry, from_dir);
+
+      // Accept the incoming particle if there is room for it, and tell
+      // the sender.
+      NovaExpr accepted(0);
+      NovaApeIf (has_sender && receiving == 1 && free_slot >= 0, [&]() {
+        accepted = 1;
+        alive = 1;
+        redirect = 0;  // Only particles that cross a boundary are shipped.
+        NovaApeIf (in_tile(x_cell, y_cell) == 0, [&]() {
+          alive = 2;  // Crossed a tile corner; keep going.
+        });
+        store_particle(free_slot);
+      });
+      NovaExpr delivered(0);
+      global_get(delivered, accepted, ack_dir);
+      NovaApeIf (sending == 1 && delivered == 1, [&]() {
+        bank_state[out_slot][0] = 0;
+      });
+    };
+
+    // Start particles only while at most 2*slots - 1 are in flight.  Then
+    // no two banks can be full at once, so every in-transit particle's
+    // destination eventually has room, and migration cannot deadlock.
+    NovaExpr remaining(0);  // Particles not yet started
+    NovaApeIf (in_tile(start_x, start_y), [&]() {
+      remaining = n_particles;
+    });
+    NovaExpr in_flight(0, NovaExpr::NovaCUVar);
+    NovaExpr w_iter(0, NovaExpr::NovaCUVar);
+    NovaCUForLoop(w_iter, 0, 1, 0, [&]() {  // while (work remains) {...}
+      // Start a particle in the first free slot.
+      NovaCUIf (in_flight < 2*slots - 1, [&]() {
+        NovaExpr started(0);
+        NovaCUForLoop(si, 0, slots - 1, 1, [&]() {
+          NovaApeIf (remaining > 0 && started == 0 && bank_state[si][0] == 0, [&]() {
+            source_particle();
+            store_particle(si);
+            --remaining;
+            started = 1;
+          });
+        });
+      });
+
+      if (s1.count_events) {
+        NovaExpr has_live(0);
+        NovaCUForLoop(si, 0, slots - 1, 1, [&]() {
+          NovaApeIf (bank_state[si][0] == 1, [&]() {
+            has_live = 1;
+          });
+        });
+        count_iteration(has_live == 1);
+      }
+
+      // Advance every particle by one step, and mark those that leave
+      // this APE's tile as in transit.
+      NovaCUForLoop(si, 0, slots - 1, 1, [&]() {
+        load_particle(si);
+        transport_step();
+        NovaApeIf (alive == 1 && in_tile(x_cell, y_cell) == 0, [&]() {
+          alive = 2;
+        });
+        store_particle(si);
+      });
+
+      // Ship in-transit particles east, west, south, and north.
+      migrate([&](const NovaExpr& x, const NovaExpr&) { return x >= x_lo + tile_x; },
+              getWest, getEast, ape_col > 0);
+      migrate([&](const NovaExpr& x, const NovaExpr&) { return x < x_lo; },
+              getEast, getWest, ape_col < total_cols - 1);
+      migrate([&](const NovaExpr&, const NovaExpr& y) { return y >= y_lo + tile_y; },
+              getNorth, getSouth, ape_row > 0);
+      migrate([&](const NovaExpr&, const NovaExpr& y) { return y < y_lo; },
+              getSouth, getNorth, ape_row < total_rows - 1);
+
+      // Count the particles in flight, and determine if any work remains.
+      NovaExpr count(0);
+      NovaCUForLoop(si, 0, slots - 1, 1, [&]() {
+        NovaApeIf (bank_state[si][0] != 0, [&]() {
+          ++count;
+        });
+      });
+      reduce_apes_to_cu(s1, &in_flight, count, ReduceSum);
+      or_reduce_apes_to_cu(s1, &all_alive, count != 0 || remaining > 0);
+      NovaCUIf (all_alive == 0, [&]() {
+        // No APE has work remaining; exit the while loop.  CUFor's bound
+        // is inclusive, so step past it rather than onto it.
+        w_iter = 2;
+      });
+    });  // while (work remains)
+    end_batch();
+  }
+  else if (s1.refill) {
+    // Give each APE its share of the particles.  An APE whose particle
+    // dies immediately starts its next particle, and the loop ends when
+    // every APE has finished its share.
+    NovaExpr remaining(0);  // Particles not yet started
+    remaining = n_particles;
+    NovaExpr w_iter(0, NovaExpr::NovaCUVar);
+    NovaCUForLoop(w_iter, 0, 1, 0, [&]() {  // while (work remains) {...}
+      NovaApeIf (alive == 0 && remaining > 0, [&]() {
+        source_particle();
+        --remaining;
+      });
+      count_iteration(alive == 1);
+      transport_step();
+
+      // Determine if any APE has work remaining.
+      or_reduce_apes_to_cu(s1, &all_alive, alive || remaining > 0);
+      NovaCUIf (all_alive == 0, [&]() {
+        // No APE has work remaining; exit the while loop.  CUFor's bound
+        // is inclusive, so step past it rather than onto it.
+        w_iter = 2;
+      });
+    });  // while (work remains)
+    end_batch();
+  }
+  else {
+    // Loop over the number of particles, which may exceed an Int.
+    NovaCU32 particle(0);
+    NovaCUForLoop32(particle, n_particles32, [&]() {
+      // Iterate until no more particles are alive.  (Dead APEs idle until
+      // every APE's particle has died.)
+      source_particle();
+      draw_half = 0;
+      NovaExpr w_iter(0, NovaExpr::NovaCUVar);
+      NovaCUForLoop(w_iter, 0, 1, 0, [&]() {  // while (alive) {...}
+        count_iteration(alive == 1);
+        transport_step();
 
         // Determine if any APE is still alive.
         or_reduce_apes_to_cu(s1, &all_alive, alive);
-        NovaApeIf (all_alive == 0, [&]() {
-          // No APE is alive; exit the while loop.
-          w_iter++;
+        NovaCUIf (all_alive == 0, [&]() {
+          // No APE is alive; exit the while loop.  CUFor's bound is
+          // inclusive, so step past it rather than onto it.
+          w_iter = 2;
         });
       });  // while (alive)
-    });  // Loop over n_particles (part 2)
-  });  // Loop over n_particles (part 1)
+      end_batch();
+    });  // Loop over n_particles
+  }
+
+  // Accumulate all local tallies back into the CU's global tallies.
+  sum_array_apes_to_cu(s1, global_tally, mesh_x, mesh_y,
+                       [&](NovaExpr& acc, const NovaExpr& x, const NovaExpr& y) {
+                         if (s1.decompose)
+                           NovaApeIf (in_tile(x, y), [&]() {
+                             acc += local_tally[x - x_lo][y - y_lo];
+                           });
+                         else
+                           acc += local_tally[x][y];
+                       });
+
+  // Average over all APEs the fraction of transport iterations in which
+  // each APE had a live particle.  Both counts are in units of 65536
+  // iterations.
+  NovaExpr busy(int_to_approx01(busy_hi)*65536.0 + int_to_approx01(busy_lo));
+  NovaExpr iters(int_to_approx01(iters_hi)*65536.0 + int_to_approx01(iters_lo));
+  NovaExpr occupancy(busy/iters);
+  NovaExpr occupancy_sum(0.0, NovaExpr::NovaCUVar);
+  reduce_apes_to_cu(s1, &occupancy_sum, occupancy, ReduceSum);
+  const int n_apes = s1.ape_rows*s1.ape_cols*s1.chip_rows*s1.chip_cols;
+  NovaExpr mean_occupancy(0.0, NovaExpr::NovaCUMem);
+  mean_occupancy = occupancy_sum/double(n_apes);
+
+  // Every APE steps through the same transport iterations, so the host
+  // can combine the occupancies of several launches.  Read the count from
+  // the first APE.
+  NovaExpr ape_iterations(0, NovaExpr::NovaCUMemVector, 2);
+  NovaExpr iters_elt(0, NovaExpr::NovaCUMem);
+  read_one_ape(iters_elt, iters_hi, 0, 0, 0, 0);
+  ape_iterations[0] = iters_elt;
+  read_one_ape(iters_elt, iters_lo, 0, 0, 0, 0);
+  ape_iterations[1] = iters_elt;
+
+  // Sum the event counters over all APEs, in units of 65536 events, and
+  // store the iteration counts where the host can find them.
+  NovaExpr event_sums;
+  NovaExpr iteration_counts;
+  if (s1.count_events) {
+    event_sums = NovaExpr(0.0, NovaExpr::NovaCUMemArray, NumEventCounters, 1);
+    sum_array_apes_to_cu(s1, event_sums, NumEventCounters, 1,
+                         [&](NovaExpr& acc, const NovaExpr& r, const NovaExpr&) {
+                           acc += int_to_approx01(event_counts[r][0])*65536.0 +
+                             int_to_approx01(event_counts[r][1]);
+                         });
+    iteration_counts = NovaExpr(0, NovaExpr::NovaCUMemVector, 3);
+    iteration_counts[0] = iterations.hi;
+    iteration_counts[1] = iterations.lo;
+    iteration_counts[2] = longest_batch;
+  }
 
-  // TODO: Accumulate all local tallies back into the CU's global tallies.
+  // With --ape-diagnostics, copy each APE's busy iterations and the
+  // weight absorbed into its own tally to CU memory, one APE at a time.
+  // Every APE's iteration count is already in ape_iterations.  The loops
+  // select APEs in row-major order at run time, so the kernel does not
+  // grow with the number of APEs.
+  NovaExpr ape_counts;
+  NovaExpr ape_absorbed;
+  if (s1.ape_diagnostics) {
+    NovaExpr absorbed(0.0);
+    NovaCUForLoop(x_iter, 0, tile_x - 1, 1, [&]() {
+      NovaCUForLoop(y_iter, 0, tile_y - 1, 1, [&]() {
+        absorbed += local_tally[x_iter][y_iter];
+      });
+    });
+    ape_counts = NovaExpr(0, NovaExpr::NovaCUMemArray, n_apes, 2);
+    ape_absorbed = NovaExpr(0.0, NovaExpr::NovaCUMemVector, n_apes);
+    NovaExpr count_elt(0, NovaExpr::NovaCUMem);
+    NovaExpr absorbed_elt(0.0, NovaExpr::NovaCUMem);
+    NovaExpr ape_index(0, NovaExpr::NovaCUVar);
+    NovaCUForLoop(active_chip_row, 0, s1.chip_rows - 1, 1, [&]() {
+      NovaCUForLoop(active_ape_row, 0, s1.ape_rows - 1, 1, [&]() {
+        NovaCUForLoop(active_chip_col, 0, s1.chip_cols - 1, 1, [&]() {
+          NovaCUForLoop(active_ape_col, 0, s1.ape_cols - 1, 1, [&]() {
+            read_active_ape(count_elt, busy_hi);
+            ape_counts[ape_index][0] = count_elt;
+            read_active_ape(count_elt, busy_lo);
+            ape_counts[ape_index][1] = count_elt;
+            read_active_ape(absorbed_elt, absorbed);
+            ape_absorbed[ape_index] = absorbed_elt;
+            ++ape_index;
+          });
+        });
+      });
+    });
+  }
+
+  // Hand the results to the host.
+  layout->tally_addr = MemAddress(global_tally.expr);
+  layout->occupancy_addr = MemAddress(mean_occupancy.expr);
+  layout->ape_iterations_addr = MemAddress(ape_iterations.expr);
+  layout->event_counts_addr = s1.count_events ? MemAddress(event_sums.expr) : -1;
+  layout->iterations_addr = s1.count_events ? MemAddress(iteration_counts.expr) : -1;
+  layout->samples_addr = s1.count_events ? MemAddress(samples.expr) : -1;
+  layout->ape_counts_addr = s1.ape_diagnostics ? MemAddress(ape_counts.expr) : -1;
+  layout->ape_absorbed_addr = s1.ape_diagnostics ? MemAddress(ape_absorbed.expr) : -1;
+#ifndef S1EMU_CU_READBACK
+  // The host cannot read CU memory, so trace the results instead.
+  NovaExpr result(0.0);
   NovaCUForLoop(x_iter, 0, max_x_cell - 1, 1, [&]() {
     NovaCUForLoop(y_iter, 0, max_y_cell - 1, 1, [&]() {
-      TraceOneRegisterAllApes(local_tally[x_iter][y_iter].expr);
+      result = global_tally[x_iter][y_iter];
+      TraceOneRegisterAllApes(result.expr);
     });
   });
+  result = mean_occupancy;
+  TraceOneRegisterAllApes(result.expr);
+  if (s1.count_events) {
+    NovaCUForLoop(x_iter, 0, NumEventCounters - 1, 1, [&]() {
+      result = event_sums[x_iter][0]*65536.0;
+      TraceOneRegisterAllApes(result.expr);
+    });
+  }
+#endif
 }
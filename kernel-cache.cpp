@@ -0,0 +1,124 @@
+/*
+ * Cache translated S1 kernels on disk so that runs with the same machine
+ * shape and options skip code generation and translation
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "simple-bcmc.h"
+
+// A kernel can be reused only if its parameters are not baked into it.
+#if defined(S1EMU_KERNEL_CACHE) && defined(S1EMU_CU_WRITE)
+
+namespace {
+
+// The Makefile passes a checksum of the sources and build settings, which
+// stands in for the version of every file that affects code generation.
+#ifdef SOURCE_VERSION
+const uint64_t source_version = SOURCE_VERSION;
+#else
+const uint64_t source_version = 0;
+#endif
+
+// Accumulate a 64-bit FNV-1a hash.
+class Hasher {
+private:
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+public:
+  void bytes(const void* data, size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; ++i) {
+      h ^= p[i];
+      h *= 0x100000001b3ULL;
+    }
+  }
+  template <typename T> void value(const T& v) { bytes(&v, sizeof(v)); }
+  uint64_t digest() const { return h; }
+};
+
+// Return the cache file for a kernel.  Only the settings that change the
+// generated code contribute to the key; the problem parameters and the
+// seed are read from CU memory at run time.
+std::string cache_path(const S1State& s1)
+{
+  Hasher hash;
+  hash.value(source_version);
+  hash.value(s1.transport);
+  hash.value(s1.refill);
+  hash.value(s1.decompose);
+  hash.value(s1.bank_slots);
+  hash.value(s1.chip_cols);
+  hash.value(s1.chip_rows);
+  hash.value(s1.ape_cols);
+  hash.value(s1.ape_rows);
+  hash.value(s1.max_mesh_x);
+  hash.value(s1.max_mesh_y);
+  hash.value(s1.count_events);
+  hash.value(s1.ape_diagnostics);
+  char name[32];
+  std::snprintf(name, sizeof(name), "/%016llx.llk",
+                (unsigned long long) hash.digest());
+  return std::string(s1.kernel_cache) + name;
+}
+
+} // anonymous namespace
+
+// Replace the kernel that scKernelTranslate() would produce with a cached
+// copy, returning false if there is none.
+bool load_cached_kernel(const S1State& s1, KernelLayout* layout)
+{
+  std::string path = cache_path(s1);
+  FILE* file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  bool ok = std::fread(layout, sizeof(*layout), 1, file) == 1 &&
+    scLLKernelRestore(file);
+  std::fclose(file);
+  return ok;
+}
+
+// Save the kernel most recently translated.  The file is written under a
+// temporary name and renamed so that concurrent runs never see a partial
+// kernel.
+void save_cached_kernel(const S1State& s1, const KernelLayout& layout)
+{
+  if (mkdir(s1.kernel_cache, 0777) != 0 && errno != EEXIST) {
+    std::cerr << "Warning: cannot create kernel cache " << s1.kernel_cache << '\n';
+    return;
+  }
+  std::string path = cache_path(s1);
+  std::string tmp_path = path + '.' + std::to_string(getpid());
+  FILE* file = std::fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "Warning: cannot write kernel cache " << tmp_path << '\n';
+    return;
+  }
+  extern LLKernel *llKernel;
+  bool ok = std::fwrite(&layout, sizeof(layout), 1, file) == 1 &&
+    scLLKernelSave(llKernel, file);
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "Warning: cannot write kernel cache " << path << '\n';
+    std::remove(tmp_path.c_str());
+  }
+}
+
+#else
+
+// Singular Computing's runtime offers no way to save a kernel, so every run
+// translates its own.
+bool load_cached_kernel(const S1State& s1, KernelLayout* layout)
+{
+  return false;
+}
+
+void save_cached_kernel(const S1State& s1, const KernelLayout& layout)
+{
+}
+
+#endif
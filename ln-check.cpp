@@ -0,0 +1,122 @@
+/*
+ * Report the cost and accuracy of each way a kernel can compute a natural
+ * logarithm
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "simple-bcmc.h"
+
+// The results must be read back from CU memory.
+#ifdef S1EMU_CU_READBACK
+
+namespace {
+
+// Describe one implementation of ln_of_int().
+struct LnMethod {
+  const char* name;
+  int id;                                 // LN_METHOD value
+  NovaExpr (*ln)(const NovaExpr& r);
+};
+
+const LnMethod methods[] = {
+  {"shift-subtract", LN_SHIFT_SUBTRACT, ln_of_int_shift_subtract},
+  {"chebyshev", LN_CHEBYSHEV, ln_of_int_chebyshev},
+  {"table", LN_TABLE, ln_of_int_table}
+};
+const int n_methods = sizeof(methods)/sizeof(methods[0]);
+
+} // anonymous namespace
+
+// Evaluate every implementation of ln_of_int() for every r in [1, 65535]
+// and report the operations each emits and its maximum absolute error.
+// The APEs split the values of r among themselves, and the CU gathers the
+// results.
+void check_ln_methods(const S1State& s1)
+{
+  const int total_rows = s1.ape_rows*s1.chip_rows;
+  const int total_cols = s1.ape_cols*s1.chip_cols;
+  const int n_apes = total_rows*total_cols;
+  const int rounds = (65535 + n_apes - 1)/n_apes;
+
+  // Generate a kernel in which APE i computes ln_of_int(1 + n_apes*k + i)
+  // in round k.
+  scNovaInit();
+  scEmitLLKernelCreate();
+  eCUC(cuSetMaskMode, _, _, 1);
+  eCUC(cuSetGroupMode, _, _, 0);
+  eApeC(apeSetMask, _, _, 0);
+  NovaExpr ape_row, ape_col;
+  assign_ape_coords(s1, ape_row, ape_col);
+  init_math_tables();
+  NovaExpr ape_id(ape_col);
+  NovaExpr ti(0, NovaExpr::NovaCUVar);
+  NovaCUForLoop(ti, 1, total_rows - 1, 1, [&]() {
+    NovaApeIf(ape_row >= ti, [&]() {
+      ape_id += total_cols;
+    });
+  });
+  NovaCost costs[n_methods];
+  std::vector<NovaExpr> results;
+  results.reserve(n_methods);
+  for (int m = 0; m < n_methods; ++m) {
+    results.emplace_back(0.0, NovaExpr::NovaCUMemArray, rounds, n_apes);
+    NovaExpr& result = results.back();
+    NovaExpr r(ape_id + 1);
+    NovaExpr k(0, NovaExpr::NovaCUVar);
+    NovaExpr elt(0.0, NovaExpr::NovaCUMem);
+    NovaExpr i(0, NovaExpr::NovaCUVar);
+    NovaCUForLoop(k, 0, rounds - 1, 1, [&]() {
+      NovaCost start = NovaProfile::total();
+      NovaExpr lg(methods[m].ln(r));
+      costs[m] = NovaProfile::total() - start;
+      i = 0;
+      for (int row = 0; row < total_rows; ++row)
+        for (int col = 0; col < total_cols; ++col) {
+          read_one_ape(elt, lg, row/s1.ape_rows, col/s1.ape_cols,
+                       row%s1.ape_rows, col%s1.ape_cols);
+          result[k][i] = elt;
+          ++i;
+        }
+      r += n_apes;
+    });
+  }
+  eCUC(cuHalt, _, _, _);
+  scKernelTranslate();
+
+  // Run the kernel.
+  extern LLKernel *llKernel;
+  scLLKernelLoad(llKernel, 0);
+  scLLKernelExecute(0);
+  scLLKernelWaitSignal();
+
+  // Compare each method's results to the host's logarithms.
+  std::printf("%-16s %8s %8s %12s %8s\n",
+              "Method", "APE ops", "CU ops", "Max error", "At r");
+  std::vector<double> lg(size_t(rounds)*n_apes);
+  for (int m = 0; m < n_methods; ++m) {
+    scReadCUMemory(MemAddress(results[m].expr), int(lg.size()), lg.data());
+    double max_error = 0.0;
+    int worst_r = 1;
+    for (int r = 1; r <= 65535; ++r) {
+      double error = std::fabs(lg[r - 1] - std::log(r/65535.0));
+      if (error > max_error) {
+        max_error = error;
+        worst_r = r;
+      }
+    }
+    std::printf("%-16s %8.0f %8.0f %12.6g %8d%s\n", methods[m].name,
+                costs[m].ape_ops, costs[m].cu_ops, max_error, worst_r,
+                methods[m].id == LN_METHOD ? "  (selected)" : "");
+  }
+}
+
+#else
+
+void check_ln_methods(const S1State& s1)
+{
+  std::fprintf(stderr, "Checking ln_of_int() requires s1emu\n");
+}
+
+#endif
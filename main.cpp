@@ -2,17 +2,69 @@
  * Top-level code for a simple billion-core Monte Carlo simulation
  */
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <cstdio>
 #include <cstdlib>
 #include <cerrno>
+#include <climits>
+#include <vector>
 #include <unistd.h>
 #include <getopt.h>
 #include "simple-bcmc.h"
+#include "tally-file.h"
 
-// Parse the command line into an S1State plus a random-number seed.
-S1State parse_command_line(int argc, char *argv[], unsigned long long* seed) {
+// Set the problem parameter named by the text before the "=" in an
+// assignment to the value after it.  Return false if the assignment is
+// malformed, names no parameter, or gives a value out of range.
+bool set_param(IMCParams* params, const std::string& assignment) {
+  size_t eq = assignment.find('=');
+  if (eq == std::string::npos)
+    return false;
+  auto trim = [](const std::string& s) {
+    size_t first = s.find_first_not_of(" \t");
+    size_t last = s.find_last_not_of(" \t\r");
+    return first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+  };
+  std::string name = trim(assignment.substr(0, eq));
+  std::string value = trim(assignment.substr(eq + 1));
+  struct { const char* name; int* i; double* d; } fields[] =
+    {{"n_particles", &params->n_particles, nullptr},
+     {"c", nullptr, &params->c},
+     {"dx", nullptr, &params->dx},
+     {"dt", nullptr, &params->dt},
+     {"mfp", nullptr, &params->mfp},
+     {"sig_a", nullptr, &params->sig_a},
+     {"start_x", &params->start_x, nullptr},
+     {"start_y", &params->start_y, nullptr},
+     {"max_x_cell", &params->max_x_cell, nullptr},
+     {"max_y_cell", &params->max_y_cell, nullptr}};
+  for (const auto& f : fields) {
+    if (name != f.name)
+      continue;
+    char *endptr;
+    errno = 0;
+    if (f.i != nullptr) {
+      long v = std::strtol(value.c_str(), &endptr, 0);
+      if (v < INT_MIN || v > INT_MAX)
+        return false;
+      *f.i = int(v);
+    }
+    else
+      *f.d = std::strtod(value.c_str(), &endptr);
+    return !value.empty() && *endptr == '\0' && errno == 0;
+  }
+  return false;
+}
+
+// Parse the command line into an S1State plus a random-number seed and
+// the problem parameters.
+S1State parse_command_line(int argc, char *argv[], unsigned long long* seed,
+                           IMCParams* params) {
   S1State s1;
   struct option long_options[] =
     {{"emulate", no_argument, nullptr, 'e'},
@@ -20,10 +72,27 @@ S1State parse_command_line(int argc, char *argv[], unsigned long long* seed) {
      {"chips", required_argument, nullptr, 'c'},
      {"apes", required_argument, nullptr, 'a'},
      {"seed", required_argument, nullptr, 's'},
+     {"backend", required_argument, nullptr, 'b'},
+     {"transport", required_argument, nullptr, 'p'},
+     {"refill", no_argument, nullptr, 'r'},
+     {"decompose", optional_argument, nullptr, 'd'},
+     {"kernel-cache", required_argument, nullptr, 'k'},
+     {"param", required_argument, nullptr, 'P'},
+     {"input", required_argument, nullptr, 'i'},
+     {"mesh-capacity", required_argument, nullptr, 'm'},
+     {"profile", no_argument, nullptr, 'o'},
+     {"count-events", no_argument, nullptr, 'v'},
+     {"check-ln", no_argument, nullptr, 'l'},
+     {"check-rng", no_argument, nullptr, 'g'},
+     {"tally-output", required_argument, nullptr, 'T'},
+     {"ape-diagnostics", no_argument, nullptr, 'D'},
+     {"segment", required_argument, nullptr, 'S'},
+     {"checkpoint", required_argument, nullptr, 'C'},
+     {"restart", required_argument, nullptr, 'R'},
      {"help", no_argument, nullptr, 'h'},
      {nullptr, 0, nullptr, 0}};
   int c;
-  while ((c = getopt_long(argc, argv, "h:f:c:a:s:h", long_options, nullptr)) != -1) {
+  while ((c = getopt_long(argc, argv, "h:f:c:a:s:b:p:rd::k:P:i:m:ovlgT:DS:C:R:h", long_options, nullptr)) != -1) {
     switch (c) {
       case 'e':
         s1.emulated = true;
@@ -66,9 +135,137 @@ S1State parse_command_line(int argc, char *argv[], unsigned long long* seed) {
         }
         break;
 
+      case 'b':
+        if (std::string(optarg) == "s1")
+          s1.backend = S1Backend;
+        else if (std::string(optarg) == "cpu")
+          s1.backend = CPUBackend;
+        else {
+          std::cerr << argv[0] << ": --backend must be either \"s1\" or \"cpu\""
+                    << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'p':
+        if (std::string(optarg) == "history")
+          s1.transport = HistoryTransport;
+        else if (std::string(optarg) == "event")
+          s1.transport = EventTransport;
+        else {
+          std::cerr << argv[0] << ": --transport must be either \"history\" or \"event\""
+                    << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'r':
+        s1.refill = true;
+        break;
+
+      case 'd':
+        s1.decompose = true;
+        if (optarg != nullptr) {
+          s1.bank_slots = std::atoi(optarg);
+          if (s1.bank_slots < 1) {
+            std::cerr << argv[0] << ": --decompose requires a positive number of slots"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        break;
+
+      case 'k':
+        s1.kernel_cache = optarg;
+        break;
+
+      case 'P':
+        if (!set_param(params, optarg)) {
+          std::cerr << argv[0] << ": --param expects <name>=<value> with a known name and an in-range value, not \""
+                    << optarg << "\"" << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'i': {
+        // Read one <name> = <value> assignment per line, ignoring blank
+        // lines and comments introduced by "#".
+        std::ifstream input(optarg);
+        if (!input) {
+          std::cerr << argv[0] << ": cannot read " << optarg << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        std::string line;
+        for (int lineno = 1; std::getline(input, line); ++lineno) {
+          line = line.substr(0, line.find('#'));
+          if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+          if (!set_param(params, line)) {
+            std::cerr << optarg << ':' << lineno << ": expected <name> = <value> with a known name and an in-range value"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        break;
+      }
+
+      case 'm':
+        int mx, my;
+        if (sscanf(optarg, "%d x %d", &mx, &my) != 2) {
+          std::cerr << argv[0] << ": --mesh-capacity must be of the form <x>x<y>"
+                    << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        s1.max_mesh_x = mx;
+        s1.max_mesh_y = my;
+        break;
+
+      case 'o':
+        s1.profile = true;
+        break;
+
+      case 'v':
+        s1.count_events = true;
+        break;
+
+      case 'l':
+        s1.check_ln = true;
+        break;
+
+      case 'g':
+        s1.check_rng = true;
+        break;
+
+      case 'T':
+        s1.tally_output = optarg;
+        break;
+
+      case 'D':
+        s1.ape_diagnostics = true;
+        break;
+
+      case 'S':
+        s1.segment = std::atoi(optarg);
+        if (s1.segment < 1) {
+          std::cerr << argv[0] << ": --segment requires a positive number of particles"
+                    << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'C':
+        s1.checkpoint = optarg;
+        break;
+
+      case 'R':
+        s1.restart = optarg;
+        break;
+
       case 'h':
         std::cout << "Usage: " << argv[0]
-                  << "[--emulate] [--trace=<num>] [--chips=<cols>x<rows>] [--apes=<cols>x<rows>] [--seed=<num>] [--help]"
+                  << "[--emulate] [--trace=<num>] [--chips=<cols>x<rows>] [--apes=<cols>x<rows>] [--seed=<num>] [--backend=s1|cpu] [--transport=history|event] [--refill] [--decompose[=<slots>]] [--kernel-cache=<dir>] [--param=<name>=<value>] [--input=<file>] [--mesh-capacity=<x>x<y>] [--profile] [--count-events] [--check-ln] [--check-rng] [--tally-output=<file>] [--ape-diagnostics] [--segment=<particles>] [--checkpoint=<file>] [--restart=<file>] [--help]"
+                  << std::endl
+                  << "--kernel-cache requires s1emu and is ignored with Singular Computing's runtime."
                   << std::endl;
         std::exit(EXIT_SUCCESS);
         break;
@@ -78,13 +275,227 @@ S1State parse_command_line(int argc, char *argv[], unsigned long long* seed) {
         break;
     }
   }
+  if (s1.ape_diagnostics && s1.tally_output == nullptr) {
+    std::cerr << argv[0] << ": --ape-diagnostics requires --tally-output"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
   return s1;
 }
 
+void check_params(const IMCParams& params) {
+  if (params.n_particles < 1)
+    throw std::invalid_argument("n_particles must be positive");
+  if (params.max_x_cell < 1 || params.max_y_cell < 1)
+    throw std::invalid_argument("the mesh must have at least one cell in x and in y");
+  if (params.start_x < 0 || params.start_x >= params.max_x_cell ||
+      params.start_y < 0 || params.start_y >= params.max_y_cell)
+    throw std::invalid_argument("the source cell lies outside the mesh");
+  if (!(params.c > 0) || !(params.dx > 0) || !(params.dt > 0) ||
+      !(params.mfp > 0) || !(params.sig_a > 0))
+    throw std::invalid_argument("c, dx, dt, mfp, and sig_a must be positive");
+}
+
+// Print a tally one row of x per line and return its total.
+double print_tally(const IMCParams& params, const double* tally) {
+  double total = 0.0;
+  for (int x = 0; x < params.max_x_cell; ++x) {
+    for (int y = 0; y < params.max_y_cell; ++y) {
+      double t = tally[size_t(x)*params.max_y_cell + y];
+      std::printf("%s%.6g", y == 0 ? "" : " ", t);
+      total += t;
+    }
+    std::printf("\n");
+  }
+  return total;
+}
+
+#ifdef S1EMU_CU_READBACK
+// Read back and print the event counters and busy-APE statistics gathered
+// with --count-events.  Event counts are sums of Approx values and thus
+// approximate; iteration counts are exact.
+void print_event_counts(const S1State& s1, const KernelLayout& layout) {
+  auto int32 = [](double hi, double lo) {
+    return double(int(hi))*65536.0 + double(uint16_t(int(lo)));
+  };
+  double counts[NumEventCounters];
+  scReadCUMemory(layout.event_counts_addr, NumEventCounters, counts);
+  for (double& c : counts)
+    c *= 65536.0;
+  double iters[3];
+  scReadCUMemory(layout.iterations_addr, 3, iters);
+  double samples[2*BusyIterations];
+  scReadCUMemory(layout.samples_addr, 2*BusyIterations, samples);
+  double batches = int32(samples[0], samples[1]);
+  double iterations = int32(iters[0], iters[1]);
+  const double n_apes = s1.ape_rows*s1.ape_cols*s1.chip_rows*s1.chip_cols;
+  std::printf("Scatter events:        %.0f\n"
+              "Absorption events:     %.0f\n"
+              "Census events:         %.0f\n"
+              "Boundary crossings:    %.0f\n"
+              "Double crossings:      %.0f\n"
+              "Transport iterations:  %.0f\n"
+              "Batches:               %.0f\n"
+              "Iterations per batch:  %.6g (longest %s%d)\n",
+              counts[CountScatter], counts[CountAbsorb], counts[CountCensus],
+              counts[CountBoundary], counts[CountDoubleCrossing],
+              iterations, batches, iterations/batches,
+              iters[2] >= 32767 ? ">=" : "", int(iters[2]));
+
+  // Print the fraction of APEs with a live particle in each iteration of
+  // a batch, averaged over the batches that reached it.
+  std::printf("Busy APEs by iteration:\n");
+  for (int i = 0; i < BusyIterations; ++i) {
+    double reached = int32(samples[2*i], samples[2*i + 1]);
+    if (reached == 0)
+      break;
+    std::printf("  %3d%s %.6g\n", i, i == BusyIterations - 1 ? "+" : " ",
+                counts[CountBusy + i]/(reached*n_apes));
+  }
+}
+
+// Write the tally, and each APE's diagnostics if the kernel gathered them,
+// to the file named by --tally-output.  Return false if it can't be
+// written.
+bool write_tallies(const S1State& s1, const IMCParams& params,
+                   const KernelLayout& layout, const double* tally,
+                   double histories, unsigned long long seed) {
+  const int total_rows = s1.ape_rows*s1.chip_rows;
+  const int total_cols = s1.ape_cols*s1.chip_cols;
+  const size_t n_apes = size_t(total_rows)*total_cols;
+  std::vector<double> ape_values;
+  if (s1.ape_diagnostics) {
+    // Every APE steps through the same iterations.
+    std::vector<double> counts(2*n_apes), absorbed(n_apes);
+    double iters[2];
+    scReadCUMemory(layout.ape_counts_addr, int(counts.size()), counts.data());
+    scReadCUMemory(layout.ape_absorbed_addr, int(n_apes), absorbed.data());
+    scReadCUMemory(layout.ape_iterations_addr, 2, iters);
+    auto int32 = [](double hi, double lo) {
+      return double(int(hi))*65536.0 + double(uint16_t(int(lo)));
+    };
+    ape_values.resize(NumApeFields*n_apes);
+    for (size_t i = 0; i < n_apes; ++i) {
+      double* v = &ape_values[NumApeFields*i];
+      v[ApeBusyIterations] = int32(counts[2*i], counts[2*i + 1]);
+      v[ApeIterations] = int32(iters[0], iters[1]);
+      v[ApeAbsorbed] = absorbed[i];
+    }
+  }
+  return write_tally_file(s1.tally_output, S1Backend,
+                          params.max_x_cell, params.max_y_cell,
+                          uint64_t(histories), seed, tally,
+                          total_rows, total_cols,
+                          s1.ape_diagnostics ? ape_values.data() : nullptr);
+}
+#endif
+
 int main (int argc, char *argv[]) {
   // Parse the command line.
   unsigned long long seed = 0ULL;
-  S1State s1 = parse_command_line(argc, argv, &seed);
+  IMCParams params;
+  S1State s1 = parse_command_line(argc, argv, &seed, &params);
+  try {
+    check_params(params);
+  }
+  catch (std::invalid_argument& e) {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Run natively on the host if so instructed.
+  if (s1.backend == CPUBackend) {
+    if (s1.decompose) {
+      std::cerr << argv[0] << ": --decompose applies only to the S1 backend"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (s1.count_events) {
+      std::cerr << argv[0] << ": --count-events applies only to the S1 backend"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (s1.ape_diagnostics) {
+      std::cerr << argv[0] << ": --ape-diagnostics applies only to the S1 backend"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (s1.segment > 0 || s1.checkpoint != nullptr || s1.restart != nullptr) {
+      std::cerr << argv[0] << ": --segment, --checkpoint, and --restart apply only to the S1 backend"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (s1.check_rng)
+      return check_rng_battery(seed) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (!run_cpu_engine(s1, params, seed)) {
+      std::cerr << argv[0] << ": cannot write " << s1.tally_output << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+#ifndef S1EMU_CU_READBACK
+  if (s1.tally_output != nullptr) {
+    std::cerr << argv[0] << ": --tally-output requires s1emu on the S1 backend"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+#endif
+#if !defined(S1EMU_KERNEL_CACHE) || !defined(S1EMU_CU_WRITE)
+  if (s1.kernel_cache != nullptr) {
+    std::cerr << "Warning: --kernel-cache requires s1emu; ignoring it" << std::endl;
+    s1.kernel_cache = nullptr;
+  }
+#endif
+#if !defined(S1EMU_CU_READBACK) || !defined(S1EMU_CU_WRITE)
+  if (s1.segment > 0 || s1.checkpoint != nullptr || s1.restart != nullptr) {
+    std::cerr << argv[0] << ": --segment, --checkpoint, and --restart require s1emu"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+#endif
+  const bool segmented = s1.segment > 0 || s1.restart != nullptr;
+  if (segmented && (s1.count_events || s1.ape_diagnostics)) {
+    std::cerr << argv[0] << ": --count-events and --ape-diagnostics describe a single kernel launch and can't be combined with --segment or --restart"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Size the kernel's mesh for the problem unless told otherwise, and
+  // check that the kernel can run the problem.  Each launch runs up to
+  // launch_particles particles per APE (in total, if decomposed).
+  if (s1.max_mesh_x == 0)
+    s1.max_mesh_x = params.max_x_cell;
+  if (s1.max_mesh_y == 0)
+    s1.max_mesh_y = params.max_y_cell;
+  const long long n_particles = params.n_particles;
+  const long long launch_particles =
+    s1.segment > 0 ? std::min<long long>(s1.segment, n_particles) : n_particles;
+  double approx_params[NumApproxParams];
+  double int_params[NumIntParams];
+  try {
+    kernel_param_values(s1, params, seed, 0, launch_particles,
+                        approx_params, int_params);
+  }
+  catch (std::invalid_argument& e) {
+    std::cerr << argv[0] << ": " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Resume from a checkpoint if so instructed.
+  Checkpoint ckpt;
+  if (s1.restart != nullptr) {
+    try {
+      ckpt = load_checkpoint(s1.restart, s1, params, seed);
+    }
+    catch (std::runtime_error& e) {
+      std::cerr << argv[0] << ": " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  else
+    ckpt.tally.assign(size_t(params.max_x_cell)*params.max_y_cell, 0.0);
+  const long long first_particle = ckpt.next_particle;
 
   // Initialize the S1.
   initSingularArithmetic();
@@ -94,21 +505,140 @@ int main (int argc, char *argv[]) {
                       s1.trace_flags,
                       0, 0, 0);
 
-  // Compile the entire S1 program to a kernel.
-  scNovaInit();
-  scEmitLLKernelCreate();
-  eCUC(cuSetMaskMode, _, _, 1);
-  eCUC(cuSetGroupMode, _, _, 0);
-  eApeC(apeSetMask, _, _, 0);
-  emit_nova_code(s1, seed);
-  eCUC(cuHalt, _, _, _);
-  scKernelTranslate();
-
-  // Launch the S1 program and wait for it to finish.
+  // Compare the ways of computing logarithms instead of simulating, if so
+  // instructed.
+  if (s1.check_ln) {
+    check_ln_methods(s1);
+    scTerminateMachine();
+    return EXIT_SUCCESS;
+  }
+
+  // Check the S1's random numbers against the host's, then test the host's
+  // generators, instead of simulating, if so instructed.
+  if (s1.check_rng) {
+    bool ok = check_rng_kernel(s1, seed);
+    ok = check_rng_battery(seed) && ok;
+    scTerminateMachine();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Compile the entire S1 program to a kernel, unless an identical kernel
+  // was cached by an earlier run.  Time each phase of compiling, loading,
+  // and running the kernel separately.
+  typedef std::chrono::steady_clock clock;
+  std::chrono::duration<double> codegen_elapsed(0), translate_elapsed(0);
+  KernelLayout layout;
+  auto restore_start = clock::now();
+  bool cached = s1.kernel_cache != nullptr &&
+    load_cached_kernel(s1, &layout);
+  if (!cached) {
+    auto codegen_start = clock::now();
+    scNovaInit();
+    scEmitLLKernelCreate();
+    eCUC(cuSetMaskMode, _, _, 1);
+    eCUC(cuSetGroupMode, _, _, 0);
+    eApeC(apeSetMask, _, _, 0);
+    emit_nova_code(s1, params, seed, &layout);
+    eCUC(cuHalt, _, _, _);
+    auto translate_start = clock::now();
+    codegen_elapsed = translate_start - codegen_start;
+    scKernelTranslate();
+    translate_elapsed = clock::now() - translate_start;
+    if (s1.kernel_cache != nullptr)
+      save_cached_kernel(s1, layout);
+    if (s1.profile)
+      NovaProfile::report(stdout);
+  }
+  else {
+    // Reading the cached kernel takes the place of translating it.
+    translate_elapsed = clock::now() - restore_start;
+    if (s1.profile)
+      std::cerr << "Warning: a cached kernel can't be profiled" << std::endl;
+  }
+
+  // Launch the S1 program as many times as it takes to run every particle,
+  // waiting for each launch to finish.  Loading includes writing the
+  // kernel's parameters.  Each launch's tally is added to the run's on the
+  // host, and the run's progress is saved after each launch if so
+  // instructed.
   extern LLKernel *llKernel;
-  scLLKernelLoad(llKernel, 0);
-  scLLKernelExecute(0);
-  scLLKernelWaitSignal();
+  std::chrono::duration<double> load_elapsed(0), elapsed(0);
+  int launches = 0;
+  while (ckpt.next_particle < n_particles) {
+    const long long particles =
+      std::min(launch_particles, n_particles - ckpt.next_particle);
+    kernel_param_values(s1, params, seed, ckpt.next_particle, particles,
+                        approx_params, int_params);
+    auto load_start = clock::now();
+    scLLKernelLoad(llKernel, 0);
+#ifdef S1EMU_CU_WRITE
+    scWriteCUMemory(layout.approx_params_addr, NumApproxParams, approx_params);
+    scWriteCUMemory(layout.int_params_addr, NumIntParams, int_params);
+#endif
+    auto start_time = clock::now();
+    load_elapsed += start_time - load_start;
+    scLLKernelExecute(0);
+    scLLKernelWaitSignal();
+    elapsed += clock::now() - start_time;
+#ifdef S1EMU_CU_READBACK
+    // Read the global tally, the occupancy, and the transport iterations
+    // back from CU memory.  Without readback support, the kernel instead
+    // traces the tally and the occupancy.
+    std::vector<double> tally(ckpt.tally.size());
+    for (int x = 0; x < params.max_x_cell; ++x)
+      scReadCUMemory(layout.tally_addr + x*s1.max_mesh_y, params.max_y_cell,
+                     &tally[size_t(x)*params.max_y_cell]);
+    for (size_t i = 0; i < tally.size(); ++i)
+      ckpt.tally[i] += tally[i];
+    double occupancy, iters[2];
+    scReadCUMemory(layout.occupancy_addr, 1, &occupancy);
+    scReadCUMemory(layout.ape_iterations_addr, 2, iters);
+    double iterations = double(int(iters[0]))*65536.0 + double(uint16_t(int(iters[1])));
+    ckpt.busy_iterations += occupancy*iterations;
+    ckpt.iterations += iterations;
+#endif
+    ckpt.next_particle += particles;
+    ++launches;
+    if (s1.checkpoint != nullptr &&
+        !save_checkpoint(s1.checkpoint, s1, params, seed, ckpt)) {
+      std::cerr << argv[0] << ": cannot write " << s1.checkpoint << std::endl;
+      scTerminateMachine();
+      return EXIT_FAILURE;
+    }
+  }
+  const double apes = s1.decompose ? 1.0 :
+    double(s1.ape_rows*s1.ape_cols*s1.chip_rows*s1.chip_cols);
+  double histories = double(n_particles)*apes;
+  double histories_run = double(n_particles - first_particle)*apes;
+#ifdef S1EMU_CU_READBACK
+  double total = print_tally(params, ckpt.tally.data());
+  std::cout << "Total absorbed energy: " << total << '\n'
+            << "APE occupancy:         "
+            << (ckpt.iterations > 0 ? ckpt.busy_iterations/ckpt.iterations : 0.0)
+            << '\n';
+  if (s1.count_events)
+    print_event_counts(s1, layout);
+  if (s1.tally_output != nullptr &&
+      !write_tallies(s1, params, layout, ckpt.tally.data(), histories, seed)) {
+    std::cerr << argv[0] << ": cannot write " << s1.tally_output << std::endl;
+    scTerminateMachine();
+    return EXIT_FAILURE;
+  }
+#endif
+  std::cout << "Histories:             " << histories << '\n';
+  if (segmented)
+    std::cout << "Kernel launches:       " << launches << '\n'
+              << "Histories this run:    " << histories_run << '\n';
+  const char* cached_mark = cached ? " (cached)" : "";
+  std::cout << "Codegen seconds:       " << codegen_elapsed.count()
+            << cached_mark << '\n'
+            << "Translate seconds:     " << translate_elapsed.count()
+            << cached_mark << '\n'
+            << "Load seconds:          " << load_elapsed.count() << '\n'
+            << "Elapsed seconds:       " << elapsed.count() << '\n'
+            << "Histories/second:      "
+            << (elapsed.count() > 0 ? histories_run/elapsed.count() : 0.0)
+            << std::endl;
 
   // Shut down the S1 and the program.
   scTerminateMachine();
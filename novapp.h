@@ -7,14 +7,23 @@
 #ifndef _NOVAPP_H_
 #define _NOVAPP_H_
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
 #include <stdexcept>
+#include <string>
 #include <functional>
+#include <memory>
+#include <vector>
 
 extern "C" {
 #include "scAcceleratorAPI.h"
 #include "scNova.h"
 }
 
+class NovaTerm;
+
 // Wrap a Nova expression in a C++ class.
 class NovaExpr {
 public:
@@ -35,6 +44,8 @@ public:
   } nova_t;
 
 private:
+  friend class NovaTerm;
+
   // Store information about the expression that we can't easily access from an
   // scExpr without modifying Nova itself.
   nova_t expr_type;   // NovaApeVar, NovaCUVar, etc.
@@ -42,10 +53,12 @@ private:
   size_t rows;        // Number of rows in a vector or array
   size_t cols;        // Number of columns in an array
   scExpr row_idx;     // Row index in operator[][] array accesses
+  bool owner = false; // true=this object allocated expr's storage
 
   // Invoke the correct {Ape,CU}{Var,Mem} function based on the current value
   // of expr_type and is_approx.
   void define_expr() {
+    owner = true;
     if (is_approx)
       // Approx
       switch (expr_type) {
@@ -133,6 +146,15 @@ private:
     return result;
   }
 
+  // Return this object's storage, if it allocated any, to Nova.
+  void release() {
+#ifdef S1EMU_RELEASE
+    if (owner)
+      scRelease(expr);
+#endif
+    owner = false;
+  }
+
 public:
   // Maintain a Nova expression.
   scExpr expr = 0;    // Declare(expr); without the "static"
@@ -140,6 +162,9 @@ public:
   // Return true if the NovaExpr has been assigned a value.
   bool has_value() { return expr_type != NovaInvalidType; }
 
+  // Return true if the NovaExpr is an Approx and false if it is an Int.
+  bool approx() const { return is_approx; }
+
   // ----- Constructors -----
 
   // "Declare" a variable without "defining" it.
@@ -156,15 +181,27 @@ public:
     Set(expr, other.expr);
   }
 
-  // Move a NovaExpr to another NovaExpr.
-  NovaExpr(const NovaExpr&& other) noexcept {
+  // Move a NovaExpr to another NovaExpr, taking over its storage.
+  NovaExpr(NovaExpr&& other) noexcept {
     expr_type = other.expr_type;
     is_approx = other.is_approx;
     rows = other.rows;
     cols = other.cols;
+    row_idx = other.row_idx;
     expr = other.expr;
+    owner = other.owner;
+    other.owner = false;
+  }
+
+  // Release the storage this object allocated so that later variables can
+  // reuse it.  Variables thus live only as long as their C++ scope.
+  ~NovaExpr() {
+    release();
   }
 
+  // Evaluate an arithmetic term into a new variable.
+  NovaExpr(const NovaTerm& term);
+
   // Initialize a Nova Approx from a double.  The double is currently
   // ignored for vector and array types.
   NovaExpr(double d, nova_t type = NovaApeVar, size_t rows=1, size_t cols=1) {
@@ -222,27 +259,56 @@ public:
 
   // Assign one NovaExpr to another using Nova's Set macro.
   NovaExpr& operator=(const NovaExpr& rhs) {
-    expr_type = rhs.expr_type;
-    is_approx = rhs.is_approx;
-    define_expr();
-    switch (expr_type) {
+    switch (rhs.expr_type) {
       case NovaApeMemVector:
       case NovaCUMemVector:
       case NovaApeMemArray:
       case NovaCUMemArray:
         // Store only a pointer for vector/array expressions.  (Set doesn't
         // work here.)
+        release();
+        expr_type = rhs.expr_type;
+        is_approx = rhs.is_approx;
+        rows = rhs.rows;
+        cols = rhs.cols;
         expr = rhs.expr;
         break;
 
       default:
-        // Copy scalar expressions.
+        // Copy scalar expressions.  A scalar that is already defined keeps
+        // its own storage class (e.g., an APE variable assigned from a CU
+        // variable remains an APE variable).
+        if (expr_type == NovaInvalidType) {
+          expr_type = rhs.expr_type;
+          is_approx = rhs.is_approx;
+          define_expr();
+        }
         Set(expr, rhs.expr);
         break;
     }
     return *this;
   }
 
+  // Assign a temporary NovaExpr to another, taking over the temporary's
+  // storage if it is a vector or array or if this NovaExpr is undefined.
+  NovaExpr& operator=(NovaExpr&& rhs) {
+    bool aggregate = rhs.expr_type == NovaApeMemVector ||
+      rhs.expr_type == NovaCUMemVector ||
+      rhs.expr_type == NovaApeMemArray ||
+      rhs.expr_type == NovaCUMemArray;
+    if (!rhs.owner || !(aggregate || expr_type == NovaInvalidType))
+      return *this = static_cast<const NovaExpr&>(rhs);
+    release();
+    expr_type = rhs.expr_type;
+    is_approx = rhs.is_approx;
+    rows = rhs.rows;
+    cols = rhs.cols;
+    expr = rhs.expr;
+    owner = true;
+    rhs.owner = false;
+    return *this;
+  }
+
   // Assign an integer constant to a NovaExpr.
   NovaExpr& operator=(int rhs) {
     switch (expr_type) {
@@ -279,133 +345,60 @@ public:
     return *this;
   }
 
+  // Assign an arithmetic term to a NovaExpr using a single Nova Set.
+  NovaExpr& operator=(const NovaTerm& rhs);
+
   // ----- Helper macros -----
 
-  // A NOVA_OP defines both an arithmetic and an assignment operator
-  // that accept a NovaExpr on the right-hand side.
-#define NOVA_OP(OP, OP_EQ, NOVA)                                \
-  friend NovaExpr operator OP(NovaExpr lhs,                     \
-                              const NovaExpr& rhs) {            \
-  NovaExpr result(lhs, true);                                   \
-    Set(result.expr, NOVA(lhs.expr, rhs.expr));                 \
-    return result;                                              \
-  }                                                             \
-                                                                \
-  NovaExpr& operator OP_EQ(const NovaExpr& rhs) {               \
-    Set(expr, NOVA(expr, rhs.expr));                            \
-    return *this;                                               \
-  }
+  // A NOVA_OP_EQ defines an assignment operator that accepts a NovaExpr
+  // or a NovaTerm on the right-hand side.
+#define NOVA_OP_EQ(OP_EQ, NOVA)                                 \
+  NovaExpr& operator OP_EQ(const NovaTerm& rhs);
 
-  // An INTEGER_OP defines both an arithmetic and an assignment operator
-  // that accept either a NovaExpr or an integer on the right-hand side.
-#define INTEGER_OP(OP, OP_EQ, NOVA)                             \
-  NOVA_OP(OP, OP_EQ, NOVA)                                      \
-                                                                \
-  friend NovaExpr operator OP(NovaExpr lhs, const int rhs) {    \
-    NovaExpr result(lhs, true);                                 \
-    Set(result.expr, NOVA(lhs.expr, IntConst(rhs)));            \
-    return result;                                              \
-  }                                                             \
+  // An INTEGER_OP_EQ defines an assignment operator that accepts either a
+  // NovaExpr, a NovaTerm, or an integer on the right-hand side.
+#define INTEGER_OP_EQ(OP_EQ, NOVA)                              \
+  NOVA_OP_EQ(OP_EQ, NOVA)                                       \
                                                                 \
   NovaExpr& operator OP_EQ(const int rhs) {                     \
     Set(expr, NOVA(expr, IntConst(rhs)));                       \
     return *this;                                               \
   }
 
-  // An APPROX_OP defines both an arithmetic and an assignment operator
-  // that accept either a NovaExpr or a double on the right-hand side.
-#define APPROX_OP(OP, OP_EQ, NOVA)                              \
-  NOVA_OP(OP, OP_EQ, NOVA)                                      \
-                                                                \
-  friend NovaExpr operator OP(NovaExpr lhs, const double rhs) { \
-    NovaExpr result(lhs, true);                                 \
-    Set(result.expr, NOVA(lhs.expr, AConst(rhs)));              \
-    return result;                                              \
-  }                                                             \
+  // An APPROX_OP_EQ defines an assignment operator that accepts either a
+  // NovaExpr, a NovaTerm, or a double on the right-hand side.
+#define APPROX_OP_EQ(OP_EQ, NOVA)                               \
+  NOVA_OP_EQ(OP_EQ, NOVA)                                       \
                                                                 \
   NovaExpr& operator OP_EQ(const double rhs) {                  \
     Set(expr, NOVA(expr, AConst(rhs)));                         \
     return *this;                                               \
   }
 
-  // A GENERAL_OP defines both an arithmetic and an assignment operator
-  // that accept a NovaExpr, an integer, or a double on the right-hand
-  // side.
-#define GENERAL_OP(OP, OP_EQ, NOVA)                             \
-  NOVA_OP(OP, OP_EQ, NOVA)                                      \
-                                                                \
-  friend NovaExpr operator OP(NovaExpr lhs, const int rhs) {    \
-    NovaExpr result(lhs, true);                                 \
-    Set(result.expr, NOVA(lhs.expr, IntConst(rhs)));            \
-    return result;                                              \
-  }                                                             \
-                                                                \
-  NovaExpr& operator OP_EQ(const int rhs) {                     \
-    Set(expr, NOVA(expr, IntConst(rhs)));                       \
-    return *this;                                               \
-  }                                                             \
-                                                                \
-  friend NovaExpr operator OP(NovaExpr lhs, const double rhs) { \
-    NovaExpr result(lhs, true);                                 \
-    Set(result.expr, NOVA(lhs.expr, AConst(rhs)));              \
-    return result;                                              \
-  }                                                             \
+  // A GENERAL_OP_EQ defines an assignment operator that accepts a
+  // NovaExpr, a NovaTerm, an integer, or a double on the right-hand side.
+#define GENERAL_OP_EQ(OP_EQ, NOVA)                              \
+  INTEGER_OP_EQ(OP_EQ, NOVA)                                    \
                                                                 \
   NovaExpr& operator OP_EQ(const double rhs) {                  \
     Set(expr, NOVA(expr, AConst(rhs)));                         \
     return *this;                                               \
   }
 
-  // A GENERAL_REL defines a relational operator that accepts a NovaExpr,
-  // an integer, or a double on the right-hand side.
-#define GENERAL_REL(OP, NOVA)                                           \
-  friend NovaExpr operator OP(const NovaExpr& lhs,                      \
-                              const NovaExpr& rhs) {                    \
-    NovaExpr result;                                                    \
-    result.expr_type = convert_to_var(lhs.expr_type);                   \
-    result.is_approx = false;                                           \
-    result.expr = NOVA(lhs.expr, rhs.expr);                             \
-    return result;                                                      \
-  }                                                                     \
-                                                                        \
-  friend NovaExpr operator OP(const NovaExpr& lhs, int rhs) {           \
-    NovaExpr result;                                                    \
-    result.expr_type = convert_to_var(lhs.expr_type);                   \
-    result.is_approx = false;                                           \
-    result.expr = NOVA(lhs.expr, IntConst(rhs));                        \
-    return result;                                                      \
-  }                                                                     \
-                                                                        \
-  friend NovaExpr operator OP(const NovaExpr& lhs, double rhs) {        \
-    NovaExpr result;                                                    \
-    result.expr_type = convert_to_var(lhs.expr_type);                   \
-    result.is_approx = false;                                           \
-    result.expr = NOVA(lhs.expr, AConst(rhs));                          \
-    return result;                                                      \
-  }
-
   // ----- Basic arithmetic -----
 
-  GENERAL_OP(+, +=, Add)
-  GENERAL_OP(-, -=, Sub)
-  APPROX_OP(*, *=, Mul)
-  APPROX_OP(/, /=, Div)
-
-  NovaExpr operator-() {
-    NovaExpr result;
-    result.expr_type = convert_to_var(expr_type);
-    result.is_approx = is_approx;
-    result.expr = Sub(is_approx ? AConst(0.0) : IntConst(0), expr);
-    return result;
-  }
+  GENERAL_OP_EQ(+=, Add)
+  GENERAL_OP_EQ(-=, Sub)
+  APPROX_OP_EQ(*=, Mul)
+  APPROX_OP_EQ(/=, Div)
 
   // ----- Bit manipulation -----
 
-  INTEGER_OP(|, |=, Or)
-  INTEGER_OP(&, &=, And)
-  INTEGER_OP(^, ^=, Xor)
-  INTEGER_OP(<<, <<=, Asl)
-  INTEGER_OP(>>, >>=, Asr)
+  INTEGER_OP_EQ(|=, Or)
+  INTEGER_OP_EQ(&=, And)
+  INTEGER_OP_EQ(^=, Xor)
+  INTEGER_OP_EQ(<<=, Asl)
+  INTEGER_OP_EQ(>>=, Asr)
 
   // ----- Prefix and postfix operators -----
 
@@ -449,7 +442,7 @@ public:
         val.row_idx = IntConst(idx);
         break;
       case NovaCUMemArray:
-        val.expr_type = NovaCUVar;
+        val.expr_type = NovaCUMemArrayPartial;
         val.expr = expr;
         val.row_idx = IntConst(idx);
         break;
@@ -502,55 +495,368 @@ public:
     }
     return val;
   }
+};
 
-  // ----- Square root -----
-
-  friend NovaExpr sqrt(const NovaExpr& x) {
-    NovaExpr s(x);
-    Set(s.expr, Sqrt(x.expr));
-    return s;
+// Represent an unevaluated arithmetic or logical expression.  Operators on
+// NovaExprs and NovaTerms build a NovaTerm holding a tree of Nova
+// expressions and emit no code; only assigning the NovaTerm to a NovaExpr
+// (or constructing a NovaExpr from it) emits a single Set of the whole
+// tree.  An expression such as x[i] += a*b + c*d therefore needs no
+// temporary variables.  A NovaTerm reads its operands' values when it is
+// assigned, not when it is built, so it should be assigned before any of
+// its operands change or go out of scope.
+class NovaTerm {
+private:
+  // Keep alive any variables the tree reads that were allocated on its
+  // behalf.
+  std::vector<std::shared_ptr<const NovaExpr>> temps;
+
+  // Determine the storage class of a combination of two operands: APE if
+  // either operand is on the APEs and CU otherwise.
+  static NovaExpr::nova_t combine_types(NovaExpr::nova_t lhs, NovaExpr::nova_t rhs) {
+    if (NovaExpr::convert_to_var(lhs) == NovaExpr::NovaApeVar ||
+        NovaExpr::convert_to_var(rhs) == NovaExpr::NovaApeVar)
+      return NovaExpr::NovaApeVar;
+    return NovaExpr::NovaCUVar;
   }
 
-  // ----- Conditionals -----
-
-  GENERAL_REL(==, Eq)
-  GENERAL_REL(!=, Ne)
-  GENERAL_REL(<, Lt)
-  GENERAL_REL(<=, Le)
-  GENERAL_REL(>, Gt)
-  GENERAL_REL(>=, Ge)
+  // Evaluate a term into a new variable, and wrap that.
+  static NovaTerm evaluate(const NovaTerm& term) {
+    auto var = std::make_shared<const NovaExpr>(term);
+    NovaTerm result(*var);
+    result.temps.push_back(var);
+    return result;
+  }
 
-  // ----- Logical operators -----
+public:
+  scExpr expr;                 // Nova expression tree
+  NovaExpr::nova_t expr_type;  // NovaApeVar or NovaCUVar (or, if the term
+                               // wraps a NovaExpr, that NovaExpr's type)
+  bool is_approx;              // true=Approx; false=Int
+
+  // Return true if the NovaTerm is an Approx and false if it is an Int.
+  bool approx() const { return is_approx; }
+
+  // Wrap a NovaExpr without copying it.
+  NovaTerm(const NovaExpr& e) : expr(e.expr), expr_type(e.expr_type),
+                                is_approx(e.is_approx) { }
+
+  // Wrap the tree for a Nova operator applied to one term.
+  static NovaTerm apply(scExpr tree, bool approx, const NovaTerm& arg) {
+    NovaTerm result(arg);
+    result.expr = tree;
+    result.expr_type = NovaExpr::convert_to_var(arg.expr_type);
+    result.is_approx = approx;
+    return result;
+  }
 
-  friend NovaExpr operator||(NovaExpr lhs, NovaExpr rhs) {
-    NovaExpr result;
-    result.expr_type = convert_to_var(lhs.expr_type);
-    result.is_approx = false;
-    result.expr = Or(lhs.expr, rhs.expr);
+  // Wrap the tree for a Nova operator applied to two terms.
+  static NovaTerm apply(scExpr tree, bool approx,
+                        const NovaTerm& lhs, const NovaTerm& rhs) {
+    NovaTerm result(apply(tree, approx, lhs));
+    result.expr_type = combine_types(lhs.expr_type, rhs.expr_type);
+    result.temps.insert(result.temps.end(), rhs.temps.begin(), rhs.temps.end());
     return result;
   }
 
-  friend NovaExpr operator&&(NovaExpr lhs, NovaExpr rhs) {
-    NovaExpr result;
-    result.expr_type = convert_to_var(lhs.expr_type);
-    result.is_approx = false;
-    result.expr = And(lhs.expr, rhs.expr);
+  // Wrap the tree for an arithmetic operator applied to two terms.  The
+  // result has the type of the left-hand side.  An Int combined with an
+  // Approx is evaluated into an Int variable right away, as though it had
+  // been assigned to one, so that mixed-type expressions convert at the
+  // same point they would if every operator emitted its own Set.
+  static NovaTerm binary(scExpr tree, const NovaTerm& lhs, const NovaTerm& rhs) {
+    NovaTerm result(apply(tree, lhs.is_approx, lhs, rhs));
+    if (!lhs.is_approx && rhs.is_approx)
+      return evaluate(result);
     return result;
   }
 
-  friend NovaExpr operator!(NovaExpr rhs) {
-    NovaExpr result;
-    result.expr_type = convert_to_var(rhs.expr_type);
-    result.is_approx = false;
-    result.expr = Not(rhs.expr);
+  // Wrap the tree for an arithmetic operator applied to a term and an
+  // integer constant.
+  static NovaTerm binary(scExpr tree, const NovaTerm& lhs, int rhs) {
+    return apply(tree, lhs.is_approx, lhs);
+  }
+
+  // Wrap the tree for an arithmetic operator applied to a term and an
+  // Approx constant.
+  static NovaTerm binary(scExpr tree, const NovaTerm& lhs, double rhs) {
+    NovaTerm result(apply(tree, lhs.is_approx, lhs));
+    if (!lhs.is_approx)
+      return evaluate(result);
     return result;
   }
 };
 
+// ----- Assignment from terms -----
+
+inline NovaExpr::NovaExpr(const NovaTerm& term) {
+  expr_type = convert_to_var(term.expr_type);
+  is_approx = term.is_approx;
+  rows = 1;
+  cols = 1;
+  define_expr();
+  Set(expr, term.expr);
+}
+
+inline NovaExpr& NovaExpr::operator=(const NovaTerm& rhs) {
+  if (expr_type == NovaInvalidType) {
+    expr_type = convert_to_var(rhs.expr_type);
+    is_approx = rhs.is_approx;
+    rows = 1;
+    cols = 1;
+    define_expr();
+  }
+  Set(expr, rhs.expr);
+  return *this;
+}
+
+#define NOVA_OP_EQ_DEFN(OP_EQ, NOVA)                                    \
+  inline NovaExpr& NovaExpr::operator OP_EQ(const NovaTerm& rhs) {      \
+    Set(expr, NOVA(expr, rhs.expr));                                    \
+    return *this;                                                       \
+  }
+
+NOVA_OP_EQ_DEFN(+=, Add)
+NOVA_OP_EQ_DEFN(-=, Sub)
+NOVA_OP_EQ_DEFN(*=, Mul)
+NOVA_OP_EQ_DEFN(/=, Div)
+NOVA_OP_EQ_DEFN(|=, Or)
+NOVA_OP_EQ_DEFN(&=, And)
+NOVA_OP_EQ_DEFN(^=, Xor)
+NOVA_OP_EQ_DEFN(<<=, Asl)
+NOVA_OP_EQ_DEFN(>>=, Asr)
+
+// ----- Helper macros -----
+
+// A NOVA_OP defines an arithmetic operator that accepts a NovaExpr or a
+// NovaTerm on either side.
+#define NOVA_OP(OP, NOVA)                                               \
+  inline NovaTerm operator OP(const NovaTerm& lhs, const NovaTerm& rhs) { \
+    return NovaTerm::binary(NOVA(lhs.expr, rhs.expr), lhs, rhs);        \
+  }
+
+// An INTEGER_OP also accepts an integer on the right-hand side.
+#define INTEGER_OP(OP, NOVA)                                            \
+  NOVA_OP(OP, NOVA)                                                     \
+                                                                        \
+  inline NovaTerm operator OP(const NovaTerm& lhs, const int rhs) {     \
+    return NovaTerm::binary(NOVA(lhs.expr, IntConst(rhs)), lhs, rhs);   \
+  }
+
+// An APPROX_OP also accepts a double on the right-hand side.
+#define APPROX_OP(OP, NOVA)                                             \
+  NOVA_OP(OP, NOVA)                                                     \
+                                                                        \
+  inline NovaTerm operator OP(const NovaTerm& lhs, const double rhs) {  \
+    return NovaTerm::binary(NOVA(lhs.expr, AConst(rhs)), lhs, rhs);     \
+  }
+
+// A GENERAL_OP also accepts an integer or a double on the right-hand side.
+#define GENERAL_OP(OP, NOVA)                                            \
+  INTEGER_OP(OP, NOVA)                                                  \
+                                                                        \
+  inline NovaTerm operator OP(const NovaTerm& lhs, const double rhs) {  \
+    return NovaTerm::binary(NOVA(lhs.expr, AConst(rhs)), lhs, rhs);     \
+  }
+
+// A GENERAL_REL defines a relational operator that accepts a NovaExpr, a
+// NovaTerm, an integer, or a double on the right-hand side.
+#define GENERAL_REL(OP, NOVA)                                           \
+  inline NovaTerm operator OP(const NovaTerm& lhs, const NovaTerm& rhs) { \
+    return NovaTerm::apply(NOVA(lhs.expr, rhs.expr), false, lhs, rhs);  \
+  }                                                                     \
+                                                                        \
+  inline NovaTerm operator OP(const NovaTerm& lhs, int rhs) {           \
+    return NovaTerm::apply(NOVA(lhs.expr, IntConst(rhs)), false, lhs);  \
+  }                                                                     \
+                                                                        \
+  inline NovaTerm operator OP(const NovaTerm& lhs, double rhs) {        \
+    return NovaTerm::apply(NOVA(lhs.expr, AConst(rhs)), false, lhs);    \
+  }
+
+// ----- Basic arithmetic -----
+
+GENERAL_OP(+, Add)
+GENERAL_OP(-, Sub)
+APPROX_OP(*, Mul)
+APPROX_OP(/, Div)
+
+inline NovaTerm operator-(const NovaTerm& rhs) {
+  return NovaTerm::apply(Sub(rhs.is_approx ? AConst(0.0) : IntConst(0), rhs.expr),
+                         rhs.is_approx, rhs);
+}
+
+// ----- Bit manipulation -----
+
+INTEGER_OP(|, Or)
+INTEGER_OP(&, And)
+INTEGER_OP(^, Xor)
+INTEGER_OP(<<, Asl)
+INTEGER_OP(>>, Asr)
+
+// ----- Square root -----
+
+inline NovaTerm sqrt(const NovaTerm& x) {
+  return NovaTerm::apply(Sqrt(x.expr), x.is_approx, x);
+}
+
+// ----- Conditionals -----
+
+GENERAL_REL(==, Eq)
+GENERAL_REL(!=, Ne)
+GENERAL_REL(<, Lt)
+GENERAL_REL(<=, Le)
+GENERAL_REL(>, Gt)
+GENERAL_REL(>=, Ge)
+
+// ----- Logical operators -----
+
+inline NovaTerm operator||(const NovaTerm& lhs, const NovaTerm& rhs) {
+  return NovaTerm::apply(Or(lhs.expr, rhs.expr), false, lhs, rhs);
+}
+
+inline NovaTerm operator&&(const NovaTerm& lhs, const NovaTerm& rhs) {
+  return NovaTerm::apply(And(lhs.expr, rhs.expr), false, lhs, rhs);
+}
+
+inline NovaTerm operator!(const NovaTerm& rhs) {
+  return NovaTerm::apply(Not(rhs.expr), false, rhs);
+}
+
+
+// ----- Profiling -----
+
+// Estimate the cost of executing a piece of a kernel.
+struct NovaCost {
+  double ape_ops = 0;       // Operations that every APE steps through
+  double cu_ops = 0;        // Operations that the CU executes
+  double get_moves = 0;     // Bit moves of global gets
+  double mem_accesses = 0;  // Reads and writes of APE or CU memory
+
+  NovaCost& operator+=(const NovaCost& other) {
+    ape_ops += other.ape_ops;
+    cu_ops += other.cu_ops;
+    get_moves += other.get_moves;
+    mem_accesses += other.mem_accesses;
+    return *this;
+  }
+
+  friend NovaCost operator-(NovaCost lhs, const NovaCost& rhs) {
+    lhs.ape_ops -= rhs.ape_ops;
+    lhs.cu_ops -= rhs.cu_ops;
+    lhs.get_moves -= rhs.get_moves;
+    lhs.mem_accesses -= rhs.mem_accesses;
+    return lhs;
+  }
+
+  friend NovaCost operator*(NovaCost lhs, double scale) {
+    lhs.ape_ops *= scale;
+    lhs.cu_ops *= scale;
+    lhs.get_moves *= scale;
+    lhs.mem_accesses *= scale;
+    return lhs;
+  }
+};
+
+// Attribute the cost of the code emitted so far to named regions of the
+// kernel.  The cost of code within a NovaCUForLoop is multiplied by the
+// loop's trip count, so costs estimate operations executed rather than
+// operations emitted.  A loop whose trip count is known only at run time
+// counts as a single trip, so code within such a loop is costed per trip.
+// Profiling requires s1emu; otherwise every cost is zero.
+class NovaProfile {
+private:
+  inline static NovaCost repeats;    // Added cost of repeated loop bodies
+  inline static double trips = 1.0;  // Product of enclosing loops' trip counts
+
+  struct Region {
+    int entries = 0;    // Times the region was emitted
+    NovaCost cost;      // Total cost of the region
+  };
+  inline static std::map<std::string, Region> regions;
+
+public:
+  // Return the cost of the code emitted so far.
+  static NovaCost total() {
+    NovaCost cost;
+#ifdef S1EMU_KERNEL_COUNTS
+    scKernelCounts counts;
+    scGetKernelCounts(&counts);
+    cost.ape_ops = counts.ape_ops;
+    cost.cu_ops = counts.cu_ops;
+    cost.get_moves = counts.get_moves;
+    cost.mem_accesses = counts.mem_accesses;
+#endif
+    cost += repeats;
+    return cost;
+  }
+
+  // Note the start of a loop body that will run loop_trips times, and
+  // return the cost so far.
+  static NovaCost enter_loop(double loop_trips) {
+    trips *= loop_trips;
+    return total();
+  }
+
+  // Note the end of a loop body that began when the cost was start.
+  static void exit_loop(const NovaCost& start, double loop_trips) {
+    repeats += (total() - start)*(loop_trips - 1.0);
+    trips /= loop_trips;
+  }
+
+  // Charge a region for the code emitted since the cost was start.
+  static void charge(const std::string& name, const NovaCost& start) {
+    Region& r = regions[name];
+    r.entries++;
+    r.cost += (total() - start)*trips;
+  }
+
+  // Report the cost of every region and of the kernel as a whole, in
+  // decreasing order of APE operations.
+  static void report(std::FILE* out) {
+#ifdef S1EMU_KERNEL_COUNTS
+    std::vector<std::pair<std::string, Region>> sorted(regions.begin(), regions.end());
+    Region kernel;
+    kernel.entries = 1;
+    kernel.cost = total();
+    sorted.emplace_back("(entire kernel)", kernel);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<std::string, Region>& a,
+                 const std::pair<std::string, Region>& b) {
+                return a.second.cost.ape_ops > b.second.cost.ape_ops;
+              });
+    std::fprintf(out, "%-28s %7s %12s %12s %12s %12s\n", "Region", "Entries",
+                 "APE ops", "CU ops", "Get moves", "Mem accesses");
+    for (const auto& r : sorted)
+      std::fprintf(out, "%-28s %7d %12.0f %12.0f %12.0f %12.0f\n",
+                   r.first.c_str(), r.second.entries,
+                   r.second.cost.ape_ops, r.second.cost.cu_ops,
+                   r.second.cost.get_moves, r.second.cost.mem_accesses);
+#else
+    std::fprintf(out, "Kernel profiling requires s1emu\n");
+#endif
+  }
+};
+
+// Charge the cost of the code emitted during an object's lifetime to a
+// named region.
+class NovaProfileRegion {
+private:
+  std::string name;
+  NovaCost start;
+
+public:
+  explicit NovaProfileRegion(const std::string& name)
+    : name(name), start(NovaProfile::total()) { }
+
+  ~NovaProfileRegion() {
+    NovaProfile::charge(name, start);
+  }
+};
 
 // Perform an if statement on the APEs, taking the then and else clauses as
 // arguments.
-static void NovaApeIf(const NovaExpr& cond,
+static void NovaApeIf(const NovaTerm& cond,
                       const std::function <void ()>& f_then,
                       const std::function <void ()>& f_else=nullptr)
 {
@@ -565,7 +871,7 @@ static void NovaApeIf(const NovaExpr& cond,
 
 // Perform an if statement on the CU, taking the then and else clauses as
 // arguments.
-static void NovaCUIf(const NovaExpr& cond,
+static void NovaCUIf(const NovaTerm& cond,
                      const std::function <void ()>& f_then,
                      const std::function <void ()>& f_else=nullptr)
 {
@@ -584,11 +890,105 @@ static void NovaCUIf(const NovaExpr& cond,
 static void NovaCUForLoop(NovaExpr& var, int from, int to, int step,
                           const std::function <void ()>& f)
 {
+  double trips = 1.0;  // A step of 0 loops until the body changes var.
+  if (step > 0)
+    trips = to < from ? 0.0 : double((to - from)/step + 1);
   CUFor(var.expr, IntConst(from), IntConst(to), IntConst(step));
+  NovaCost start = NovaProfile::enter_loop(trips);
+  f();
+  CUForEnd();
+  NovaProfile::exit_loop(start, trips);
+}
+
+// Perform a for loop on the CU whose upper bound is computed at run time.
+static void NovaCUForLoop(NovaExpr& var, int from, const NovaExpr& to, int step,
+                          const std::function <void ()>& f)
+{
+  CUFor(var.expr, IntConst(from), to.expr, IntConst(step));
   f();
   CUForEnd();
 }
 
+// Represent an unsigned 32-bit count on the CU, whose Ints hold only 16
+// bits, as a high and a low half.  The low half is stored as a signed Int,
+// so values of lo from -32768 to -1 stand for 32768 to 65535.
+class NovaCU32 {
+public:
+  NovaExpr hi;
+  NovaExpr lo;
+
+  // "Declare" a counter without "defining" it.
+  NovaCU32() { }
+
+  // Initialize a counter from a constant.
+  explicit NovaCU32(uint32_t value)
+    : hi(int(int16_t(value >> 16)), NovaExpr::NovaCUVar),
+      lo(int(int16_t(value & 0xFFFF)), NovaExpr::NovaCUVar) { }
+
+  // Initialize a counter from its two halves (e.g., Ints in CU memory).
+  NovaCU32(const NovaExpr& hi, const NovaExpr& lo) : hi(hi, true), lo(lo, true) { }
+
+  // Increment the counter, carrying into the high half.
+  NovaCU32& operator++() {
+    ++lo;
+    NovaCUIf(lo == 0, [&]() {
+      ++hi;
+    });
+    return *this;
+  }
+};
+
+// Perform a for loop on the CU with var running from 0 to count - 1, taking
+// the loop body as an argument.  count.hi must be less than 32767.  Each
+// value of var.hi is split into two blocks of up to 32768 iterations, each
+// an ordinary CUFor over a 16-bit index, so the only per-iteration cost
+// beyond CUForEnd is updating var.lo; carries are handled once per block.
+static void NovaCUForLoop32(NovaCU32& var, const NovaCU32& count,
+                            const std::function <void ()>& f)
+{
+  NovaExpr half(0, NovaExpr::NovaCUVar);    // 0 for lo >= 0; 1 for lo < 0
+  NovaExpr j(0, NovaExpr::NovaCUVar);       // Index within a block
+  NovaExpr last(0, NovaExpr::NovaCUVar);    // Final value of j
+  NovaExpr run(0, NovaExpr::NovaCUVar);     // 1 if the block is nonempty
+  NovaExpr offset(0, NovaExpr::NovaCUVar);  // var.lo - j
+  NovaCUForLoop(var.hi, 0, count.hi, 1, [&]() {
+    // Loop over the halves directly so that the profiler counts each of
+    // var's values once.
+    CUFor(half.expr, IntConst(0), IntConst(1), IntConst(1));
+    // Every block except those for the final value of var.hi runs j
+    // over all 32768 values from -32768 to -1.  A block of n iterations
+    // ends at n + 32767 (mod 65536).
+    last = -1;
+    run = 1;
+    offset = 0;
+    NovaCUIf(half == 0, [&]() {
+      offset = -32768;
+    });
+    NovaCUIf(var.hi == count.hi, [&]() {
+      NovaCUIf(half == 0, [&]() {
+        NovaCUIf(count.lo >= 0, [&]() {
+          last = count.lo + 32767;
+          run = count.lo != 0;
+        });
+      }, [&]() {
+        NovaCUIf(count.lo >= 0, [&]() {
+          run = 0;
+        }, [&]() {
+          last = count.lo - 1;
+          run = count.lo != -32768;
+        });
+      });
+    });
+    NovaCUIf(run != 0, [&]() {
+      CUFor(j.expr, IntConst(-32768), last.expr, IntConst(1));
+      var.lo = j + offset;
+      f();
+      CUForEnd();
+    });
+    CUForEnd();
+  });
+}
+
 // Predefine wrappers for certain registers.
 inline NovaExpr active_chip_row = NovaExpr(cuRChipRow, NovaExpr::NovaRegister);
 inline NovaExpr active_chip_col = NovaExpr(cuRChipCol, NovaExpr::NovaRegister);
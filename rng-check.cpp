@@ -0,0 +1,348 @@
+/*
+ * Check that the S1 and the host generate the same random numbers, and
+ * subject the host's generators to a battery of statistical tests
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "simple-bcmc.h"
+
+// The S1's random numbers must be read back from CU memory.
+#ifdef S1EMU_CU_READBACK
+
+// Generate the first few blocks of random numbers on every APE with the
+// generator selected by RNG_METHOD and compare them to the host's.  APE
+// (row, col) draws from the stream of history row*65536 + col.  Return
+// true if they all agree.
+bool check_rng_kernel(const S1State& s1, unsigned long long seed)
+{
+  const int total_rows = s1.ape_rows*s1.chip_rows;
+  const int total_cols = s1.ape_cols*s1.chip_cols;
+  const int n_apes = total_rows*total_cols;
+  const int n_blocks = 3;
+  const int n_numbers = n_blocks*8;
+
+  // Generate a kernel that keys the generator as emit_nova_code() does
+  // and gathers every APE's first n_numbers random numbers.
+  scNovaInit();
+  scEmitLLKernelCreate();
+  eCUC(cuSetMaskMode, _, _, 1);
+  eCUC(cuSetGroupMode, _, _, 0);
+  eApeC(apeSetMask, _, _, 0);
+  NovaExpr ape_row, ape_col;
+  assign_ape_coords(s1, ape_row, ape_col);
+  counter_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 8);
+  key_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 8);
+  for (int i = 0; i < 8; ++i)
+    counter_3fry[i] = 0;
+  key_3fry[0] = 0;
+  key_3fry[1] = 0;
+  key_3fry[2] = ape_row;
+  key_3fry[3] = ape_col;
+  for (int i = 4; i < 8; ++i)
+    key_3fry[i] = int(int16_t((seed >> 16*(i - 4))&0xFFFF));
+  init_random_draw();
+  std::vector<NovaExpr> randoms;
+  randoms.reserve(4);
+  for (int n = 0; n < 4; ++n)
+    randoms.emplace_back(0);
+  NovaExpr result(0, NovaExpr::NovaCUMemArray, n_numbers, n_apes);
+  NovaExpr d(0, NovaExpr::NovaCUVar);
+  NovaExpr k(0, NovaExpr::NovaCUVar);
+  NovaExpr elt(0, NovaExpr::NovaCUMem);
+  NovaExpr i(0, NovaExpr::NovaCUVar);
+  NovaCUForLoop(d, 0, 2*n_blocks - 1, 1, [&]() {
+    get_random_draw(randoms);
+    for (int n = 0; n < 4; ++n) {
+      i = 0;
+      for (int row = 0; row < total_rows; ++row)
+        for (int col = 0; col < total_cols; ++col) {
+          read_one_ape(elt, randoms[n], row/s1.ape_rows, col/s1.ape_cols,
+                       row%s1.ape_rows, col%s1.ape_cols);
+          result[k][i] = elt;
+          ++i;
+        }
+      ++k;
+    }
+  });
+  eCUC(cuHalt, _, _, _);
+  scKernelTranslate();
+
+  // Run the kernel.
+  extern LLKernel *llKernel;
+  scLLKernelLoad(llKernel, 0);
+  scLLKernelExecute(0);
+  scLLKernelWaitSignal();
+
+  // Compare each APE's numbers to the host's, high half of each word
+  // first.
+  std::vector<double> s1_numbers(size_t(n_numbers)*n_apes);
+  scReadCUMemory(MemAddress(result.expr), int(s1_numbers.size()),
+                 s1_numbers.data());
+  int mismatches = 0;
+  for (int row = 0; row < total_rows; ++row)
+    for (int col = 0; col < total_cols; ++col) {
+      uint32_t key[4];
+      threefry_key_host((uint64_t(row) << 16) | col, seed, key);
+      for (int b = 0; b < n_blocks; ++b) {
+        uint32_t ctr[4] = {uint32_t(b), 0, 0, 0};
+        uint32_t block[1][4];
+        random4x32_host_batch(1, &ctr, key, block);
+        for (int n = 0; n < 8; ++n) {
+          uint32_t word = block[0][n/2];
+          int expected = n%2 == 0 ? int(word >> 16) : int(word & 0xFFFF);
+          int actual = uint16_t(int(s1_numbers[size_t(b*8 + n)*n_apes +
+                                               row*total_cols + col]));
+          if (actual != expected && mismatches++ == 0)
+            std::printf("APE (%d, %d), number %d: S1 %04x, host %04x\n",
+                        row, col, b*8 + n, actual, expected);
+        }
+      }
+    }
+  std::printf("S1 and host random numbers: %d of %d differ\n\n",
+              mismatches, n_numbers*n_apes);
+  return mismatches == 0;
+}
+
+#else
+
+bool check_rng_kernel(const S1State& s1, unsigned long long seed)
+{
+  std::fprintf(stderr, "Comparing the S1's random numbers to the host's requires s1emu\n");
+  return true;
+}
+
+#endif
+
+namespace {
+
+// Describe one generator configuration.
+struct RngConfig {
+  const char* name;
+  void (*gen)(const uint32_t ctr[4], const uint32_t key[4],
+              uint32_t out[4], int rounds);
+  int rounds;
+  bool selected;     // true=the configuration get_random_draw() uses
+};
+
+// Return the probability of a chi-square statistic at least x with dof
+// degrees of freedom, using the Wilson-Hilferty approximation.
+double chi_square_p(double x, double dof)
+{
+  double v = 2.0/(9.0*dof);
+  double z = (std::cbrt(x/dof) - (1.0 - v))/std::sqrt(v);
+  return 0.5*std::erfc(z/std::sqrt(2.0));
+}
+
+// Return the chi-square statistic of counts expected to be uniform.
+double chi_square(const std::vector<double>& counts)
+{
+  double total = 0.0;
+  for (double c : counts)
+    total += c;
+  double expected = total/counts.size();
+  double x = 0.0;
+  for (double c : counts)
+    x += (c - expected)*(c - expected)/expected;
+  return x;
+}
+
+// Generate the stream of 16-bit numbers get_random_draw() draws for a
+// history.
+std::vector<uint16_t> stream(const RngConfig& cfg, uint64_t history,
+                             unsigned long long seed, size_t n_blocks)
+{
+  uint32_t key[4];
+  threefry_key_host(history, seed, key);
+  std::vector<uint16_t> numbers;
+  numbers.reserve(n_blocks*8);
+  for (size_t b = 0; b < n_blocks; ++b) {
+    uint32_t ctr[4] = {uint32_t(b), 0, 0, 0};
+    uint32_t out[4];
+    cfg.gen(ctr, key, out, cfg.rounds);
+    for (int w = 0; w < 4; ++w) {
+      numbers.push_back(uint16_t(out[w] >> 16));
+      numbers.push_back(uint16_t(out[w] & 0xFFFF));
+    }
+  }
+  return numbers;
+}
+
+// Test that every 16-bit value is equally likely.
+double test_uniform(const std::vector<uint16_t>& s)
+{
+  std::vector<double> counts(65536);
+  for (uint16_t r : s)
+    counts[r]++;
+  return chi_square_p(chi_square(counts), 65535);
+}
+
+// Test that every pair of consecutive numbers' high bytes is equally
+// likely.
+double test_serial(const std::vector<uint16_t>& s)
+{
+  std::vector<double> counts(65536);
+  for (size_t i = 0; i + 1 < s.size(); i += 2)
+    counts[(s[i] & 0xFF00) | (s[i + 1] >> 8)]++;
+  return chi_square_p(chi_square(counts), 65535);
+}
+
+// Test that each bit position is set half the time.
+double test_bits(const std::vector<uint16_t>& s)
+{
+  double x = 0.0;
+  for (int bit = 0; bit < 16; ++bit) {
+    double ones = 0.0;
+    for (uint16_t r : s)
+      ones += (r >> bit) & 1;
+    double z = (ones - 0.5*s.size())/std::sqrt(0.25*s.size());
+    x += z*z;
+  }
+  return chi_square_p(x, 16);
+}
+
+// Test that neighboring histories' streams, differing in the low or the
+// high word of the index, are independent by testing the uniformity of
+// their exclusive ORs.
+double test_streams(const RngConfig& cfg, unsigned long long seed,
+                    size_t n_blocks)
+{
+  std::vector<uint16_t> here(stream(cfg, 0, seed, n_blocks));
+  std::vector<uint16_t> next(stream(cfg, 1, seed, n_blocks));
+  std::vector<uint16_t> far(stream(cfg, 1ULL << 32, seed, n_blocks));
+  std::vector<double> counts(65536);
+  for (size_t i = 0; i < here.size(); ++i) {
+    counts[here[i] ^ next[i]]++;
+    counts[here[i] ^ far[i]]++;
+  }
+  return chi_square_p(chi_square(counts), 65535);
+}
+
+// Perform Marsaglia's birthday-spacings test on 32-bit words: the number
+// of repeated spacings among 4096 sorted birthdays in a year of 2^32 days
+// is Poisson with mean 4.
+double test_birthdays(const std::vector<uint16_t>& s)
+{
+  const size_t m = 4096;
+  std::vector<uint32_t> days(m), spacings(m);
+  double repeats = 0.0;
+  size_t reps = s.size()/(2*m);
+  for (size_t rep = 0; rep < reps; ++rep) {
+    for (size_t i = 0; i < m; ++i) {
+      size_t j = 2*(rep*m + i);
+      days[i] = (uint32_t(s[j]) << 16) | s[j + 1];
+    }
+    std::sort(days.begin(), days.end());
+    spacings[0] = days[0];
+    for (size_t i = 1; i < m; ++i)
+      spacings[i] = days[i] - days[i - 1];
+    std::sort(spacings.begin(), spacings.end());
+    for (size_t i = 1; i < m; ++i)
+      if (spacings[i] == spacings[i - 1])
+        repeats++;
+  }
+  double lambda = 4.0*reps;
+  double z = (repeats - lambda)/std::sqrt(lambda);
+  return 0.5*std::erfc(z/std::sqrt(2.0));
+}
+
+// Test the strict avalanche criterion: flipping any one bit of the
+// counter should flip each output bit with probability one half.
+double test_avalanche(const RngConfig& cfg, unsigned long long seed,
+                      int samples)
+{
+  std::mt19937_64 inputs(seed);
+  std::vector<double> flips(128*128);
+  for (int n = 0; n < samples; ++n) {
+    uint32_t ctr[4], key[4], out[4];
+    for (int w = 0; w < 4; ++w) {
+      ctr[w] = uint32_t(inputs());
+      key[w] = uint32_t(inputs());
+    }
+    cfg.gen(ctr, key, out, cfg.rounds);
+    for (int in_bit = 0; in_bit < 128; ++in_bit) {
+      uint32_t ctr2[4] = {ctr[0], ctr[1], ctr[2], ctr[3]};
+      uint32_t out2[4];
+      ctr2[in_bit/32] ^= uint32_t(1) << (in_bit%32);
+      cfg.gen(ctr2, key, out2, cfg.rounds);
+      for (int out_bit = 0; out_bit < 128; ++out_bit)
+        flips[in_bit*128 + out_bit] +=
+          ((out[out_bit/32] ^ out2[out_bit/32]) >> (out_bit%32)) & 1;
+    }
+  }
+  double x = 0.0;
+  for (double f : flips)
+    x += (f - 0.5*samples)*(f - 0.5*samples)/(0.25*samples);
+  return chi_square_p(x, 128*128);
+}
+
+} // anonymous namespace
+
+// Run a battery of statistical tests on the host's implementation of each
+// generator configuration, including the selected one and deliberately
+// weakened ones that show what a failure looks like.  Report each test's
+// p-value, marking those below 0.0001 or above 0.9999 as failures, and
+// return true if the selected configuration passes every test.
+bool check_rng_battery(unsigned long long seed)
+{
+  const RngConfig configs[] = {
+    {"threefry-20", threefry4x32_host, 20,
+     RNG_METHOD == RNG_THREEFRY && THREEFRY_ROUNDS == 20},
+    {"threefry-13", threefry4x32_host, 13,
+     RNG_METHOD == RNG_THREEFRY && THREEFRY_ROUNDS == 13},
+    {"threefry-6", threefry4x32_host, 6,
+     RNG_METHOD == RNG_THREEFRY && THREEFRY_ROUNDS == 6},
+    {"philox-10", philox4x32_host, 10,
+     RNG_METHOD == RNG_PHILOX && PHILOX_ROUNDS == 10},
+    {"philox-7", philox4x32_host, 7,
+     RNG_METHOD == RNG_PHILOX && PHILOX_ROUNDS == 7},
+    {"philox-4", philox4x32_host, 4,
+     RNG_METHOD == RNG_PHILOX && PHILOX_ROUNDS == 4}
+  };
+  std::vector<RngConfig> tested(std::begin(configs), std::end(configs));
+  if (std::none_of(tested.begin(), tested.end(),
+                   [](const RngConfig& cfg) { return cfg.selected; })) {
+    if (RNG_METHOD == RNG_PHILOX)
+      tested.push_back({"philox", philox4x32_host, PHILOX_ROUNDS, true});
+    else
+      tested.push_back({"threefry", threefry4x32_host, THREEFRY_ROUNDS, true});
+  }
+
+  const size_t n_blocks = 1 << 21;   // 2^24 numbers per stream
+  const char* tests[] = {"Uniform", "Serial", "Bits", "Streams",
+                         "Birthdays", "Avalanche"};
+  std::printf("%-16s", "Generator");
+  for (const char* t : tests)
+    std::printf(" %10s", t);
+  std::printf("\n");
+  bool selected_ok = true;
+  for (const RngConfig& cfg : tested) {
+    std::vector<uint16_t> s(stream(cfg, 0, seed, n_blocks));
+    double p[] = {
+      test_uniform(s),
+      test_serial(s),
+      test_bits(s),
+      test_streams(cfg, seed, n_blocks/2),
+      test_birthdays(s),
+      test_avalanche(cfg, seed, 2048)
+    };
+    std::string name(cfg.name);
+    if (name.find('-') == std::string::npos)
+      name += '-' + std::to_string(cfg.rounds);
+    std::printf("%-16s", name.c_str());
+    bool ok = true;
+    for (double pv : p) {
+      bool pass = pv >= 1e-4 && pv <= 1.0 - 1e-4;
+      ok = ok && pass;
+      std::printf(" %9.3g%c", pv, pass ? ' ' : '!');
+    }
+    std::printf("%s\n", cfg.selected ? "  (selected)" : "");
+    if (cfg.selected)
+      selected_ok = ok;
+  }
+  return selected_ok;
+}
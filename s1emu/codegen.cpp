@@ -0,0 +1,485 @@
+/*
+ * Code generator for the S1 emulator: build expression nodes and record
+ * Nova statements into a kernel
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include "s1emu.h"
+
+namespace s1emu {
+
+Machine machine;
+std::vector<Node> nodes;
+
+namespace {
+
+std::vector<Instr> program;            // Kernel under construction
+std::vector<int> cu_stack;             // Open CUIf and CUFor instructions
+int ape_depth = 0;                     // Nesting depth of ApeIf
+int ape_words = 0;                     // Words of APE storage allocated
+int cu_words = 0;                      // Words of CU storage allocated
+std::map<int, scExpr> int_consts;      // Memoized IntConst nodes
+std::map<float, scExpr> approx_consts; // Memoized AConst nodes
+scKernelCounts counts;                 // Operations emitted so far
+bool generating = false;               // Kernel under construction?
+std::map<std::pair<bool, int>, std::vector<int>>
+  free_slots;                          // Released storage by APE/CU and size
+
+// Add a node to the table and return its handle.
+scExpr new_node(const Node& n)
+{
+  nodes.push_back(n);
+  return first_node + scExpr(nodes.size() - 1);
+}
+
+// Return a blank node of a given kind.
+Node blank_node(node_t kind)
+{
+  Node n = Node();
+  n.kind = kind;
+  return n;
+}
+
+// Complain about a malformed kernel.
+[[noreturn]] void codegen_error(const std::string& msg)
+{
+  throw std::invalid_argument("s1emu: " + msg);
+}
+
+// Count the operators and memory accesses in an expression.
+void count_expr(scExpr e)
+{
+  if (e < first_node)
+    return;   // Nothing or a CU register
+  const Node& n = node(e);
+  switch (n.kind) {
+    case StorageNode:
+      if (n.mem)
+        counts.mem_accesses++;
+      break;
+    case IndexNode:
+      counts.mem_accesses++;
+      count_expr(n.b);
+      count_expr(n.c);
+      break;
+    case UnaryNode:
+    case BinaryNode:
+      (n.on_ape ? counts.ape_ops : counts.cu_ops)++;
+      count_expr(n.a);
+      count_expr(n.b);
+      break;
+    default:
+      break;
+  }
+}
+
+// Count the operations an instruction performs.
+void count_instr(const Instr& in)
+{
+  switch (in.kind) {
+    case SetInstr:
+      (expr_on_ape(in.a) ? counts.ape_ops : counts.cu_ops)++;
+      count_expr(in.a);
+      count_expr(in.b);
+      break;
+    case ApeIfInstr:
+      counts.ape_ops++;
+      count_expr(in.a);
+      break;
+    case ApeElseInstr:
+    case ApeFiInstr:
+      counts.ape_ops++;
+      break;
+    case CUIfInstr:
+      counts.cu_ops++;
+      count_expr(in.a);
+      break;
+    case CUForInstr:
+      counts.cu_ops++;
+      count_expr(in.b);
+      count_expr(in.c);
+      break;
+    case CUForEndInstr:
+      counts.cu_ops++;
+      count_expr(in.c);
+      count_expr(in.d);
+      break;
+    case ApeOpInstr:
+      counts.ape_ops++;
+      if (in.op == apeGetGMove)
+        counts.get_moves++;
+      else if (in.op == apeSet)
+        count_expr(in.c);
+      break;
+    case CUOpInstr:
+      counts.cu_ops++;
+      break;
+    default:
+      break;
+  }
+}
+
+// Append an instruction to the kernel.
+int emit(instr_t kind, int op = 0, int a = 0, int b = 0, int c = 0, int d = 0)
+{
+  Instr in = Instr();
+  in.kind = kind;
+  in.op = op;
+  in.a = a;
+  in.b = b;
+  in.c = c;
+  in.d = d;
+  in.target = -1;
+  count_instr(in);
+  program.push_back(in);
+  return int(program.size() - 1);
+}
+
+// Build a binary node, inferring its type from its operator and operands.
+scExpr binary(op_t op, scExpr a, scExpr b)
+{
+  Node n = blank_node(BinaryNode);
+  n.op = op;
+  n.a = a;
+  n.b = b;
+  n.on_ape = expr_on_ape(a) || expr_on_ape(b);
+  switch (op) {
+    case OpAdd:
+    case OpSub:
+    case OpMul:
+    case OpDiv:
+      n.approx = expr_is_approx(a) || expr_is_approx(b);
+      break;
+    default:
+      n.approx = false;
+      break;
+  }
+  return new_node(n);
+}
+
+// Build a unary node.
+scExpr unary(op_t op, scExpr a, bool approx)
+{
+  Node n = blank_node(UnaryNode);
+  n.op = op;
+  n.a = a;
+  n.on_ape = expr_on_ape(a);
+  n.approx = approx;
+  return new_node(n);
+}
+
+// Return the number of words a storage node occupies.
+int storage_words(const Node& n)
+{
+  return n.cols > 0 ? n.rows*n.cols : n.rows;
+}
+
+// Ensure that an expression can be the target of a Set or CUFor.
+void check_lvalue(scExpr e)
+{
+  if (e > 0 && e < first_node)
+    return;   // CU register
+  node_t kind = node(e).kind;
+  if (kind != StorageNode && kind != IndexNode)
+    codegen_error("assignment to an expression that is not a variable");
+}
+
+} // anonymous namespace
+
+const Node& node(scExpr e)
+{
+  if (e < first_node || e >= first_node + scExpr(nodes.size()))
+    codegen_error("reference to undefined expression " + std::to_string(e));
+  return nodes[e - first_node];
+}
+
+bool expr_is_approx(scExpr e)
+{
+  return e >= first_node && node(e).approx;
+}
+
+bool expr_on_ape(scExpr e)
+{
+  return e >= first_node && node(e).on_ape;
+}
+
+Kernel translate()
+{
+  if (!cu_stack.empty())
+    codegen_error("CUIf or CUFor without a matching CUFi or CUForEnd");
+  if (ape_depth != 0)
+    codegen_error("ApeIf without a matching ApeFi");
+  generating = false;
+  free_slots.clear();
+  Kernel k;
+  k.program = program;
+  k.ape_words = ape_words;
+  k.cu_words = cu_words;
+  return k;
+}
+
+// Discard the kernel under construction.
+void reset_program()
+{
+  program.clear();
+  cu_stack.clear();
+  ape_depth = 0;
+  generating = true;
+  free_slots.clear();
+  counts = scKernelCounts();
+}
+
+} // namespace s1emu
+
+using namespace s1emu;
+
+// ----- Declarations -----
+
+scExpr scDefine(scExpr var, int storage, int type, int rows, int cols)
+{
+  if (var != 0)
+    return var;
+  Node n = blank_node(StorageNode);
+  n.approx = type == Approx;
+  n.ape = storage == scApeVarClass || storage == scApeMemClass;
+  n.mem = storage == scApeMemClass || storage == scCUMemClass;
+  n.on_ape = n.ape;
+  n.rows = rows;
+  n.cols = cols;
+  int words = storage_words(n);
+  if (words < 0)
+    codegen_error("declaration of a vector or array of negative size");
+  std::vector<int>& reusable = free_slots[{n.ape, words}];
+  if (!reusable.empty()) {
+    n.addr = reusable.back();
+    reusable.pop_back();
+  }
+  else if (n.ape) {
+    n.addr = ape_words;
+    ape_words += words;
+  }
+  else {
+    n.addr = cu_words;
+    cu_words += words;
+  }
+  return new_node(n);
+}
+
+// Storage released after the kernel has been translated (e.g., by the
+// destructors of global variables) is simply dropped.
+void scRelease(scExpr var)
+{
+  if (!generating)
+    return;
+  const Node& n = node(var);
+  if (n.kind != StorageNode)
+    codegen_error("release of something other than a variable");
+  free_slots[{n.ape, storage_words(n)}].push_back(n.addr);
+}
+
+void scGetKernelCounts(scKernelCounts *counts)
+{
+  *counts = s1emu::counts;
+}
+
+// ----- Constants -----
+
+scExpr IntConst(int i)
+{
+  i = int(int16_t(i));
+  auto iter = int_consts.find(i);
+  if (iter != int_consts.end())
+    return iter->second;
+  Node n = blank_node(ConstNode);
+  n.value = float(i);
+  scExpr e = new_node(n);
+  int_consts[i] = e;
+  return e;
+}
+
+scExpr AConst(double d)
+{
+  float f = float(d);
+  auto iter = approx_consts.find(f);
+  if (iter != approx_consts.end())
+    return iter->second;
+  Node n = blank_node(ConstNode);
+  n.approx = true;
+  n.value = f;
+  scExpr e = new_node(n);
+  approx_consts[f] = e;
+  return e;
+}
+
+// ----- Operators -----
+
+scExpr Add(scExpr a, scExpr b) { return binary(OpAdd, a, b); }
+scExpr Sub(scExpr a, scExpr b) { return binary(OpSub, a, b); }
+scExpr Mul(scExpr a, scExpr b) { return binary(OpMul, a, b); }
+scExpr Div(scExpr a, scExpr b) { return binary(OpDiv, a, b); }
+scExpr And(scExpr a, scExpr b) { return binary(OpAnd, a, b); }
+scExpr Or(scExpr a, scExpr b)  { return binary(OpOr, a, b); }
+scExpr Xor(scExpr a, scExpr b) { return binary(OpXor, a, b); }
+scExpr Asl(scExpr a, scExpr b) { return binary(OpAsl, a, b); }
+scExpr Asr(scExpr a, scExpr b) { return binary(OpAsr, a, b); }
+scExpr Eq(scExpr a, scExpr b)  { return binary(OpEq, a, b); }
+scExpr Ne(scExpr a, scExpr b)  { return binary(OpNe, a, b); }
+scExpr Lt(scExpr a, scExpr b)  { return binary(OpLt, a, b); }
+scExpr Le(scExpr a, scExpr b)  { return binary(OpLe, a, b); }
+scExpr Gt(scExpr a, scExpr b)  { return binary(OpGt, a, b); }
+scExpr Ge(scExpr a, scExpr b)  { return binary(OpGe, a, b); }
+scExpr Not(scExpr a)  { return unary(OpNot, a, false); }
+scExpr Sqrt(scExpr a) { return unary(OpSqrt, a, true); }
+
+// ----- Indexing -----
+
+scExpr IndexVector(scExpr v, scExpr i)
+{
+  const Node& vn = node(v);
+  if (vn.kind != StorageNode || vn.rows < 1)
+    codegen_error("IndexVector applied to a non-vector");
+  Node n = blank_node(IndexNode);
+  n.approx = vn.approx;
+  n.on_ape = vn.ape || expr_on_ape(i);
+  n.a = v;
+  n.b = i;
+  return new_node(n);
+}
+
+scExpr IndexArray(scExpr a, scExpr r, scExpr c)
+{
+  const Node& an = node(a);
+  if (an.kind != StorageNode || an.cols < 1)
+    codegen_error("IndexArray applied to a non-array");
+  Node n = blank_node(IndexNode);
+  n.approx = an.approx;
+  n.on_ape = an.ape || expr_on_ape(r) || expr_on_ape(c);
+  n.a = a;
+  n.b = r;
+  n.c = c;
+  return new_node(n);
+}
+
+int MemAddress(scExpr m)
+{
+  const Node& n = node(m);
+  if (n.kind != StorageNode || n.ape)
+    codegen_error("MemAddress applied to something other than CU memory");
+  return n.addr;
+}
+
+// ----- Statements -----
+
+void Set(scExpr dest, scExpr src)
+{
+  check_lvalue(dest);
+  if (!expr_on_ape(dest) && expr_on_ape(src))
+    codegen_error("APE data assigned to a CU variable");
+  emit(SetInstr, 0, dest, src);
+}
+
+void ApeIf(scExpr cond)
+{
+  emit(ApeIfInstr, 0, cond);
+  ape_depth++;
+}
+
+void ApeElse(void)
+{
+  if (ape_depth == 0)
+    codegen_error("ApeElse outside of an ApeIf");
+  emit(ApeElseInstr);
+}
+
+void ApeFi(void)
+{
+  if (ape_depth == 0)
+    codegen_error("ApeFi without a matching ApeIf");
+  emit(ApeFiInstr);
+  ape_depth--;
+}
+
+void CUIf(scExpr cond)
+{
+  if (expr_on_ape(cond))
+    codegen_error("CUIf on APE data");
+  cu_stack.push_back(emit(CUIfInstr, 0, cond));
+}
+
+void CUFi(void)
+{
+  if (cu_stack.empty() || program[cu_stack.back()].kind != CUIfInstr)
+    codegen_error("CUFi without a matching CUIf");
+  int fi = emit(CUFiInstr);
+  program[cu_stack.back()].target = fi;
+  cu_stack.pop_back();
+}
+
+void CUFor(scExpr var, scExpr from, scExpr to, scExpr step)
+{
+  check_lvalue(var);
+  if (expr_on_ape(var) || expr_on_ape(from) ||
+      expr_on_ape(to) || expr_on_ape(step))
+    codegen_error("CUFor on APE data");
+  cu_stack.push_back(emit(CUForInstr, 0, var, from, to, step));
+}
+
+void CUForEnd(void)
+{
+  if (cu_stack.empty() || program[cu_stack.back()].kind != CUForInstr)
+    codegen_error("CUForEnd without a matching CUFor");
+  int loop = cu_stack.back();
+  const Instr& head = program[loop];
+  int end = emit(CUForEndInstr, 0, head.a, head.b, head.c, head.d);
+  program[end].target = loop;
+  program[loop].target = end;
+  cu_stack.pop_back();
+}
+
+void TraceOneRegisterAllApes(scExpr e)
+{
+  emit(TraceInstr, 0, e);
+}
+
+// ----- Low-level instructions -----
+
+void eApeC(int op, int a, int b, int c)
+{
+  emit(ApeOpInstr, op, a, b, c);
+}
+
+void eApeX(int op, int reg, int unused, int expr)
+{
+  emit(ApeOpInstr, op, reg, unused, expr);
+}
+
+void eApeR(int op, int dest, int reg1, int reg2)
+{
+  emit(ApeOpInstr, op, dest, reg1, reg2);
+}
+
+void eCUC(int op, int a, int b, int c)
+{
+  emit(CUOpInstr, op, a, b, c);
+}
+
+void eControl(int op, int reg)
+{
+  // Register reservation matters only to a real register allocator.
+  (void) op;
+  (void) reg;
+}
+
+void scNovaInit(void)
+{
+  reset_program();
+}
+
+void scEmitLLKernelCreate(void)
+{
+  reset_program();
+}
@@ -0,0 +1,799 @@
+/*
+ * Interpreter for the S1 emulator
+ *
+ * Every APE is a SIMD lane.  The APE grid is divided by rows among host
+ * threads, and each thread interprets the entire kernel over its own lanes,
+ * replicating the CU's state.  The CU's control flow never depends on APE
+ * data except through collective operations (cuRead and global gets), at
+ * which all threads synchronize, so the replicas never diverge.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "s1emu.h"
+
+namespace s1emu {
+
+namespace {
+
+// Lanes are processed in chunks small enough for temporaries to stay in cache.
+const int chunk = 256;
+
+// Describe how Approx values are rounded after each operation.
+uint32_t approx_round = 0;          // Added to the IEEE single bits
+uint32_t approx_mask = 0xFFFFFFFF;  // ANDed with the IEEE single bits
+
+// Round a float to the precision of an Approx.
+inline float quantize(float x)
+{
+  uint32_t u;
+  std::memcpy(&u, &x, sizeof(u));
+  u = (u + approx_round) & approx_mask;
+  std::memcpy(&x, &u, sizeof(u));
+  return x;
+}
+
+// Convert a value to an Int's range, wrapping modulo 2^16.
+inline float wrap16(int32_t i)
+{
+  return float(int16_t(uint16_t(uint32_t(i))));
+}
+
+// Convert a value to an integer, truncating toward zero.
+inline int32_t to_int(float x)
+{
+  return int32_t(x);
+}
+
+// Define functors for each operator, with separate Int and Approx versions
+// where the two differ.
+struct AddA { float operator()(float x, float y) const { return quantize(x + y); } };
+struct SubA { float operator()(float x, float y) const { return quantize(x - y); } };
+struct MulA { float operator()(float x, float y) const { return quantize(x*y); } };
+struct DivA { float operator()(float x, float y) const { return quantize(x/y); } };
+struct AddI { float operator()(float x, float y) const { return wrap16(to_int(x) + to_int(y)); } };
+struct SubI { float operator()(float x, float y) const { return wrap16(to_int(x) - to_int(y)); } };
+struct MulI { float operator()(float x, float y) const { return wrap16(to_int(x)*to_int(y)); } };
+struct DivI {
+  float operator()(float x, float y) const {
+    int32_t d = to_int(y);
+    return d == 0 ? 0.0f : wrap16(to_int(x)/d);
+  }
+};
+struct AndI { float operator()(float x, float y) const { return wrap16(to_int(x) & to_int(y)); } };
+struct OrI  { float operator()(float x, float y) const { return wrap16(to_int(x) | to_int(y)); } };
+struct XorI { float operator()(float x, float y) const { return wrap16(to_int(x) ^ to_int(y)); } };
+struct AslI {
+  float operator()(float x, float y) const {
+    int32_t s = to_int(y);
+    return s < 0 || s > 15 ? 0.0f : wrap16(int32_t(uint32_t(to_int(x)) << s));
+  }
+};
+struct AsrI {
+  float operator()(float x, float y) const {
+    int32_t s = std::min(std::max(to_int(y), 0), 15);
+    return float(int16_t(to_int(x)) >> s);
+  }
+};
+struct EqR { float operator()(float x, float y) const { return x == y ? 1.0f : 0.0f; } };
+struct NeR { float operator()(float x, float y) const { return x != y ? 1.0f : 0.0f; } };
+struct LtR { float operator()(float x, float y) const { return x < y ? 1.0f : 0.0f; } };
+struct LeR { float operator()(float x, float y) const { return x <= y ? 1.0f : 0.0f; } };
+struct GtR { float operator()(float x, float y) const { return x > y ? 1.0f : 0.0f; } };
+struct GeR { float operator()(float x, float y) const { return x >= y ? 1.0f : 0.0f; } };
+struct NotU  { float operator()(float x, float) const { return x == 0.0f ? 1.0f : 0.0f; } };
+struct SqrtU { float operator()(float x, float) const { return quantize(std::sqrt(x)); } };
+
+// Invoke a visitor on the functor corresponding to a node's operator.
+template <class Visitor>
+void dispatch(const Node& n, Visitor v)
+{
+  switch (n.op) {
+    case OpAdd: if (n.approx) v(AddA()); else v(AddI()); break;
+    case OpSub: if (n.approx) v(SubA()); else v(SubI()); break;
+    case OpMul: if (n.approx) v(MulA()); else v(MulI()); break;
+    case OpDiv: if (n.approx) v(DivA()); else v(DivI()); break;
+    case OpAnd: v(AndI()); break;
+    case OpOr:  v(OrI()); break;
+    case OpXor: v(XorI()); break;
+    case OpAsl: v(AslI()); break;
+    case OpAsr: v(AsrI()); break;
+    case OpEq:  v(EqR()); break;
+    case OpNe:  v(NeR()); break;
+    case OpLt:  v(LtR()); break;
+    case OpLe:  v(LeR()); break;
+    case OpGt:  v(GtR()); break;
+    case OpGe:  v(GeR()); break;
+    case OpNot: v(NotU()); break;
+    case OpSqrt: v(SqrtU()); break;
+  }
+}
+
+// Convert a value to the type of its destination.
+inline float convert(float x, bool approx)
+{
+  return approx ? quantize(x) : wrap16(to_int(x));
+}
+
+// Represent an operand as either a vector of per-lane values or a scalar.
+struct Operand {
+  const float* p;     // Per-lane values, or nullptr for a scalar
+  float s;            // Scalar value
+};
+
+// Apply a binary functor to a chunk of lanes.
+template <class F>
+void apply(F f, Operand a, Operand b, float* out, int n)
+{
+  if (a.p != nullptr && b.p != nullptr)
+    for (int i = 0; i < n; ++i)
+      out[i] = f(a.p[i], b.p[i]);
+  else if (a.p != nullptr) {
+    float y = b.s;
+    for (int i = 0; i < n; ++i)
+      out[i] = f(a.p[i], y);
+  }
+  else if (b.p != nullptr) {
+    float x = a.s;
+    for (int i = 0; i < n; ++i)
+      out[i] = f(x, b.p[i]);
+  }
+  else {
+    float r = f(a.s, b.s);
+    for (int i = 0; i < n; ++i)
+      out[i] = r;
+  }
+}
+
+// Synchronize a fixed number of threads.
+class Barrier {
+private:
+  std::mutex mtx;
+  std::condition_variable cv;
+  int n_threads;
+  int waiting = 0;
+  unsigned long generation = 0;
+
+public:
+  explicit Barrier(int n) : n_threads(n) { }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mtx);
+    unsigned long gen = generation;
+    if (++waiting == n_threads) {
+      waiting = 0;
+      generation++;
+      cv.notify_all();
+    }
+    else
+      cv.wait(lock, [&]() { return gen != generation; });
+  }
+};
+
+// State shared by all threads executing a kernel.
+struct Shared {
+  const Kernel* k;
+  const std::vector<float>* cu_init;  // Initial contents of CU memory
+  int total_rows;                 // APE rows in the whole machine
+  int total_cols;                 // APE columns in the whole machine
+  Barrier barrier;
+  std::vector<float> exchange;    // One value per APE, for collectives
+  std::vector<uint32_t> or_bits;  // Per-thread partial results of cuRead
+  std::vector<int> or_count;
+  std::vector<float> or_value;
+  std::atomic<bool> warned_oob;
+
+  Shared(const Kernel* kernel, const std::vector<float>* cu_memory, int n_threads)
+    : k(kernel), cu_init(cu_memory),
+      total_rows(machine.chip_rows*machine.ape_rows),
+      total_cols(machine.chip_cols*machine.ape_cols),
+      barrier(n_threads),
+      exchange(size_t(total_rows)*total_cols),
+      or_bits(n_threads), or_count(n_threads), or_value(n_threads),
+      warned_oob(false)
+  {
+  }
+};
+
+// One level of the APE mask stack.
+struct MaskLevel {
+  std::vector<uint8_t> then_mask;   // Lanes executing the ApeIf clause
+  std::vector<uint8_t> else_mask;   // Lanes executing the ApeElse clause
+  std::vector<int> then_count;      // Active lanes per chunk
+  std::vector<int> else_count;
+};
+
+// Execute a kernel on a contiguous range of lanes.
+class Executor {
+private:
+  Shared& sh;
+  const Kernel& k;
+  int tid;                        // Thread number
+  int lane0;                      // First global lane owned by this thread
+  int nlanes;                     // Number of lanes owned by this thread
+  int nchunks;                    // Number of chunks of lanes
+  std::vector<float> ape_mem;     // APE storage, word-major
+  std::vector<float> ape_regs;    // APE registers, register-major
+  std::vector<uint8_t> carry;     // Per-APE carry flag
+  std::vector<float> cu_mem;      // CU storage
+  float cu_regs[scNumCURegs];     // CU registers
+  int rw_address = 0;             // CU address used by cuRead
+  std::vector<MaskLevel> masks;   // Stack of APE masks (reused, not popped)
+  std::vector<bool> in_else;      // Whether each level is in its else clause
+  size_t depth = 0;               // Number of levels in use
+  std::vector<uint8_t> all_mask;  // Level-zero mask
+  std::vector<int> all_count;
+  std::vector<float> arena;       // Temporaries for expression evaluation
+  size_t arena_top = 0;
+
+  // Return the current mask and active-lane counts.
+  const uint8_t* cur_mask() const {
+    if (depth == 0)
+      return all_mask.data();
+    return in_else[depth - 1] ? masks[depth - 1].else_mask.data()
+                              : masks[depth - 1].then_mask.data();
+  }
+  const int* cur_count() const {
+    if (depth == 0)
+      return all_count.data();
+    return in_else[depth - 1] ? masks[depth - 1].else_count.data()
+                              : masks[depth - 1].then_count.data();
+  }
+
+  // Allocate a chunk-sized temporary.  The arena never grows, so
+  // temporaries remain valid until the next statement.
+  float* temp() {
+    if (arena_top + chunk > arena.size())
+      throw std::runtime_error("s1emu: expression too deeply nested");
+    float* p = arena.data() + arena_top;
+    arena_top += chunk;
+    return p;
+  }
+
+  // Return a pointer to a word of APE storage for the first lane of a chunk.
+  float* ape_word(int addr, int off) {
+    return ape_mem.data() + size_t(addr)*nlanes + off;
+  }
+
+  // Compute the address of an indexed CU or uniformly indexed APE element,
+  // returning -1 if it is out of bounds.
+  int uniform_address(const Node& idx) {
+    const Node& st = node(idx.a);
+    int r = to_int(eval_cu(idx.b));
+    if (st.cols > 0) {
+      int c = to_int(eval_cu(idx.c));
+      if (r < 0 || r >= st.rows || c < 0 || c >= st.cols)
+        return -1;
+      return st.addr + r*st.cols + c;
+    }
+    if (r < 0 || r >= st.rows)
+      return -1;
+    return st.addr + r;
+  }
+
+  // Report an out-of-bounds store once per run.
+  void warn_oob() {
+    if (!sh.warned_oob.exchange(true))
+      std::fprintf(stderr, "s1emu: warning: out-of-bounds store ignored\n");
+  }
+
+public:
+  Executor(Shared& shared, int thread, int first_lane, int num_lanes)
+    : sh(shared), k(*shared.k), tid(thread),
+      lane0(first_lane), nlanes(num_lanes),
+      nchunks((num_lanes + chunk - 1)/chunk),
+      ape_mem(size_t(shared.k->ape_words)*num_lanes, 0.0f),
+      ape_regs(size_t(scNumApeRegs)*num_lanes, 0.0f),
+      carry(num_lanes, 0),
+      cu_mem(*shared.cu_init),
+      all_mask(num_lanes, 1),
+      all_count(nchunks),
+      arena(1024*chunk)
+  {
+    for (int c = 0; c < nchunks; ++c)
+      all_count[c] = std::min(chunk, nlanes - c*chunk);
+    for (int r = 0; r < scNumCURegs; ++r)
+      cu_regs[r] = 0.0f;
+  }
+
+  // Evaluate a CU expression.
+  float eval_cu(scExpr e) {
+    if (e < first_node)
+      return cu_regs[e];
+    const Node& n = node(e);
+    switch (n.kind) {
+      case ConstNode:
+        return n.value;
+      case StorageNode:
+        return cu_mem[n.addr];
+      case IndexNode: {
+        int addr = uniform_address(n);
+        return addr < 0 ? 0.0f : cu_mem[addr];
+      }
+      case UnaryNode:
+      case BinaryNode: {
+        float x = eval_cu(n.a);
+        float y = n.kind == BinaryNode ? eval_cu(n.b) : 0.0f;
+        float r = 0.0f;
+        dispatch(n, [&](auto f) { r = f(x, y); });
+        return r;
+      }
+      default:
+        break;
+    }
+    return 0.0f;
+  }
+
+  // Evaluate an expression on a chunk of lanes.  The result may point
+  // directly into APE storage.  Because a store to a lane modifies only
+  // that lane's words, this aliasing is harmless.
+  Operand eval(scExpr e, int off, int n) {
+    if (!expr_on_ape(e))
+      return Operand{nullptr, eval_cu(e)};
+    const Node& nd = node(e);
+    switch (nd.kind) {
+      case StorageNode:
+        return Operand{ape_word(nd.addr, off), 0.0f};
+
+      case IndexNode: {
+        const Node& st = node(nd.a);
+        if (!expr_on_ape(nd.b) && (st.cols == 0 || !expr_on_ape(nd.c))) {
+          int addr = uniform_address(nd);
+          if (addr < 0)
+            return Operand{nullptr, 0.0f};
+          return Operand{ape_word(addr, off), 0.0f};
+        }
+        Operand r = eval(nd.b, off, n);
+        Operand c = Operand{nullptr, 0.0f};
+        if (st.cols > 0)
+          c = eval(nd.c, off, n);
+        float* out = temp();
+        for (int i = 0; i < n; ++i) {
+          int ofs = element_offset(st, r, c, i);
+          out[i] = ofs < 0 ? 0.0f : ape_mem[size_t(st.addr + ofs)*nlanes + off + i];
+        }
+        return Operand{out, 0.0f};
+      }
+
+      case UnaryNode:
+      case BinaryNode: {
+        Operand a = eval(nd.a, off, n);
+        Operand b = Operand{nullptr, 0.0f};
+        if (nd.kind == BinaryNode)
+          b = eval(nd.b, off, n);
+        float* out = temp();
+        dispatch(nd, [&](auto f) { apply(f, a, b, out, n); });
+        return Operand{out, 0.0f};
+      }
+
+      default:
+        break;
+    }
+    return Operand{nullptr, 0.0f};
+  }
+
+  // Return the offset of lane i's element of a vector or array given
+  // per-lane indices, or -1 if it is out of bounds.
+  static int element_offset(const Node& st, Operand r, Operand c, int i) {
+    int ri = to_int(r.p ? r.p[i] : r.s);
+    if (ri < 0 || ri >= st.rows)
+      return -1;
+    if (st.cols == 0)
+      return ri;
+    int ci = to_int(c.p ? c.p[i] : c.s);
+    if (ci < 0 || ci >= st.cols)
+      return -1;
+    return ri*st.cols + ci;
+  }
+
+  // Store a value into an APE lvalue on a chunk of lanes under a mask.
+  void store_ape(scExpr dest, Operand v, int off, int n,
+                 const uint8_t* m, bool full) {
+    const Node& dn = node(dest);
+    bool approx = dn.approx;
+    if (dn.kind == StorageNode || (!expr_on_ape(dn.b) &&
+                                   (node(dn.a).cols == 0 || !expr_on_ape(dn.c)))) {
+      int addr = dn.kind == StorageNode ? dn.addr : uniform_address(dn);
+      if (addr < 0) {
+        warn_oob();
+        return;
+      }
+      float* d = ape_word(addr, off);
+      if (v.p == nullptr) {
+        float s = convert(v.s, approx);
+        if (full)
+          for (int i = 0; i < n; ++i)
+            d[i] = s;
+        else
+          for (int i = 0; i < n; ++i)
+            d[i] = m[i] ? s : d[i];
+      }
+      else if (full)
+        for (int i = 0; i < n; ++i)
+          d[i] = convert(v.p[i], approx);
+      else
+        for (int i = 0; i < n; ++i)
+          d[i] = m[i] ? convert(v.p[i], approx) : d[i];
+      return;
+    }
+
+    // Scatter to per-lane addresses.
+    const Node& st = node(dn.a);
+    Operand r = eval(dn.b, off, n);
+    Operand c = Operand{nullptr, 0.0f};
+    if (st.cols > 0)
+      c = eval(dn.c, off, n);
+    for (int i = 0; i < n; ++i) {
+      if (!m[i])
+        continue;
+      int ofs = element_offset(st, r, c, i);
+      if (ofs < 0) {
+        warn_oob();
+        continue;
+      }
+      ape_mem[size_t(st.addr + ofs)*nlanes + off + i] =
+        convert(v.p ? v.p[i] : v.s, approx);
+    }
+  }
+
+  // Store a value into a CU lvalue.
+  void store_cu(scExpr dest, float v) {
+    if (dest < first_node) {
+      cu_regs[dest] = wrap16(to_int(v));
+      return;
+    }
+    const Node& dn = node(dest);
+    int addr = dn.kind == StorageNode ? dn.addr : uniform_address(dn);
+    if (addr < 0) {
+      warn_oob();
+      return;
+    }
+    cu_mem[addr] = convert(v, dn.approx);
+  }
+
+  // Execute an APE Set.
+  void set_ape(scExpr dest, scExpr src) {
+    const uint8_t* mask = cur_mask();
+    const int* count = cur_count();
+    for (int c = 0; c < nchunks; ++c) {
+      if (count[c] == 0)
+        continue;
+      int off = c*chunk;
+      int n = std::min(chunk, nlanes - off);
+      arena_top = 0;
+      Operand v = eval(src, off, n);
+      store_ape(dest, v, off, n, mask + off, count[c] == n);
+    }
+  }
+
+  // Push an APE mask.
+  void ape_if(scExpr cond) {
+    const uint8_t* parent = cur_mask();
+    const int* pcount = cur_count();
+    if (depth == masks.size()) {
+      masks.emplace_back();
+      masks.back().then_mask.resize(nlanes);
+      masks.back().else_mask.resize(nlanes);
+      masks.back().then_count.resize(nchunks);
+      masks.back().else_count.resize(nchunks);
+      in_else.push_back(false);
+    }
+    MaskLevel& lvl = masks[depth];
+    for (int c = 0; c < nchunks; ++c) {
+      lvl.then_count[c] = 0;
+      lvl.else_count[c] = 0;
+      if (pcount[c] == 0)
+        continue;
+      int off = c*chunk;
+      int n = std::min(chunk, nlanes - off);
+      arena_top = 0;
+      Operand v = eval(cond, off, n);
+      int tc = 0, ec = 0;
+      for (int i = 0; i < n; ++i) {
+        uint8_t p = parent[off + i];
+        uint8_t t = v.p ? uint8_t(v.p[i] != 0.0f) : uint8_t(v.s != 0.0f);
+        lvl.then_mask[off + i] = p & t;
+        lvl.else_mask[off + i] = p & (t ^ 1);
+        tc += p & t;
+        ec += p & (t ^ 1);
+      }
+      lvl.then_count[c] = tc;
+      lvl.else_count[c] = ec;
+    }
+    in_else[depth++] = false;
+  }
+
+  // Execute a global get: dest <- src from the neighbor in direction dir.
+  void global_get(scExpr dest, scExpr src, int dir) {
+    for (int c = 0; c < nchunks; ++c) {
+      int off = c*chunk;
+      int n = std::min(chunk, nlanes - off);
+      arena_top = 0;
+      Operand v = eval(src, off, n);
+      for (int i = 0; i < n; ++i)
+        sh.exchange[lane0 + off + i] = v.p ? v.p[i] : v.s;
+    }
+    sh.barrier.wait();
+    const uint8_t* mask = cur_mask();
+    const int* count = cur_count();
+    for (int c = 0; c < nchunks; ++c) {
+      if (count[c] == 0)
+        continue;
+      int off = c*chunk;
+      int n = std::min(chunk, nlanes - off);
+      arena_top = 0;
+      float* out = temp();
+      for (int i = 0; i < n; ++i) {
+        int g = lane0 + off + i;
+        int row = g/sh.total_cols;
+        int col = g%sh.total_cols;
+        switch (dir) {
+          case getNorth: row--; break;
+          case getSouth: row++; break;
+          case getWest:  col--; break;
+          case getEast:  col++; break;
+        }
+        bool ok = row >= 0 && row < sh.total_rows &&
+                  col >= 0 && col < sh.total_cols;
+        out[i] = ok ? sh.exchange[size_t(row)*sh.total_cols + col] : 0.0f;
+      }
+      store_ape(dest, Operand{out, 0.0f}, off, n, mask + off, count[c] == n);
+    }
+    sh.barrier.wait();
+  }
+
+  // Execute a cuRead: CU memory <- wired OR of an APE register across the
+  // selected chip and APEs.
+  void cu_read(int reg) {
+    int chip_row = to_int(cu_regs[cuRChipRow]);
+    int chip_col = to_int(cu_regs[cuRChipCol]);
+    int ape_row = to_int(cu_regs[cuRApeRow]);
+    int ape_col = to_int(cu_regs[cuRApeCol]);
+    uint32_t bits = 0;
+    int count = 0;
+    float value = 0.0f;
+    const float* r = ape_regs.data() + size_t(reg)*nlanes;
+    for (int i = 0; i < nlanes; ++i) {
+      int g = lane0 + i;
+      int row = g/sh.total_cols;
+      int col = g%sh.total_cols;
+      if (row/machine.ape_rows != chip_row || col/machine.ape_cols != chip_col)
+        continue;
+      if (ape_row != -1 && row%machine.ape_rows != ape_row)
+        continue;
+      if (ape_col != -1 && col%machine.ape_cols != ape_col)
+        continue;
+      bits |= uint16_t(int16_t(to_int(r[i])));
+      value = r[i];
+      count++;
+    }
+    sh.or_bits[tid] = bits;
+    sh.or_count[tid] = count;
+    sh.or_value[tid] = value;
+    sh.barrier.wait();
+    bits = 0;
+    count = 0;
+    for (size_t t = 0; t < sh.or_bits.size(); ++t) {
+      bits |= sh.or_bits[t];
+      count += sh.or_count[t];
+      if (sh.or_count[t] > 0)
+        value = sh.or_value[t];
+    }
+    sh.barrier.wait();
+
+    // A single APE's value is passed through unchanged so that Approx
+    // values survive; multiple APEs' values are ORed bitwise.
+    if (rw_address >= 0 && rw_address < int(cu_mem.size()))
+      cu_mem[rw_address] = count == 1 ? value : float(int16_t(uint16_t(bits)));
+  }
+
+  // Execute a low-level APE operation.
+  void ape_op(const Instr& in) {
+    const uint8_t* mask = cur_mask();
+    const int* count = cur_count();
+    switch (in.op) {
+      case apeSet:
+        for (int c = 0; c < nchunks; ++c) {
+          if (count[c] == 0)
+            continue;
+          int off = c*chunk;
+          int n = std::min(chunk, nlanes - off);
+          arena_top = 0;
+          Operand v = eval(in.c, off, n);
+          float* r = ape_regs.data() + size_t(in.a)*nlanes + off;
+          for (int i = 0; i < n; ++i)
+            r[i] = v.p ? v.p[i] : v.s;
+        }
+        break;
+
+      case apeAdd:
+      case apeAddL:
+        for (int c = 0; c < nchunks; ++c) {
+          if (count[c] == 0)
+            continue;
+          int off = c*chunk;
+          int n = std::min(chunk, nlanes - off);
+          arena_top = 0;
+          float* out = temp();
+          const float* r1 = ape_regs.data() + size_t(in.b)*nlanes + off;
+          const float* r2 = ape_regs.data() + size_t(in.c)*nlanes + off;
+          uint8_t* cy = carry.data() + off;
+          for (int i = 0; i < n; ++i) {
+            uint32_t sum = uint32_t(uint16_t(int16_t(to_int(r1[i])))) +
+                           uint32_t(uint16_t(int16_t(to_int(r2[i]))));
+            if (in.op == apeAddL)
+              sum += cy[i];
+            out[i] = float(int16_t(uint16_t(sum)));
+            if (mask[off + i])
+              cy[i] = uint8_t(sum >> 16);
+          }
+          store_ape(in.a, Operand{out, 0.0f}, off, n, mask + off, count[c] == n);
+        }
+        break;
+
+      case apeGetGEnd:
+        global_get(in.a, in.b, in.c);
+        break;
+
+      default:
+        // Mask resets and the individual steps of a global get have no
+        // effect beyond what apeGetGEnd does.
+        break;
+    }
+  }
+
+  // Output an APE expression's value on all APEs.
+  void trace(scExpr e) {
+    for (int c = 0; c < nchunks; ++c) {
+      int off = c*chunk;
+      int n = std::min(chunk, nlanes - off);
+      arena_top = 0;
+      Operand v = eval(e, off, n);
+      for (int i = 0; i < n; ++i)
+        sh.exchange[lane0 + off + i] = v.p ? v.p[i] : v.s;
+    }
+    sh.barrier.wait();
+    if (tid == 0) {
+      std::printf("TraceOneRegisterAllApes:\n");
+      for (int r = 0; r < sh.total_rows; ++r) {
+        std::printf("  %4d:", r);
+        for (int c = 0; c < sh.total_cols; ++c)
+          std::printf(" %.6g", sh.exchange[size_t(r)*sh.total_cols + c]);
+        std::printf("\n");
+      }
+      std::fflush(stdout);
+    }
+    sh.barrier.wait();
+  }
+
+  // Return this thread's copy of CU memory.
+  std::vector<float>& cu_memory() { return cu_mem; }
+
+  // Interpret the kernel until it halts or runs off the end.
+  void run() {
+    const std::vector<Instr>& prog = k.program;
+    size_t pc = 0;
+    while (pc < prog.size()) {
+      const Instr& in = prog[pc];
+      switch (in.kind) {
+        case SetInstr:
+          if (expr_on_ape(in.a))
+            set_ape(in.a, in.b);
+          else
+            store_cu(in.a, eval_cu(in.b));
+          break;
+
+        case ApeIfInstr:
+          ape_if(in.a);
+          break;
+
+        case ApeElseInstr:
+          in_else[depth - 1] = true;
+          break;
+
+        case ApeFiInstr:
+          depth--;
+          break;
+
+        case CUIfInstr:
+          if (eval_cu(in.a) == 0.0f)
+            pc = in.target;
+          break;
+
+        case CUFiInstr:
+          break;
+
+        case CUForInstr:
+          store_cu(in.a, eval_cu(in.b));
+          if (eval_cu(in.a) > eval_cu(in.c))
+            pc = in.target;
+          break;
+
+        case CUForEndInstr:
+          store_cu(in.a, eval_cu(in.a) + eval_cu(in.d));
+          if (eval_cu(in.a) <= eval_cu(in.c))
+            pc = in.target;
+          break;
+
+        case ApeOpInstr:
+          ape_op(in);
+          break;
+
+        case CUOpInstr:
+          switch (in.op) {
+            case cuSet:
+              cu_regs[in.a] = float(in.c);
+              break;
+            case cuSetRWAddress:
+              rw_address = in.c;
+              break;
+            case cuRead:
+              cu_read(in.c & 0xFF);
+              break;
+            case cuHalt:
+              return;
+            default:
+              break;
+          }
+          break;
+
+        case TraceInstr:
+          trace(in.a);
+          break;
+      }
+      pc++;
+    }
+  }
+};
+
+} // anonymous namespace
+
+// Interpret a kernel using as many threads as there are APE rows, up to the
+// number of host cores (or S1EMU_THREADS, if set).
+std::vector<float> execute(const Kernel& k, const std::vector<float>& cu_init)
+{
+  // Establish the precision of Approx values.  By default, Approx values
+  // keep 10 fraction bits (about 0.05% relative error).
+  int bits = 10;
+  if (const char* env = std::getenv("S1EMU_APPROX_BITS"))
+    bits = std::min(std::max(std::atoi(env), 1), 23);
+  approx_mask = ~((uint32_t(1) << (23 - bits)) - 1);
+  approx_round = bits == 23 ? 0 : uint32_t(1) << (22 - bits);
+
+  // Divide the APE rows among the threads.
+  int total_rows = machine.chip_rows*machine.ape_rows;
+  int total_cols = machine.chip_cols*machine.ape_cols;
+  int n_threads = int(std::thread::hardware_concurrency());
+  if (const char* env = std::getenv("S1EMU_THREADS"))
+    n_threads = std::atoi(env);
+  n_threads = std::max(1, std::min(n_threads, total_rows));
+  Shared sh(&k, &cu_init, n_threads);
+  std::vector<std::thread> threads;
+  std::vector<float> cu_mem;
+  for (int t = 0; t < n_threads; ++t) {
+    int row0 = int(long(total_rows)*t/n_threads);
+    int row1 = int(long(total_rows)*(t + 1)/n_threads);
+    threads.emplace_back([&sh, &cu_mem, t, row0, row1, total_cols]() {
+      Executor ex(sh, t, row0*total_cols, (row1 - row0)*total_cols);
+      ex.run();
+
+      // Every thread holds an identical copy of CU memory.
+      if (t == 0)
+        cu_mem = std::move(ex.cu_memory());
+    });
+  }
+  for (auto& th : threads)
+    th.join();
+  return cu_mem;
+}
+
+} // namespace s1emu
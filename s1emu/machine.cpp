@@ -0,0 +1,160 @@
+/*
+ * Machine and kernel management for the S1 emulator
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "s1emu.h"
+
+using namespace s1emu;
+
+LLKernel *llKernel = nullptr;
+
+// An LLKernel is simply a translated kernel.
+struct LLKernel : public Kernel {
+};
+
+namespace {
+
+LLKernel *loaded = nullptr;     // Kernel to execute
+std::thread runner;             // Thread interpreting the loaded kernel
+std::vector<float> cu_memory;   // CU memory of the loaded kernel
+
+} // anonymous namespace
+
+void initSingularArithmetic(void)
+{
+}
+
+void scInitializeMachine(int mode, int chip_rows, int chip_cols,
+                         int ape_rows, int ape_cols, int trace_flags,
+                         int unused1, int unused2, int unused3)
+{
+  (void) unused1;
+  (void) unused2;
+  (void) unused3;
+  if (mode == scRealMachine)
+    std::fprintf(stderr, "s1emu: no S1 hardware is available; emulating\n");
+  machine.chip_rows = chip_rows;
+  machine.chip_cols = chip_cols;
+  machine.ape_rows = ape_rows;
+  machine.ape_cols = ape_cols;
+  machine.trace_flags = trace_flags;
+}
+
+void scTerminateMachine(void)
+{
+  if (runner.joinable())
+    runner.join();
+}
+
+void scKernelTranslate(void)
+{
+  delete llKernel;
+  llKernel = new LLKernel;
+  static_cast<Kernel&>(*llKernel) = translate();
+}
+
+void scLLKernelLoad(LLKernel *kernel, int unused)
+{
+  (void) unused;
+  loaded = kernel;
+  cu_memory.assign(kernel->cu_words, 0.0f);
+}
+
+void scLLKernelExecute(int unused)
+{
+  (void) unused;
+  if (loaded == nullptr) {
+    std::fprintf(stderr, "s1emu: no kernel has been loaded\n");
+    return;
+  }
+  runner = std::thread([]() { cu_memory = execute(*loaded, cu_memory); });
+}
+
+void scLLKernelWaitSignal(void)
+{
+  if (runner.joinable())
+    runner.join();
+}
+
+void scWriteCUMemory(int addr, int count, const double *values)
+{
+  for (int i = 0; i < count; ++i) {
+    int a = addr + i;
+    if (a >= 0 && a < int(cu_memory.size()))
+      cu_memory[a] = float(values[i]);
+  }
+}
+
+void scReadCUMemory(int addr, int count, double *values)
+{
+  for (int i = 0; i < count; ++i) {
+    int a = addr + i;
+    values[i] = a >= 0 && a < int(cu_memory.size()) ? cu_memory[a] : 0.0;
+  }
+}
+
+namespace {
+
+// Identify a saved kernel and the layout of its records.
+const char kernel_magic[8] = {'s', '1', 'e', 'm', 'u', 'k', 'n', 'l'};
+const uint32_t kernel_layout[] = {uint32_t(sizeof(Node)), uint32_t(sizeof(Instr))};
+
+// Write or read a vector of plain records preceded by its length.
+template <typename T>
+bool write_records(FILE *file, const std::vector<T>& v)
+{
+  uint64_t n = v.size();
+  return std::fwrite(&n, sizeof(n), 1, file) == 1 &&
+    std::fwrite(v.data(), sizeof(T), v.size(), file) == v.size();
+}
+
+template <typename T>
+bool read_records(FILE *file, std::vector<T>& v)
+{
+  uint64_t n;
+  if (std::fread(&n, sizeof(n), 1, file) != 1 || n > (uint64_t(1) << 32))
+    return false;
+  v.resize(n);
+  return std::fread(v.data(), sizeof(T), n, file) == n;
+}
+
+} // anonymous namespace
+
+// A kernel refers to expression nodes by handle, so the node table is
+// saved along with the program.
+int scLLKernelSave(LLKernel *kernel, FILE *file)
+{
+  int32_t words[2] = {kernel->ape_words, kernel->cu_words};
+  return std::fwrite(kernel_magic, sizeof(kernel_magic), 1, file) == 1 &&
+    std::fwrite(kernel_layout, sizeof(kernel_layout), 1, file) == 1 &&
+    std::fwrite(words, sizeof(words), 1, file) == 1 &&
+    write_records(file, kernel->program) &&
+    write_records(file, nodes);
+}
+
+int scLLKernelRestore(FILE *file)
+{
+  char magic[sizeof(kernel_magic)];
+  uint32_t layout[2];
+  int32_t words[2];
+  LLKernel k;
+  std::vector<Node> saved_nodes;
+  if (std::fread(magic, sizeof(magic), 1, file) != 1 ||
+      std::memcmp(magic, kernel_magic, sizeof(magic)) != 0 ||
+      std::fread(layout, sizeof(layout), 1, file) != 1 ||
+      std::memcmp(layout, kernel_layout, sizeof(layout)) != 0 ||
+      std::fread(words, sizeof(words), 1, file) != 1 ||
+      !read_records(file, k.program) ||
+      !read_records(file, saved_nodes))
+    return 0;
+  k.ape_words = words[0];
+  k.cu_words = words[1];
+  delete llKernel;
+  llKernel = new LLKernel(std::move(k));
+  nodes = std::move(saved_nodes);
+  return 1;
+}
@@ -0,0 +1,116 @@
+/*
+ * Internal definitions shared by the S1 emulator's code generator and
+ * interpreter
+ */
+
+#ifndef _S1EMU_H_
+#define _S1EMU_H_
+
+#include <vector>
+
+extern "C" {
+#include "scAcceleratorAPI.h"
+#include "scNova.h"
+}
+
+namespace s1emu {
+
+// Expression handles below this value name CU registers.
+const scExpr first_node = 1024;
+
+// Kinds of expression node.
+typedef enum {
+  ConstNode,      // Int or Approx constant
+  StorageNode,    // Scalar, vector, or array variable
+  IndexNode,      // Element of a vector or array
+  UnaryNode,      // Operator applied to one operand
+  BinaryNode,     // Operator applied to two operands
+  CURegNode       // CU register (never stored in the node table)
+} node_t;
+
+// Operators that can appear in unary and binary nodes.
+typedef enum {
+  OpAdd, OpSub, OpMul, OpDiv,
+  OpAnd, OpOr, OpXor, OpAsl, OpAsr,
+  OpEq, OpNe, OpLt, OpLe, OpGt, OpGe,
+  OpNot, OpSqrt
+} op_t;
+
+// Expression node.
+struct Node {
+  node_t kind;
+  op_t op;            // Operator for unary and binary nodes
+  bool approx;        // true=Approx; false=Int
+  bool on_ape;        // true if the value differs from APE to APE
+  scExpr a, b, c;     // Operands; for IndexNode, storage, row, and column
+  float value;        // Value of a ConstNode
+
+  // The following apply only to StorageNodes.
+  bool ape;           // true=APE storage; false=CU storage
+  bool mem;           // true=memory; false=variable
+  int addr;           // Address of the first word
+  int rows;           // Number of elements (vectors) or rows (arrays)
+  int cols;           // Number of columns (arrays) or 0
+};
+
+// Kinds of kernel instruction.
+typedef enum {
+  SetInstr,       // a <- b
+  ApeIfInstr,     // Push an APE mask based on a
+  ApeElseInstr,   // Invert the top APE mask
+  ApeFiInstr,     // Pop an APE mask
+  CUIfInstr,      // If a is zero, jump to target
+  CUFiInstr,      // End of a CUIf
+  CUForInstr,     // a <- b; if a > c, jump past target
+  CUForEndInstr,  // a <- a + d; if a <= c, jump back to target
+  ApeOpInstr,     // Low-level APE operation op(a, b, c)
+  CUOpInstr,      // Low-level CU operation op(a, b, c)
+  TraceInstr      // Output a on all APEs
+} instr_t;
+
+// Kernel instruction.
+struct Instr {
+  instr_t kind;
+  int op;             // Operation for ApeOpInstr and CUOpInstr
+  int a, b, c, d;     // Operands
+  int target;         // Matching instruction for CUIf and CUFor
+};
+
+// Machine shape.
+struct Machine {
+  int chip_rows = 1;
+  int chip_cols = 1;
+  int ape_rows = 1;
+  int ape_cols = 1;
+  int trace_flags = 0;
+};
+
+// Translated kernel.
+struct Kernel {
+  std::vector<Instr> program;   // Instructions to interpret
+  int ape_words;                // Words of storage per APE
+  int cu_words;                 // Words of CU storage
+};
+
+// State shared by the code generator and the interpreter.
+extern Machine machine;
+extern std::vector<Node> nodes;
+
+// Return the node corresponding to an expression handle.
+const Node& node(scExpr e);
+
+// Return the type and locality of an arbitrary expression.
+bool expr_is_approx(scExpr e);
+bool expr_on_ape(scExpr e);
+
+// Return a kernel containing everything emitted so far.
+Kernel translate();
+
+// Interpret a translated kernel, starting from the given contents of CU
+// memory (one word per CU word of the kernel), and return the final
+// contents of CU memory when it halts.
+std::vector<float> execute(const Kernel& k, const std::vector<float>& cu_init);
+
+} // namespace s1emu
+
+#endif
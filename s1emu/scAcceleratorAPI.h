@@ -0,0 +1,127 @@
+/*
+ * Host-side stand-in for Singular Computing's S1 accelerator API.
+ *
+ * This implements only the subset of the API that simple-bcmc uses.  The
+ * kernel is interpreted on the host, with each APE a SIMD lane and the
+ * APE grid divided among host threads.  Ints are 16-bit two's-complement
+ * values; Approx values are rounded after every operation to the number of
+ * fraction bits given by S1EMU_APPROX_BITS (default 10).
+ */
+
+#ifndef _SC_ACCELERATOR_API_H_
+#define _SC_ACCELERATOR_API_H_
+
+#include <stdio.h>
+
+// Machine modes accepted by scInitializeMachine().
+typedef enum {
+  scRealMachine,
+  scEmulated
+} scMachineMode;
+
+// Low-level APE operations (eApeC, eApeX, and eApeR).
+typedef enum {
+  apeSet,              // Register <- expression (eApeX)
+  apeAdd,              // Variable <- register + register, setting carry (eApeR)
+  apeAddL,             // Variable <- register + register + carry (eApeR)
+  apeSetMask,          // Reset the APE mask
+  apeGetGStart,        // Begin a global get from a direction
+  apeGetGStartDone,    // Latch the source of a global get
+  apeGetGMove,         // Move one bit of a global get
+  apeGetGMoveDone,     // Finish moving the bits of a global get
+  apeGetGEnd           // Store the result of a global get
+} scApeOp;
+
+// Low-level CU operations (eCUC).
+typedef enum {
+  cuSet,               // CU register <- constant
+  cuSetMaskMode,
+  cuSetGroupMode,
+  cuSetRWAddress,      // Set the CU-memory address used by cuRead
+  cuRead,              // CU memory <- wired OR of an APE register
+  cuHalt               // Stop the kernel
+} scCUOp;
+
+// Code-generation control operations (eControl).
+typedef enum {
+  controlOpReserveApeReg,
+  controlOpReleaseApeReg
+} scControlOp;
+
+// APE registers usable by eApeX, eApeR, and cuRead.
+typedef enum {
+  apeR0, apeR1, apeR2, apeR3, apeR4, apeR5, apeR6, apeR7,
+  scNumApeRegs
+} scApeReg;
+
+// CU registers that select which chip and APE(s) cuRead observes.  A value
+// of -1 in an APE register selects all rows or columns.
+typedef enum {
+  cuRChipRow = 1,
+  cuRChipCol,
+  cuRApeRow,
+  cuRApeCol,
+  scNumCURegs
+} scCUReg;
+
+// Directions from which apeGetGStart/apeGetGEnd fetch a neighbor's value.
+typedef enum {
+  getNorth,            // From the APE in the previous row
+  getSouth,            // From the APE in the next row
+  getWest,             // From the APE in the previous column
+  getEast              // From the APE in the next column
+} scGetDir;
+
+// Flags for cuRead.
+enum {
+  rwIgnoreMasks = 0x1,
+  rwUseCUMemory = 0x2
+};
+
+// Placeholder for unused operands of the low-level emit functions.
+enum { _ = 0 };
+
+// A translated kernel.
+typedef struct LLKernel LLKernel;
+extern LLKernel *llKernel;
+
+// Machine management
+void initSingularArithmetic(void);
+void scInitializeMachine(int mode, int chip_rows, int chip_cols,
+                         int ape_rows, int ape_cols, int trace_flags,
+                         int unused1, int unused2, int unused3);
+void scTerminateMachine(void);
+
+// Kernel construction and execution
+void scEmitLLKernelCreate(void);
+void scKernelTranslate(void);
+void scLLKernelLoad(LLKernel *kernel, int unused);
+void scLLKernelExecute(int unused);
+void scLLKernelWaitSignal(void);
+
+// Host access to CU memory (an emulator extension).  Between
+// scLLKernelLoad() and scLLKernelExecute(), scWriteCUMemory() copies count
+// values into the loaded kernel's CU memory, starting at address addr.
+// After scLLKernelWaitSignal(), scReadCUMemory() copies count words of the
+// finished kernel's CU memory to values.
+#define S1EMU_CU_WRITE 1
+#define S1EMU_CU_READBACK 1
+void scWriteCUMemory(int addr, int count, const double *values);
+void scReadCUMemory(int addr, int count, double *values);
+
+// Kernel caching (an emulator extension).  scLLKernelSave() writes a
+// translated kernel to an open file, returning nonzero on success.
+// scLLKernelRestore() reads one back in place of scKernelTranslate(),
+// returning zero if the file does not hold a kernel.
+#define S1EMU_KERNEL_CACHE 1
+int scLLKernelSave(LLKernel *kernel, FILE *file);
+int scLLKernelRestore(FILE *file);
+
+// Low-level instruction emission
+void eApeC(int op, int a, int b, int c);
+void eApeX(int op, int reg, int unused, int expr);
+void eApeR(int op, int dest, int reg1, int reg2);
+void eCUC(int op, int a, int b, int c);
+void eControl(int op, int reg);
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Host-side stand-in for Singular Computing's Nova code-generation macros.
+ *
+ * Expressions are handles (scExpr) into a table of expression nodes built
+ * on the host.  Statements are appended to the kernel under construction
+ * and interpreted by scLLKernelExecute().
+ */
+
+#ifndef _SC_NOVA_H_
+#define _SC_NOVA_H_
+
+// Handle to an expression.  Zero is "undefined"; small positive values
+// name CU registers (see scCUReg).
+typedef int scExpr;
+
+// Element types.
+typedef enum {
+  Int,                 // 16-bit two's-complement integer
+  Approx               // Approximate real number
+} scType;
+
+// Storage classes of variables.
+typedef enum {
+  scApeVarClass,
+  scCUVarClass,
+  scApeMemClass,
+  scCUMemClass
+} scStorage;
+
+// Allocate storage with the given shape unless the handle already refers
+// to storage.  This is what makes Nova's "static" declarations idempotent.
+scExpr scDefine(scExpr var, int storage, int type, int rows, int cols);
+
+// Declarations
+#define Declare(V) static scExpr V = 0
+#define ApeVar(V, T) ((V) = scDefine((V), scApeVarClass, (T), 1, 0))
+#define CUVar(V, T) ((V) = scDefine((V), scCUVarClass, (T), 1, 0))
+#define ApeMem(V, T) ((V) = scDefine((V), scApeMemClass, (T), 1, 0))
+#define CUMem(V, T) ((V) = scDefine((V), scCUMemClass, (T), 1, 0))
+#define ApeMemVector(V, T, N) ((V) = scDefine((V), scApeMemClass, (T), (N), 0))
+#define CUMemVector(V, T, N) ((V) = scDefine((V), scCUMemClass, (T), (N), 0))
+#define ApeMemArray(V, T, R, C) ((V) = scDefine((V), scApeMemClass, (T), (R), (C)))
+#define CUMemArray(V, T, R, C) ((V) = scDefine((V), scCUMemClass, (T), (R), (C)))
+#define DeclareApeVar(V, T) Declare(V); ApeVar(V, T)
+#define DeclareCUVar(V, T) Declare(V); CUVar(V, T)
+
+// Return a variable's storage for reuse by later declarations in the same
+// kernel (an emulator extension).  The variable must not be referenced
+// afterward.
+#define S1EMU_RELEASE 1
+void scRelease(scExpr var);
+
+// Count the operations emitted so far into the kernel under construction
+// (an emulator extension).  Each statement and each operator within an
+// expression counts as one operation on the APEs or on the CU, whichever
+// evaluates it.
+#define S1EMU_KERNEL_COUNTS 1
+typedef struct {
+  double ape_ops;        // Operations that every APE steps through
+  double cu_ops;         // Operations that the CU executes
+  double get_moves;      // Bit moves of global gets
+  double mem_accesses;   // Reads and writes of APE or CU memory
+} scKernelCounts;
+void scGetKernelCounts(scKernelCounts *counts);
+
+// Constants
+scExpr IntConst(int i);
+scExpr AConst(double d);
+
+// Arithmetic
+scExpr Add(scExpr a, scExpr b);
+scExpr Sub(scExpr a, scExpr b);
+scExpr Mul(scExpr a, scExpr b);
+scExpr Div(scExpr a, scExpr b);
+scExpr Sqrt(scExpr a);
+
+// Bit manipulation and logic
+scExpr And(scExpr a, scExpr b);
+scExpr Or(scExpr a, scExpr b);
+scExpr Xor(scExpr a, scExpr b);
+scExpr Not(scExpr a);
+scExpr Asl(scExpr a, scExpr b);
+scExpr Asr(scExpr a, scExpr b);
+
+// Comparisons
+scExpr Eq(scExpr a, scExpr b);
+scExpr Ne(scExpr a, scExpr b);
+scExpr Lt(scExpr a, scExpr b);
+scExpr Le(scExpr a, scExpr b);
+scExpr Gt(scExpr a, scExpr b);
+scExpr Ge(scExpr a, scExpr b);
+
+// Indexing
+scExpr IndexVector(scExpr v, scExpr i);
+scExpr IndexArray(scExpr a, scExpr r, scExpr c);
+int MemAddress(scExpr m);
+
+// Statements
+void Set(scExpr dest, scExpr src);
+void ApeIf(scExpr cond);
+void ApeElse(void);
+void ApeFi(void);
+void CUIf(scExpr cond);
+void CUFi(void);
+void CUFor(scExpr var, scExpr from, scExpr to, scExpr step);
+void CUForEnd(void);
+
+// Initialize Nova's code generator.
+void scNovaInit(void);
+
+// Output the value of an APE expression on every APE.
+void TraceOneRegisterAllApes(scExpr e);
+
+#endif
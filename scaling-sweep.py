@@ -0,0 +1,110 @@
+#! /usr/bin/env python
+
+#######################################
+# Run simple-bcmc over a grid of      #
+# machine shapes and tabulate where   #
+# the time goes                       #
+#######################################
+
+import argparse
+import csv
+import re
+import subprocess
+import sys
+
+# Parse the command line.  Arguments the driver does not recognize, such as
+# --emulate, --refill, or --kernel-cache=<dir>, are passed to every run.
+parser = argparse.ArgumentParser(description='Measure how simple-bcmc scales with the number of APEs and chips.',
+                                 epilog='Unrecognized arguments are passed to simple-bcmc.')
+parser.add_argument('--apes', default='1x1,2x2,4x4,8x8',
+                    help='Comma-separated APE shapes (<cols>x<rows> per chip) to run')
+parser.add_argument('--chips', default='1x1',
+                    help='Comma-separated chip shapes (<cols>x<rows>) to run')
+parser.add_argument('--strong', metavar='HISTORIES', type=int,
+                    help='Hold the total number of histories fixed (strong scaling) instead of the histories per APE (weak scaling)')
+parser.add_argument('--repeat', type=int, default=1,
+                    help='Number of times to run each shape')
+parser.add_argument('--program', default='./simple-bcmc',
+                    help='Program to run')
+parser.add_argument('-o', '--output', default=sys.stdout,
+                    type=argparse.FileType('w', encoding='utf-8'),
+                    help='File to which to write the CSV results')
+cl_args, passthrough = parser.parse_known_args()
+decompose = any(a.startswith('--decompose') for a in passthrough)
+
+def parse_shapes(text, option):
+    'Parse a comma-separated list of <cols>x<rows> shapes.'
+    shapes = []
+    for s in text.split(','):
+        m = re.fullmatch(r'\s*(\d+)\s*x\s*(\d+)\s*', s)
+        if m is None:
+            sys.exit('%s: %s shapes must be of the form <cols>x<rows>' % (sys.argv[0], option))
+        shapes.append((int(m.group(1)), int(m.group(2))))
+    return shapes
+
+# Map each line of simple-bcmc's report to a CSV column.
+report_fields = [
+    ('Histories', 'histories'),
+    ('Codegen seconds', 'codegen_s'),
+    ('Translate seconds', 'translate_s'),
+    ('Load seconds', 'load_s'),
+    ('Elapsed seconds', 'execute_s'),
+    ('Histories/second', 'histories_per_s'),
+    ('Total absorbed energy', 'total_energy'),
+    ('APE occupancy', 'occupancy')
+]
+
+def run_shape(chips, apes, n_particles):
+    '''Run simple-bcmc on one machine shape and return the fields of its
+    report, or None if it fails.'''
+    cmd = [cl_args.program,
+           '--chips=%dx%d' % chips,
+           '--apes=%dx%d' % apes] + passthrough
+    if n_particles is not None:
+        cmd.append('--param=n_particles=%d' % n_particles)
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True)
+    if proc.returncode != 0:
+        sys.stderr.write('%s failed:\n%s' % (' '.join(cmd), proc.stderr))
+        return None
+    fields = {}
+    for line in proc.stdout.splitlines():
+        name, sep, value = line.partition(':')
+        if sep == '':
+            continue
+        for label, column in report_fields:
+            if name.strip() == label:
+                words = value.split()
+                fields[column] = words[0]
+                if column == 'codegen_s':
+                    fields['cached'] = int('(cached)' in words)
+    return fields
+
+# Run every shape and write one CSV row per run.
+columns = ['chip_cols', 'chip_rows', 'ape_cols', 'ape_rows', 'n_apes',
+           'n_particles', 'run', 'cached'] + [c for _, c in report_fields]
+writer = csv.DictWriter(cl_args.output, fieldnames=columns, restval='')
+writer.writeheader()
+failed = False
+for chips in parse_shapes(cl_args.chips, '--chips'):
+    for apes in parse_shapes(cl_args.apes, '--apes'):
+        n_apes = chips[0]*chips[1]*apes[0]*apes[1]
+        n_particles = None
+        if cl_args.strong is not None:
+            # n_particles counts particles per APE unless the mesh is
+            # decomposed, in which case it counts them in total.
+            n_particles = cl_args.strong if decompose else max(cl_args.strong//n_apes, 1)
+        for run in range(cl_args.repeat):
+            sys.stderr.write('Running %dx%d chips of %dx%d APEs (run %d of %d)\n' %
+                             (chips + apes + (run + 1, cl_args.repeat)))
+            fields = run_shape(chips, apes, n_particles)
+            if fields is None:
+                failed = True
+                continue
+            fields.update(chip_cols=chips[0], chip_rows=chips[1],
+                          ape_cols=apes[0], ape_rows=apes[1], n_apes=n_apes,
+                          n_particles='' if n_particles is None else n_particles,
+                          run=run)
+            writer.writerow(fields)
+            cl_args.output.flush()
+sys.exit(1 if failed else 0)
@@ -6,37 +6,130 @@
 #ifndef _SIMPLE_BCMC_H
 #define _SIMPLE_BCMC_H
 
+#include <cmath>
 #include "novapp.h"
+#include "host.h"
 
 #define TWO_PI (2*M_PI)
 
-// Encapsulate machine state.
-struct S1State {
-  bool emulated;    // true=emulated; false=real hardware
-  int trace_flags;  // Trace flags for emulator
-  int chip_cols;    // Columns of chips
-  int chip_rows;    // Rows of chips
-  int ape_cols;     // APE columns per chip
-  int ape_rows;     // APE rows per chip
-
-  S1State() : emulated(false), trace_flags(0),
-              chip_cols(1), chip_rows(1),
-              ape_cols(44), ape_rows(48)
-  {
-  }
+// Specify how reduce_apes_to_cu() combines values.
+typedef enum {
+  ReduceSum,
+  ReduceMin,
+  ReduceMax,
+  ReduceOr,   // Bitwise
+  ReduceAnd   // Bitwise
+} reduce_t;
+
+// Enumerate the problem parameters a kernel reads from CU memory.  The
+// host fills in both parameter blocks before launching the kernel, so one
+// kernel serves any problem that fits in the mesh allocated for it.
+typedef enum {
+  ParamStartWeight,    // Energy weight of each new particle
+  ParamCensusDistance, // Distance a particle travels in one timestep
+  ParamRatio,          // Cell size, converting real space to [0,1] space
+  ParamSigS,           // Scattering opacity
+  ParamSigA,           // Absorption opacity
+  NumApproxParams
+} approx_param_t;
+
+typedef enum {
+  ParamParticles,      // Particles per APE in this launch (in total, if
+                       //   decomposed)
+  ParamParticlesHi,    // High and low 16 bits of the particle count,
+  ParamParticlesLo,    //   which may exceed an Int
+  ParamFirstHi,        // High and low 16 bits of the index, within each
+  ParamFirstLo,        //   APE's share, of the launch's first particle
+  ParamShareHi,        // High and low 16 bits of each APE's share of the
+  ParamShareLo,        //   particles over all launches
+  ParamStartX,         // Source cell
+  ParamStartY,
+  ParamMaxXCell,       // Number of cells
+  ParamMaxYCell,
+  ParamSeed0,          // Random-number seed, 16 bits per word, least
+  ParamSeed1,          //   significant first
+  ParamSeed2,
+  ParamSeed3,
+  ParamRowHistories0,  // Histories run by each row of APEs, 16 bits per
+  ParamRowHistories1,  //   word, most significant first
+  ParamRowHistories2,
+  ParamRowHistories3,
+  NumIntParams
+} int_param_t;
+
+// Enumerate the counters each APE keeps with --count-events.  Counter
+// CountBusy + i counts the batches in which the APE had a live particle
+// in iteration i of the transport loop; the last such counter also
+// counts every later iteration.
+const int BusyIterations = 64;
+
+typedef enum {
+  CountScatter,         // Scattering events
+  CountAbsorb,          // Absorption events
+  CountCensus,          // Particles reaching census
+  CountBoundary,        // Boundary crossings, including double crossings
+  CountDoubleCrossing,  // Crossings through a cell's corner
+  CountBusy,            // First of BusyIterations busy counters
+  NumEventCounters = CountBusy + BusyIterations
+} event_counter_t;
+
+// Locate the data a kernel exchanges with the host through CU memory.
+struct KernelLayout {
+  int approx_params_addr;  // NumApproxParams Approx parameters
+  int int_params_addr;     // NumIntParams Int parameters
+  int tally_addr;       // Global tally, max_mesh_x x max_mesh_y, x major
+  int occupancy_addr;   // Mean fraction of iterations an APE was busy
+  int ape_iterations_addr;  // Int high and low words of the transport
+                            //   iterations, which every APE steps through
+
+  // The rest are present only with --count-events.
+  int event_counts_addr;  // NumEventCounters Approx sums over all APEs
+  int iterations_addr;    // Int high and low words of all iterations,
+                          //   then the longest batch's iterations
+  int samples_addr;       // BusyIterations pairs of Int high and low
+                          //   words of the batches reaching iteration i
+
+  // The rest are present only with --ape-diagnostics.
+  int ape_counts_addr;    // Int high and low words of each APE's busy
+                          //   iterations, row major
+  int ape_absorbed_addr;  // Approx weight each APE absorbed, row major
 };
 
-extern NovaExpr counter_3fry;  // RNG input: Loop counter
-extern NovaExpr key_3fry;      // RNG input: Key (e.g., APE ID)
+extern NovaExpr counter_3fry;  // RNG input: Block number within a stream
+extern NovaExpr key_3fry;      // RNG input: Key (history index and seed)
+extern NovaExpr half_3fry;     // RNG input: Half of the block to draw next
 
-extern void emit_nova_code(S1State&, unsigned long long seed);
+extern void emit_nova_code(S1State&, const IMCParams&, unsigned long long seed,
+                           KernelLayout* layout);
+extern void kernel_param_values(const S1State& s1, const IMCParams& params,
+                                unsigned long long seed,
+                                long long first_particle, long long particles,
+                                double approx_values[NumApproxParams],
+                                double int_values[NumIntParams]);
+extern bool load_cached_kernel(const S1State& s1, KernelLayout* layout);
+extern void save_cached_kernel(const S1State& s1, const KernelLayout& layout);
 extern NovaExpr ape_min(const NovaExpr& a, const NovaExpr& b);
+extern void global_get(NovaExpr& dest, NovaExpr src, int dir);
 extern void assign_ape_coords(const S1State& s1, NovaExpr& ape_row, NovaExpr& ape_col);
-extern void or_reduce_apes_to_cu(const S1State& s1, NovaExpr* cu_var, const NovaExpr& ape_var);
+extern void or_reduce_apes_to_cu(const S1State& s1, NovaExpr* cu_var, const NovaTerm& ape_var);
+extern void reduce_apes_to_cu(const S1State& s1, NovaExpr* cu_var, const NovaTerm& ape_var, reduce_t op);
+extern void sum_array_apes_to_cu(const S1State& s1, NovaExpr& cu_array,
+                                 int rows, int cols,
+                                 const std::function<void(NovaExpr&, const NovaExpr&, const NovaExpr&)>& add_elt);
 extern NovaExpr int_to_approx01(const NovaExpr& i_val);
-extern NovaExpr cos_0_2pi(const NovaExpr& x);
-extern NovaExpr sin_0_2pi(const NovaExpr& x);
-extern NovaExpr get_random_int();
+extern void cos_sin_2pi(const NovaExpr& u, NovaExpr& cos_val, NovaExpr& sin_val);
+extern void init_random_draw();
+extern void get_random_draw(std::vector<NovaExpr>& randoms, NovaExpr* cu_half = nullptr);
+extern void add_words(NovaExpr& a, const NovaExpr& b, int n_words);
+extern void init_math_tables();
 extern NovaExpr ln_of_int(const NovaExpr& r);
+extern NovaExpr ln_of_int_shift_subtract(const NovaExpr& r);
+extern NovaExpr ln_of_int_chebyshev(const NovaExpr& r);
+extern NovaExpr ln_of_int_table(const NovaExpr& r);
+extern void read_active_ape(NovaExpr& cu_mem, const NovaTerm& ape_var);
+extern void read_one_ape(NovaExpr& cu_mem, const NovaTerm& ape_var,
+                         int chip_row, int chip_col, int ape_row, int ape_col);
+extern void check_ln_methods(const S1State& s1);
+extern bool check_rng_kernel(const S1State& s1, unsigned long long seed);
 
 #endif
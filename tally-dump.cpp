@@ -0,0 +1,105 @@
+/*
+ * Print the contents of a tally file that --tally-output wrote: its
+ * header, the tally in the same layout simple-bcmc prints, and any per-APE
+ * diagnostics
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <getopt.h>
+#include "host.h"
+#include "tally-file.h"
+
+namespace {
+
+// Print one tally file.
+void dump_tally_file(const TallyFile& file, bool print_apes)
+{
+  const TallyFileHeader& h = file.header();
+  std::printf("Backend:               %s\n", h.backend == S1Backend ? "s1" : "cpu");
+  std::printf("Mesh:                  %ux%u\n", h.mesh_x, h.mesh_y);
+  std::printf("APEs:                  %ux%u\n", h.ape_cols, h.ape_rows);
+  std::printf("Histories:             %llu\n", (unsigned long long)h.histories);
+  std::printf("Seed:                  %llu\n", (unsigned long long)h.seed);
+
+  // Print the tally, one row of cells per x.
+  double total = 0.0;
+  for (uint32_t x = 0; x < h.mesh_x; ++x) {
+    for (uint32_t y = 0; y < h.mesh_y; ++y) {
+      double t = file.tally(int(x), int(y));
+      std::printf("%s%.6g", y == 0 ? "" : " ", t);
+      total += t;
+    }
+    std::printf("\n");
+  }
+  std::printf("Total absorbed energy: %.6g\n", total);
+  if (!file.has_ape_diagnostics())
+    return;
+
+  // Summarize the per-APE diagnostics, and list them if asked.
+  double busy = 0.0, iterations = 0.0, absorbed = 0.0;
+  if (print_apes)
+    std::printf("%5s %5s %12s %12s %12s\n",
+                "row", "col", "busy", "iterations", "absorbed");
+  for (uint32_t row = 0; row < h.ape_rows; ++row)
+    for (uint32_t col = 0; col < h.ape_cols; ++col) {
+      double b = file.ape_diagnostic(int(row), int(col), ApeBusyIterations);
+      double i = file.ape_diagnostic(int(row), int(col), ApeIterations);
+      double a = file.ape_diagnostic(int(row), int(col), ApeAbsorbed);
+      if (print_apes)
+        std::printf("%5u %5u %12.0f %12.0f %12.6g\n", row, col, b, i, a);
+      busy += b;
+      iterations += i;
+      absorbed += a;
+    }
+  std::printf("APE occupancy:         %.6g\n",
+              iterations > 0 ? busy/iterations : 0.0);
+  std::printf("APE absorbed energy:   %.6g\n", absorbed);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+  bool print_apes = false;
+  struct option long_options[] =
+    {{"apes", no_argument, nullptr, 'a'},
+     {"help", no_argument, nullptr, 'h'},
+     {nullptr, 0, nullptr, 0}};
+  int c;
+  while ((c = getopt_long(argc, argv, "ah", long_options, nullptr)) != -1) {
+    switch (c) {
+      case 'a':
+        print_apes = true;
+        break;
+
+      case 'h':
+        std::printf("Usage: %s [--apes] [--help] <file>...\n", argv[0]);
+        return EXIT_SUCCESS;
+
+      default:
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind == argc) {
+    std::fprintf(stderr, "%s: no tally file given\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Print each file in turn.
+  bool ok = true;
+  for (int i = optind; i < argc; ++i) {
+    if (argc - optind > 1)
+      std::printf("%s%s:\n", i == optind ? "" : "\n", argv[i]);
+    try {
+      TallyFile file(argv[i]);
+      dump_tally_file(file, print_apes);
+    }
+    catch (const std::runtime_error& e) {
+      std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+      ok = false;
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,119 @@
+/*
+ * Write and read the binary tally files that --tally-output produces
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tally-file.h"
+
+// Write the header, the tally, and any per-APE diagnostics to a temporary
+// file, then rename it to path.
+bool write_tally_file(const char* path, int backend, int mesh_x, int mesh_y,
+                      uint64_t histories, unsigned long long seed,
+                      const double* tally,
+                      int ape_rows, int ape_cols, const double* ape_values)
+{
+  TallyFileHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, tally_file_magic, sizeof(h.magic));
+  h.version = tally_file_version;
+  h.header_bytes = sizeof(h);
+  h.mesh_x = uint32_t(mesh_x);
+  h.mesh_y = uint32_t(mesh_y);
+  h.ape_rows = uint32_t(ape_rows);
+  h.ape_cols = uint32_t(ape_cols);
+  h.ape_fields = ape_values != nullptr ? NumApeFields : 0;
+  h.backend = uint32_t(backend);
+  h.histories = histories;
+  h.seed = seed;
+  const size_t n_cells = size_t(mesh_x)*mesh_y;
+  const size_t n_ape_values = size_t(ape_rows)*ape_cols*h.ape_fields;
+  h.tally_offset = sizeof(h);
+  h.ape_offset = ape_values != nullptr ? h.tally_offset + n_cells*sizeof(double) : 0;
+
+  std::string tmp_path = std::string(path) + '.' + std::to_string(getpid());
+  FILE* file = std::fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr)
+    return false;
+  bool ok = std::fwrite(&h, sizeof(h), 1, file) == 1 &&
+    std::fwrite(tally, sizeof(double), n_cells, file) == n_cells &&
+    (ape_values == nullptr ||
+     std::fwrite(ape_values, sizeof(double), n_ape_values, file) == n_ape_values);
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok || std::rename(tmp_path.c_str(), path) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// Return whether n1*n2*n3 doubles starting at byte offset fit within a
+// file of size bytes.  Header fields may be corrupt, so nothing here may
+// overflow.
+bool fits_in_file(uint64_t offset, uint64_t n1, uint64_t n2, uint64_t n3,
+                  size_t size)
+{
+  if (offset > size)
+    return false;
+  const uint64_t room = (size - offset)/sizeof(double);
+  uint64_t count = 1;
+  for (uint64_t n : {n1, n2, n3}) {
+    if (n != 0 && count > room/n)
+      return false;
+    count *= n;
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+// Map a tally file and check that its header describes data that fits
+// within it.
+TallyFile::TallyFile(const char* path)
+  : data(nullptr), size(0)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error(std::string("cannot open ") + path);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(TallyFileHeader)) {
+    close(fd);
+    throw std::runtime_error(std::string(path) + " is not a tally file");
+  }
+  size = size_t(st.st_size);
+  void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    throw std::runtime_error(std::string("cannot map ") + path);
+  data = static_cast<const unsigned char*>(map);
+
+  const TallyFileHeader& h = header();
+  const char* problem = nullptr;
+  if (std::memcmp(h.magic, tally_file_magic, sizeof(h.magic)) != 0)
+    problem = " is not a tally file";
+  else if (h.version != tally_file_version ||
+           h.header_bytes != sizeof(TallyFileHeader))
+    problem = " has an unsupported tally-file version";
+  else if (h.tally_offset%sizeof(double) != 0 || h.ape_offset%sizeof(double) != 0 ||
+           !fits_in_file(h.tally_offset, h.mesh_x, h.mesh_y, 1, size) ||
+           !fits_in_file(h.ape_offset, h.ape_rows, h.ape_cols, h.ape_fields, size) ||
+           (h.ape_offset != 0 && h.ape_fields < NumApeFields))
+    problem = " is truncated or corrupt";
+  if (problem != nullptr) {
+    munmap(const_cast<unsigned char*>(data), size);
+    throw std::runtime_error(std::string(path) + problem);
+  }
+}
+
+TallyFile::~TallyFile()
+{
+  munmap(const_cast<unsigned char*>(data), size);
+}
@@ -0,0 +1,101 @@
+/*
+ * Write and read the binary tally files that --tally-output produces.  A
+ * file holds a fixed-size header followed by the global tally and,
+ * optionally, per-APE diagnostics, all as native (little-endian on every
+ * supported host) 64-bit values at 8-byte-aligned offsets, so analysis
+ * tools can map the file and index it directly.  Nothing in this file
+ * depends on Nova.
+ */
+
+#ifndef _TALLY_FILE_H_
+#define _TALLY_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Identify a tally file and the version of its layout.
+const char tally_file_magic[8] = {'b', 'c', 'm', 'c', 't', 'a', 'l', 'y'};
+const uint32_t tally_file_version = 1;
+
+// Enumerate the diagnostics recorded for each APE.  Iteration counts are
+// exact; absorbed weights are sums of Approx values.
+typedef enum {
+  ApeBusyIterations,  // Transport iterations with a live particle
+  ApeIterations,      // Transport iterations stepped through
+  ApeAbsorbed,        // Weight absorbed into the APE's own tally
+  NumApeFields
+} ape_field_t;
+
+// Describe the contents of a tally file.  The header occupies the first
+// header_bytes bytes; offsets count bytes from the start of the file.
+struct TallyFileHeader {
+  char magic[8];            // tally_file_magic
+  uint32_t version;         // tally_file_version
+  uint32_t header_bytes;    // sizeof(TallyFileHeader)
+  uint32_t mesh_x;          // Cells in x
+  uint32_t mesh_y;          // Cells in y
+  uint32_t ape_rows;        // Rows of APEs across all chips
+  uint32_t ape_cols;        // Columns of APEs across all chips
+  uint32_t ape_fields;      // Diagnostics per APE (0=none recorded)
+  uint32_t backend;         // backend_t that produced the tallies
+  uint64_t histories;       // Histories transported
+  uint64_t seed;            // Random-number seed
+  uint64_t tally_offset;    // mesh_x*mesh_y doubles, x major
+  uint64_t ape_offset;      // ape_rows*ape_cols*ape_fields doubles, APE
+                            //   (row, col) at (row*ape_cols + col)*ape_fields,
+                            //   or 0 if none were recorded
+};
+
+// Write a tally file.  ape_values, if not null, holds NumApeFields
+// diagnostics for each of ape_rows*ape_cols APEs, row major.  The file is
+// written under a temporary name and renamed, so readers never see a
+// partial file.  Return false if the file can't be written.
+extern bool write_tally_file(const char* path, int backend,
+                             int mesh_x, int mesh_y,
+                             uint64_t histories, unsigned long long seed,
+                             const double* tally,
+                             int ape_rows, int ape_cols,
+                             const double* ape_values);
+
+// Map a tally file into memory for reading.  The constructor throws
+// std::runtime_error if the file can't be mapped or is not a tally file.
+class TallyFile {
+private:
+  const unsigned char* data;   // Mapped file
+  size_t size;                 // Bytes in the file
+
+public:
+  explicit TallyFile(const char* path);
+  ~TallyFile();
+  TallyFile(const TallyFile&) = delete;
+  TallyFile& operator=(const TallyFile&) = delete;
+
+  const TallyFileHeader& header() const {
+    return *reinterpret_cast<const TallyFileHeader*>(data);
+  }
+
+  // Return the tally, mesh_x*mesh_y values, x major.
+  const double* tally() const {
+    return reinterpret_cast<const double*>(data + header().tally_offset);
+  }
+
+  // Return the tally of cell (x, y).
+  double tally(int x, int y) const {
+    return tally()[size_t(x)*header().mesh_y + y];
+  }
+
+  // Return whether the file holds per-APE diagnostics.
+  bool has_ape_diagnostics() const {
+    return header().ape_offset != 0;
+  }
+
+  // Return one diagnostic of APE (row, col), counting rows and columns
+  // across all chips.
+  double ape_diagnostic(int row, int col, ape_field_t field) const {
+    const TallyFileHeader& h = header();
+    const double* values = reinterpret_cast<const double*>(data + h.ape_offset);
+    return values[(size_t(row)*h.ape_cols + col)*h.ape_fields + field];
+  }
+};
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * Implement on the host the same Threefry and Philox PRNGs that
+ * threefry.cpp emits for the S1.
+ */
+
+#include <cstdlib>
+#include <string>
+#include <immintrin.h>
+#include "host.h"
+
+// Most of this file represents helper functions for Threefry and Philox.
+namespace {
+
+// Define the list of Threefry 32x4 rotation constants (same as threefry.cpp).
+const int rot_32x4[] = {
+  10, 26, 11, 21, 13, 27, 23,  5,  6, 20, 17, 11, 25, 10, 18, 20
+};
+
+// Left-rotate a 32-bit number.
+inline uint32_t rotl32(uint32_t x, int rot)
+{
+  return (x << rot) | (x >> (32 - rot));
+}
+
+// Key injection for round/4.
+inline void inject_key(uint32_t x[4], const uint32_t ks[5], int r)
+{
+  for (int i = 0; i < 4; i++)
+    x[i] += ks[(r + i)%5];
+  x[3] += uint32_t(r);
+}
+
+// Mixer operation.
+inline void mix(uint32_t x[4], int a, int b, int ridx)
+{
+  x[a] += x[b];
+  x[b] = rotl32(x[b], rot_32x4[ridx]);
+  x[b] ^= x[a];
+}
+
+// The batch implementations below take either one key shared by every
+// block (keyed=false, key[0]) or a key for each block (keyed=true,
+// key[i]).
+
+// Generate blocks one at a time.
+void threefry4x32_batch_scalar(size_t n, const uint32_t (*ctr)[4],
+                               const uint32_t (*key)[4], bool keyed,
+                               uint32_t (*out)[4], int rounds)
+{
+  for (size_t i = 0; i < n; ++i)
+    threefry4x32_host(ctr[i], key[keyed ? i : 0], out[i], rounds);
+}
+
+// Generate blocks eight at a time using AVX2, with each 32-bit lane of a
+// vector holding one word of a different block.
+__attribute__((target("avx2")))
+void threefry4x32_batch_avx2(size_t n, const uint32_t (*ctr)[4],
+                             const uint32_t (*key)[4], bool keyed,
+                             uint32_t (*out)[4], int rounds)
+{
+  // Broadcast a shared key schedule.
+  __m256i ks[5];
+  uint32_t ks4 = 0x1BD11BDA;
+  for (int i = 0; i < 4; ++i) {
+    ks[i] = _mm256_set1_epi32(int(key[0][i]));
+    ks4 ^= key[0][i];
+  }
+  ks[4] = _mm256_set1_epi32(int(ks4));
+
+  // Gather word w of eight consecutive blocks with a stride of four words.
+  const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  size_t i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    const int* base = reinterpret_cast<const int*>(ctr[i]);
+    __m256i x[4];
+    if (keyed) {
+      // Gather each block's own key schedule likewise.
+      const int* key_base = reinterpret_cast<const int*>(key[i]);
+      ks[4] = _mm256_set1_epi32(0x1BD11BDA);
+      for (int w = 0; w < 4; ++w) {
+        ks[w] = _mm256_i32gather_epi32(key_base + w, stride, 4);
+        ks[4] = _mm256_xor_si256(ks[4], ks[w]);
+      }
+    }
+    for (int w = 0; w < 4; ++w)
+      x[w] = _mm256_add_epi32(_mm256_i32gather_epi32(base + w, stride, 4),
+                              ks[w]);
+
+    // Perform the given number of rounds of mixing.
+    for (int r = 0; r < rounds; ++r) {
+      if (r%4 == 0 && r > 0) {
+        int k = r/4;
+        for (int w = 0; w < 4; ++w)
+          x[w] = _mm256_add_epi32(x[w], ks[(k + w)%5]);
+        x[3] = _mm256_add_epi32(x[3], _mm256_set1_epi32(k));
+      }
+      int a0 = 0, b0 = r%2 == 0 ? 1 : 3;
+      int a1 = 2, b1 = r%2 == 0 ? 3 : 1;
+      int rot0 = rot_32x4[(2*r)%16];
+      int rot1 = rot_32x4[(2*r + 1)%16];
+      x[a0] = _mm256_add_epi32(x[a0], x[b0]);
+      x[b0] = _mm256_or_si256(_mm256_sll_epi32(x[b0], _mm_cvtsi32_si128(rot0)),
+                              _mm256_srl_epi32(x[b0], _mm_cvtsi32_si128(32 - rot0)));
+      x[b0] = _mm256_xor_si256(x[b0], x[a0]);
+      x[a1] = _mm256_add_epi32(x[a1], x[b1]);
+      x[b1] = _mm256_or_si256(_mm256_sll_epi32(x[b1], _mm_cvtsi32_si128(rot1)),
+                              _mm256_srl_epi32(x[b1], _mm_cvtsi32_si128(32 - rot1)));
+      x[b1] = _mm256_xor_si256(x[b1], x[a1]);
+    }
+    if (rounds%4 == 0) {
+      int k = rounds/4;
+      for (int w = 0; w < 4; ++w)
+        x[w] = _mm256_add_epi32(x[w], ks[(k + w)%5]);
+      x[3] = _mm256_add_epi32(x[3], _mm256_set1_epi32(k));
+    }
+
+    // Transpose the results back into blocks.
+    alignas(32) uint32_t soa[4][8];
+    for (int w = 0; w < 4; ++w)
+      _mm256_store_si256(reinterpret_cast<__m256i*>(soa[w]), x[w]);
+    for (int j = 0; j < 8; ++j)
+      for (int w = 0; w < 4; ++w)
+        out[i + j][w] = soa[w][j];
+  }
+  threefry4x32_batch_scalar(n - i, ctr + i, keyed ? key + i : key, keyed,
+                            out + i, rounds);
+}
+
+// Generate blocks sixteen at a time using AVX-512.
+__attribute__((target("avx512f")))
+void threefry4x32_batch_avx512(size_t n, const uint32_t (*ctr)[4],
+                               const uint32_t (*key)[4], bool keyed,
+                               uint32_t (*out)[4], int rounds)
+{
+  // Broadcast a shared key schedule.
+  __m512i ks[5];
+  uint32_t ks4 = 0x1BD11BDA;
+  for (int i = 0; i < 4; ++i) {
+    ks[i] = _mm512_set1_epi32(int(key[0][i]));
+    ks4 ^= key[0][i];
+  }
+  ks[4] = _mm512_set1_epi32(int(ks4));
+
+  // Gather and scatter word w of sixteen consecutive blocks with a stride
+  // of four words.
+  const __m512i stride = _mm512_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28,
+                                           32, 36, 40, 44, 48, 52, 56, 60);
+  size_t i;
+  for (i = 0; i + 16 <= n; i += 16) {
+    const int* base = reinterpret_cast<const int*>(ctr[i]);
+    __m512i x[4];
+    if (keyed) {
+      // Gather each block's own key schedule likewise.
+      const int* key_base = reinterpret_cast<const int*>(key[i]);
+      ks[4] = _mm512_set1_epi32(0x1BD11BDA);
+      for (int w = 0; w < 4; ++w) {
+        ks[w] = _mm512_i32gather_epi32(stride, key_base + w, 4);
+        ks[4] = _mm512_xor_si512(ks[4], ks[w]);
+      }
+    }
+    for (int w = 0; w < 4; ++w)
+      x[w] = _mm512_add_epi32(_mm512_i32gather_epi32(stride, base + w, 4),
+                              ks[w]);
+
+    // Perform the given number of rounds of mixing.
+    for (int r = 0; r < rounds; ++r) {
+      if (r%4 == 0 && r > 0) {
+        int k = r/4;
+        for (int w = 0; w < 4; ++w)
+          x[w] = _mm512_add_epi32(x[w], ks[(k + w)%5]);
+        x[3] = _mm512_add_epi32(x[3], _mm512_set1_epi32(k));
+      }
+      int a0 = 0, b0 = r%2 == 0 ? 1 : 3;
+      int a1 = 2, b1 = r%2 == 0 ? 3 : 1;
+      x[a0] = _mm512_add_epi32(x[a0], x[b0]);
+      x[b0] = _mm512_rolv_epi32(x[b0], _mm512_set1_epi32(rot_32x4[(2*r)%16]));
+      x[b0] = _mm512_xor_si512(x[b0], x[a0]);
+      x[a1] = _mm512_add_epi32(x[a1], x[b1]);
+      x[b1] = _mm512_rolv_epi32(x[b1], _mm512_set1_epi32(rot_32x4[(2*r + 1)%16]));
+      x[b1] = _mm512_xor_si512(x[b1], x[a1]);
+    }
+    if (rounds%4 == 0) {
+      int k = rounds/4;
+      for (int w = 0; w < 4; ++w)
+        x[w] = _mm512_add_epi32(x[w], ks[(k + w)%5]);
+      x[3] = _mm512_add_epi32(x[3], _mm512_set1_epi32(k));
+    }
+
+    int* dest = reinterpret_cast<int*>(out[i]);
+    for (int w = 0; w < 4; ++w)
+      _mm512_i32scatter_epi32(dest + w, stride, x[w], 4);
+  }
+  threefry4x32_batch_scalar(n - i, ctr + i, keyed ? key + i : key, keyed,
+                            out + i, rounds);
+}
+
+// Select the widest implementation the CPU supports.  Setting
+// THREEFRY_ISA to "scalar", "avx2", or "avx512" overrides the choice.
+typedef void (*batch_fn)(size_t, const uint32_t (*)[4], const uint32_t (*)[4],
+                         bool, uint32_t (*)[4], int);
+batch_fn select_batch()
+{
+  __builtin_cpu_init();
+  bool avx512 = __builtin_cpu_supports("avx512f");
+  bool avx2 = __builtin_cpu_supports("avx2");
+  if (const char* isa = std::getenv("THREEFRY_ISA")) {
+    std::string want(isa);
+    avx512 = avx512 && want == "avx512";
+    avx2 = avx2 && (want == "avx2" || want == "avx512");
+  }
+  if (avx512)
+    return threefry4x32_batch_avx512;
+  if (avx2)
+    return threefry4x32_batch_avx2;
+  return threefry4x32_batch_scalar;
+}
+
+} // anonymous namespace
+
+// Use a counter and a key to generate four random 32-bit numbers by the
+// given number of rounds of Threefry.
+void threefry4x32_host(const uint32_t ctr[4], const uint32_t key[4],
+                       uint32_t out[4], int rounds)
+{
+  // Initialize both the internal and output state.
+  uint32_t ks[5];
+  ks[4] = 0x1BD11BDA;
+  for (int i = 0; i < 4; ++i) {
+    ks[i] = key[i];
+    ks[4] ^= key[i];
+    out[i] = ctr[i] + ks[i];
+  }
+
+  // Perform the given number of rounds of mixing, injecting the key after
+  // every fourth round.
+  for (int r = 0; r < rounds; ++r) {
+    // Inject
+    if (r%4 == 0 && r > 0)
+      inject_key(out, ks, r/4);
+
+    // Mix
+    if (r%2 == 0) {
+      mix(out, 0, 1, (2*r)%16);
+      mix(out, 2, 3, (2*r + 1)%16);
+    }
+    else {
+      mix(out, 0, 3, (2*r)%16);
+      mix(out, 2, 1, (2*r + 1)%16);
+    }
+  }
+  if (rounds%4 == 0)
+    inject_key(out, ks, rounds/4);
+}
+
+// Use n counters and a shared key to generate n blocks of four random
+// 32-bit numbers, as many blocks at a time as the CPU's vector units allow.
+void threefry4x32_host_batch(size_t n, const uint32_t (*ctr)[4],
+                             const uint32_t key[4], uint32_t (*out)[4],
+                             int rounds)
+{
+  static const batch_fn batch = select_batch();
+  batch(n, ctr, reinterpret_cast<const uint32_t (*)[4]>(key), false, out, rounds);
+}
+
+// Likewise, but with a key for each block.
+void threefry4x32_host_batch_keys(size_t n, const uint32_t (*ctr)[4],
+                                  const uint32_t (*keys)[4],
+                                  uint32_t (*out)[4], int rounds)
+{
+  static const batch_fn batch = select_batch();
+  batch(n, ctr, keys, true, out, rounds);
+}
+
+// Name the implementation threefry4x32_host_batch() uses.
+const char* threefry_host_isa()
+{
+  static const batch_fn batch = select_batch();
+  if (batch == threefry4x32_batch_avx512)
+    return "avx512";
+  if (batch == threefry4x32_batch_avx2)
+    return "avx2";
+  return "scalar";
+}
+
+// Use a counter and a key to generate four random 32-bit numbers by the
+// given number of rounds of Philox, with the key laid out as philox4x32()
+// lays it out on the S1.
+void philox4x32_host(const uint32_t ctr[4], const uint32_t key[4],
+                     uint32_t out[4], int rounds)
+{
+  uint32_t k0 = key[0], k1 = key[1];
+  uint32_t x[4] = {ctr[0], ctr[1], ctr[2] ^ key[2], ctr[3] ^ key[3]};
+  for (int r = 0; r < rounds; ++r) {
+    if (r > 0) {
+      k0 += 0x9E3779B9;
+      k1 += 0xBB67AE85;
+    }
+    uint64_t p0 = uint64_t(0xD2511F53)*x[0];
+    uint64_t p1 = uint64_t(0xCD9E8D57)*x[2];
+    uint32_t x1 = x[1], x3 = x[3];
+    x[0] = uint32_t(p1 >> 32) ^ x1 ^ k0;
+    x[1] = uint32_t(p1);
+    x[2] = uint32_t(p0 >> 32) ^ x3 ^ k1;
+    x[3] = uint32_t(p0);
+  }
+  for (int i = 0; i < 4; ++i)
+    out[i] = x[i];
+}
+
+// Generate n blocks with the generator selected by RNG_METHOD.
+void random4x32_host_batch(size_t n, const uint32_t (*ctr)[4],
+                           const uint32_t key[4], uint32_t (*out)[4])
+{
+#if RNG_METHOD == RNG_PHILOX
+  for (size_t i = 0; i < n; ++i)
+    philox4x32_host(ctr[i], key, out[i]);
+#else
+  threefry4x32_host_batch(n, ctr, key, out);
+#endif
+}
+
+// Likewise, but with a key for each block.
+void random4x32_host_batch_keys(size_t n, const uint32_t (*ctr)[4],
+                                const uint32_t (*keys)[4], uint32_t (*out)[4])
+{
+#if RNG_METHOD == RNG_PHILOX
+  for (size_t i = 0; i < n; ++i)
+    philox4x32_host(ctr[i], keys[i], out[i]);
+#else
+  threefry4x32_host_batch_keys(n, ctr, keys, out);
+#endif
+}
+
+// Reproduce the key_3fry layout of emit_nova_code(): eight 16-bit Ints,
+// high half first, holding the history index from most to least
+// significant and the seed from least to most significant.
+void threefry_key_host(uint64_t history, unsigned long long seed,
+                       uint32_t key[4])
+{
+  uint16_t k16[8] = {0};
+  for (int i = 3; i >= 0; --i) {
+    k16[i] = uint16_t(history&0xFFFF);
+    history >>= 16;
+  }
+  for (int i = 4; i < 8; ++i) {
+    k16[i] = uint16_t(seed&0xFFFF);
+    seed >>= 16;
+  }
+  for (int i = 0; i < 4; ++i)
+    key[i] = (uint32_t(k16[2*i]) << 16) | k16[2*i + 1];
+}
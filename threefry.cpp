@@ -1,26 +1,39 @@
 /*
- * Implement the Threefry PRNG for Singular Computing's S1 system.
+ * Implement the Threefry and Philox PRNGs for Singular Computing's S1
+ * system.
  */
 
+#include <stdexcept>
+#include <vector>
 #include <novapp.h>
 #include "simple-bcmc.h"
 
 // Each of the following represent four 32-bit numbers stored as eight Ints.
-NovaExpr counter_3fry;  // Input: Loop counter
-NovaExpr key_3fry;      // Input: Key (e.g., APE ID)
+NovaExpr counter_3fry;  // Input: Block number within a stream
+NovaExpr key_3fry;      // Input: Key (history index and seed)
+NovaExpr half_3fry;     // Half of the block the next draw takes (one Int)
 
-// Most of this file represents helper functions for Threefry.
+// Most of this file represents helper functions for Threefry and Philox.
+// Both generators use the same state.
 namespace {
 
 // The following private data are also four 32-bit numbers stored as eight Ints.
 NovaExpr random_3fry;   // Output: Random numbers
-NovaExpr scratch_3fry;  // Internal: Scratch space
+NovaExpr scratch_3fry;  // Internal: Scratch space (key schedule)
 
 // Define the list of Threefry 32x4 rotation constants.
 const int rot_32x4[] = {
   10, 26, 11, 21, 13, 27, 23,  5,  6, 20, 17, 11, 25, 10, 18, 20
 };
 
+// Define the Philox 4x32 multipliers and key increments.
+const uint32_t philox_m[2] = {0xD2511F53, 0xCD9E8D57};
+const uint32_t philox_w[2] = {0x9E3779B9, 0xBB67AE85};
+
+// Return the high or low 16 bits of a 32-bit constant as an Int.
+inline int hi16(uint32_t v) { return int(int16_t(uint16_t(v >> 16))); }
+inline int lo16(uint32_t v) { return int(int16_t(uint16_t(v))); }
+
 // Emit code to add two 32-bit numbers.
 void Add32Bits(scExpr sum_hi, scExpr sum_lo,
                scExpr a_hi, scExpr a_lo,
@@ -127,11 +140,84 @@ void mix(int a, int b, int ridx)
   random_3fry[b*2 + 1] ^= random_3fry[a*2 + 1];
 }
 
+// Multiply an Int by an Int constant.  (A NovaTerm times an int is an
+// Approx product.)
+NovaTerm mul_int(const NovaTerm& x, int c)
+{
+  return NovaTerm::apply(Mul(x.expr, IntConst(c)), false, x);
+}
+
+// Multiply random_3fry word w by the constant m, returning the 64-bit
+// product as four Ints, most significant first.  An Int product keeps only
+// the low 16 bits, so the product is assembled from the exact 16-bit
+// products of bytes, summed by column with the carries propagated.
+std::vector<NovaExpr> mul32x32(uint32_t m, int w)
+{
+  // Split word w into bytes, least significant first.
+  std::vector<NovaExpr> x;
+  x.reserve(4);
+  x.emplace_back(random_3fry[w*2 + 1] & 0xFF);
+  x.emplace_back((random_3fry[w*2 + 1] >> 8) & 0xFF);
+  x.emplace_back(random_3fry[w*2] & 0xFF);
+  x.emplace_back((random_3fry[w*2] >> 8) & 0xFF);
+
+  // Multiply every byte of the word by every byte of m.
+  std::vector<NovaExpr> p;
+  p.reserve(16);
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 4; ++j)
+      p.emplace_back(mul_int(x[i], int((m >> 8*j) & 0xFF)));
+
+  // Column k sums the carry out of column k - 1, the low bytes of the
+  // products of bytes i and j with i + j = k, and the high bytes of those
+  // with i + j = k - 1.  No sum exceeds 12 bits.
+  std::vector<NovaExpr> col;
+  col.reserve(8);
+  for (int k = 0; k < 8; ++k) {
+    std::vector<NovaTerm> terms;
+    if (k > 0)
+      terms.push_back(col[k - 1] >> 8);
+    for (int i = 0; i < 4; ++i) {
+      if (k - i >= 0 && k - i < 4)
+        terms.push_back(p[i*4 + k - i] & 0xFF);
+      if (k - 1 - i >= 0 && k - 1 - i < 4)
+        terms.push_back((p[i*4 + k - 1 - i] >> 8) & 0xFF);
+    }
+    NovaTerm sum(terms[0]);
+    for (size_t t = 1; t < terms.size(); ++t)
+      sum = sum + terms[t];
+    col.emplace_back(sum);
+  }
+
+  // Pack the bytes into Ints.  The product fits in 64 bits, so column 7
+  // needs no mask.
+  std::vector<NovaExpr> prod;
+  prod.reserve(4);
+  prod.emplace_back((col[7] << 8) | (col[6] & 0xFF));
+  prod.emplace_back(((col[5] & 0xFF) << 8) | (col[4] & 0xFF));
+  prod.emplace_back(((col[3] & 0xFF) << 8) | (col[2] & 0xFF));
+  prod.emplace_back(((col[1] & 0xFF) << 8) | (col[0] & 0xFF));
+  return prod;
+}
+
+// Add Philox key increment i to key word i.
+void bump_key(int i)
+{
+  Add32Bits(scratch_3fry[i*2].expr,
+            scratch_3fry[i*2 + 1].expr,
+            scratch_3fry[i*2].expr,
+            scratch_3fry[i*2 + 1].expr,
+            IntConst(hi16(philox_w[i])),
+            IntConst(lo16(philox_w[i])));
+}
+
 } // anonymous namespace
 
-// Use counter_3fry and key_3fry to generate random numbers random_3fry.
+// Use counter_3fry and key_3fry to generate random numbers random_3fry by
+// THREEFRY_ROUNDS rounds of Threefry.
 void threefry4x32()
 {
+  NovaProfileRegion profile("threefry4x32");
   // Initialize both the internal and output state.
   scratch_3fry[8] = 0x1BD1;
   scratch_3fry[9] = 0x1BDA;
@@ -152,8 +238,9 @@ void threefry4x32()
   for (int i = 0; i < 4; ++i)
     ADD32(random_3fry, i, random_3fry, i, scratch_3fry, i);
 
-  // Perform 20 rounds of mixing.
-  for (int r = 0; r < 20; ++r) {
+  // Perform THREEFRY_ROUNDS rounds of mixing, injecting the key after every
+  // fourth round.
+  for (int r = 0; r < THREEFRY_ROUNDS; ++r) {
     // Inject
     if (r%4 == 0 && r > 0)
       inject_key(r/4);
@@ -168,36 +255,121 @@ void threefry4x32()
       mix(2, 1, (2*r + 1)%16);
     }
   }
-  inject_key(20/4);
+  if (THREEFRY_ROUNDS%4 == 0)
+    inject_key(THREEFRY_ROUNDS/4);
 }
 
-// Return the next random number in random_3fry, invoking threefry4x32()
-// again if we've run out of random numbers.
-NovaExpr get_random_int()
+// Use counter_3fry and key_3fry to generate random numbers random_3fry by
+// PHILOX_ROUNDS rounds of Philox.  Philox's key is only two words, so the
+// other two words of key_3fry are XORed into counter words 2 and 3, which
+// are otherwise always zero.
+void philox4x32()
 {
-  static NovaExpr r_idx(8, NovaExpr::NovaCUVar);  // Index into random_3fry
-  static NovaExpr ctr_hi(0, NovaExpr::NovaCUVar); // High 16 bits of tally of threefry4x32() invocations
-  static NovaExpr ctr_lo(0, NovaExpr::NovaCUVar); // Low 16 bits of tally of threefry4x32() invocations
-
-  // On first invocation, initialize the output vector and the scratch vector.
-  if (!random_3fry.has_value()) {
-    scratch_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 10);
-    random_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 8);
+  NovaProfileRegion profile("philox4x32");
+  for (int i = 0; i < 4; ++i) {
+    scratch_3fry[i] = key_3fry[i];
+    random_3fry[i] = counter_3fry[i];
+  }
+  for (int i = 4; i < 8; ++i)
+    random_3fry[i] = counter_3fry[i] ^ key_3fry[i];
+
+  // Perform PHILOX_ROUNDS rounds, bumping the key between rounds.
+  for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+    if (r > 0) {
+      bump_key(0);
+      bump_key(1);
+    }
+    std::vector<NovaExpr> p0(mul32x32(philox_m[0], 0));
+    std::vector<NovaExpr> p1(mul32x32(philox_m[1], 2));
+    random_3fry[0] = p1[0] ^ random_3fry[2] ^ scratch_3fry[0];
+    random_3fry[1] = p1[1] ^ random_3fry[3] ^ scratch_3fry[1];
+    random_3fry[2] = p1[2];
+    random_3fry[3] = p1[3];
+    random_3fry[4] = p0[0] ^ random_3fry[6] ^ scratch_3fry[2];
+    random_3fry[5] = p0[1] ^ random_3fry[7] ^ scratch_3fry[3];
+    random_3fry[6] = p0[2];
+    random_3fry[7] = p0[3];
   }
+}
 
-  // Generate 8 more random numbers if we've exhausted the current 8.
-  ++r_idx;
-  NovaCUIf(r_idx > 7, [&]() {
+// Initialize the state used by get_random_draw().  This must be called
+// once, outside of any loop, before the first call to get_random_draw().
+void init_random_draw()
+{
+  scratch_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 10);
+  random_3fry = NovaExpr(0, NovaExpr::NovaApeMemVector, 8);
+  half_3fry = NovaExpr(0);
+}
+
+// Assign each APE's next draw of up to four random numbers to the APE Int
+// variables in randoms.  The stream that key_3fry selects is a sequence of
+// blocks of eight numbers, generated by the generator RNG_METHOD selects;
+// draw d takes half d%2 of block d/2, so counter_3fry and half_3fry
+// together locate the next draw.  A block is generated for every draw,
+// since APEs may be at different halves, unless the caller keeps in
+// cu_half the half at which every APE is known to be, in which case the
+// second draw from a block reuses it.  Each APE's numbers depend only on
+// its own key and counter, so an APE masked off by an enclosing ApeIf
+// simply does not advance, but it costs as much as any other.
+void get_random_draw(std::vector<NovaExpr>& randoms, NovaExpr* cu_half)
+{
+  NovaProfileRegion profile("get_random_draw");
+  if (randoms.size() > 4)
+    throw std::invalid_argument("get_random_draw() draws at most 4 numbers");
+  auto generate = []() {
+#if RNG_METHOD == RNG_PHILOX
+    philox4x32();
+#else
     threefry4x32();
-    ++ctr_lo;
-    counter_3fry[1] = ctr_lo;
-    NovaCUIf(ctr_lo == 0, [&]() {
-      ++ctr_hi;
-      counter_3fry[0] = ctr_hi;
+#endif
+  };
+  if (cu_half == nullptr)
+    generate();
+  else {
+    NovaCUIf(*cu_half == 0, generate);
+    *cu_half ^= 1;
+  }
+  for (size_t i = 0; i < randoms.size(); ++i)
+    randoms[i] = random_3fry[i];
+  NovaApeIf (half_3fry == 1, [&]() {
+    for (size_t i = 0; i < randoms.size(); ++i)
+      randoms[i] = random_3fry[4 + i];
+  });
+
+  // Advance to the next half, and to the next block after the second.
+  half_3fry ^= 1;
+  NovaApeIf (half_3fry == 0, [&]() {
+    counter_3fry[1] += 1;
+    NovaApeIf (counter_3fry[1] == 0, [&]() {
+      counter_3fry[0] += 1;
     });
-    r_idx = 0;
   });
+}
 
-  // Return the current random number.
-  return random_3fry[r_idx];
+// Add the multiword integer b to a, where each is a vector of n_words Ints,
+// most significant first.  b may lie in CU memory.
+void add_words(NovaExpr& a, const NovaExpr& b, int n_words)
+{
+  // Stage every word in an APE variable, as Add32Bits() does, so that the
+  // carry chain runs uninterrupted through the registers.
+  std::vector<NovaExpr> a_var, b_var;
+  a_var.reserve(n_words);
+  b_var.reserve(n_words);
+  for (int i = 0; i < n_words; ++i) {
+    a_var.emplace_back(0);
+    b_var.emplace_back(0);
+    a_var[i] = a[i];
+    b_var[i] = b[i];
+  }
+  eControl(controlOpReserveApeReg, apeR0);
+  eControl(controlOpReserveApeReg, apeR1);
+  for (int i = n_words - 1; i >= 0; --i) {
+    eApeX(apeSet, apeR0, _, a_var[i].expr);
+    eApeX(apeSet, apeR1, _, b_var[i].expr);
+    eApeR(i == n_words - 1 ? apeAdd : apeAddL, a_var[i].expr, apeR0, apeR1);
+  }
+  eControl(controlOpReleaseApeReg, apeR0);
+  eControl(controlOpReleaseApeReg, apeR1);
+  for (int i = 0; i < n_words; ++i)
+    a[i] = a_var[i];
 }
@@ -29,6 +29,11 @@ void global_get(NovaExpr& dest, NovaExpr src, int dir)
 
 }
 
+// Each APE's row and column number, recorded by assign_ape_coords() for use
+// by reduce_apes_to_cu()
+static NovaExpr reduce_ape_row;
+static NovaExpr reduce_ape_col;
+
 // Tell each APE its row and column number.
 void assign_ape_coords(const S1State& s1, NovaExpr& ape_row, NovaExpr& ape_col)
 {
@@ -51,80 +56,242 @@ void assign_ape_coords(const S1State& s1, NovaExpr& ape_row, NovaExpr& ape_col)
                   ++ape_col;
                 });
   --ape_col;    // Use zero-based numbering.
+
+  // Remember the coordinates for reductions.
+  reduce_ape_row = ape_row;
+  reduce_ape_col = ape_col;
 }
 
+// Copy the value of an APE expression on the APE that active_chip_row,
+// active_chip_col, active_ape_row, and active_ape_col select into CU
+// memory.  With active_ape_row and active_ape_col set to -1, the CU reads
+// the OR of the value over every APE on the chip.
+void read_active_ape(NovaExpr& cu_mem, const NovaTerm& ape_var)
+{
+  eCUC(cuSetRWAddress, _, _, MemAddress(cu_mem.expr));
+  int apeRValue = apeR1;
+  eControl(controlOpReserveApeReg, apeRValue);
+  eApeX(apeSet, apeRValue, _, ape_var.expr);
+  int propDelay = 4;  // This is plenty long.
+  eCUC(cuRead, _, rwIgnoreMasks|rwUseCUMemory, (propDelay<<8)|apeRValue);
+  eControl(controlOpReleaseApeReg, apeRValue);
+}
 
-// OR-reduce a value from all APEs to the CU.
-void or_reduce_apes_to_cu(const S1State& s1, NovaExpr* cu_var, const NovaExpr& ape_var)
+// Copy the value of an APE expression on a single APE into CU memory.
+void read_one_ape(NovaExpr& cu_mem, const NovaTerm& ape_var,
+                  int chip_row, int chip_col, int ape_row, int ape_col)
 {
-  // Loop over all chips, ORing one value per chip into cu_var.
-  *cu_var = 0;
-  DeclareCUVar(SomethingChangedInGrid,Int);
-  Set(SomethingChangedInGrid,IntConst(0));
+  active_chip_row = chip_row;
+  active_chip_col = chip_col;
+  active_ape_row = ape_row;
+  active_ape_col = ape_col;
+  read_active_ape(cu_mem, ape_var);
+}
+
+// Combine a value from all APEs into a CU variable of the same type.  The
+// APE grid is reduced first along rows and then along the first column by
+// a systolic chain: at each step, the APE next in line to the west gets the
+// combination of the APEs east of it from its neighbor and combines its
+// own value into that.  Each step is one neighbor get and one combine, so
+// a reduction takes one step fewer than the APE rows plus columns.  (APEs
+// can only get from their neighbors, so no scheme needs fewer gets.)
+// assign_ape_coords() must have been called first, and this must not be
+// called within an ApeIf.
+void reduce_apes_to_cu(const S1State& s1, NovaExpr* cu_var,
+                       const NovaTerm& ape_var, reduce_t op)
+{
+  NovaProfileRegion profile("reduce_apes_to_cu");
+  NovaExpr partial(ape_var);  // Combination of this APE and those after it
+  NovaExpr other(partial);    // Combination of the APEs after this one
+  NovaExpr to_go(0);          // Minus the steps until this APE combines
+  auto combine = [&]() {
+    switch (op) {
+      case ReduceSum:
+        partial += other;
+        break;
+      case ReduceMin:
+        NovaApeIf(other < partial, [&]() { partial = other; });
+        break;
+      case ReduceMax:
+        NovaApeIf(other > partial, [&]() { partial = other; });
+        break;
+      case ReduceOr:
+        partial |= other;
+        break;
+      case ReduceAnd:
+        partial &= other;
+        break;
+    }
+  };
+
+  // Reduce each row into its first column.
+  NovaExpr hop(0, NovaExpr::NovaCUVar);
+  const int total_cols = s1.ape_cols*s1.chip_cols;
+  if (total_cols > 1) {
+    to_go = reduce_ape_col - (total_cols - 1);
+    NovaCUForLoop(hop, 1, total_cols - 1, 1, [&]() {
+      global_get(other, partial, getEast);
+      ++to_go;
+      NovaApeIf(to_go == 0, combine);
+    });
+  }
+
+  // Reduce the first column into its first row.
+  const int total_rows = s1.ape_rows*s1.chip_rows;
+  if (total_rows > 1) {
+    to_go = reduce_ape_row - (total_rows - 1);
+    NovaCUForLoop(hop, 1, total_rows - 1, 1, [&]() {
+      global_get(other, partial, getSouth);
+      ++to_go;
+      NovaApeIf(to_go == 0, combine);
+    });
+  }
+
+  // Read the result from the APE in the upper-left corner.
+  NovaExpr result = ape_var.approx() ? NovaExpr(0.0, NovaExpr::NovaCUMem)
+                                     : NovaExpr(0, NovaExpr::NovaCUMem);
+  read_one_ape(result, partial, 0, 0, 0, 0);
+  Set(cu_var->expr, result.expr);
+}
+
+
+// Sum a rows x cols array of Approx values across all APEs into a CU
+// array of the same shape.  add_elt(acc, r, c) must add this APE's
+// contribution to element [r][c] into acc; this lets APEs contribute
+// elements they do not store.  Rather than reducing each element in turn,
+// the reduction is pipelined as a systolic wave: partial sums flow one APE
+// west per step along every row, picking up one contribution per APE, and
+// the finished row sums flow one APE north per step along the first
+// column.  Each row starts one step after the row below it so that its
+// sums reach the first column just as the column sum arrives from the
+// south.  The upper-left APE thus finishes one element per step and hands
+// it to the CU, and reducing the whole array takes a number of neighbor
+// gets proportional to the number of elements plus the number of APE rows
+// and columns, rather than to their product.  assign_ape_coords() must
+// have been called first, and this must not be called within an ApeIf.
+void sum_array_apes_to_cu(const S1State& s1, NovaExpr& cu_array,
+                          int rows, int cols,
+                          const std::function<void(NovaExpr&, const NovaExpr&, const NovaExpr&)>& add_elt)
+{
+  NovaProfileRegion profile("sum_array_apes_to_cu");
+  const int n_elts = rows*cols;
+  const int total_rows = s1.ape_rows*s1.chip_rows;
+  const int total_cols = s1.ape_cols*s1.chip_cols;
+  NovaExpr row_acc(0.0);  // Partial row sum passing through this APE
+  NovaExpr col_acc(0.0);  // Partial column sum (first column only)
+  NovaExpr k(0);          // Element this APE adds to row_acc, if in range
+  NovaExpr kr(0);         // Row of element k
+  NovaExpr kc(0);         // Column of element k
+  NovaExpr t(0, NovaExpr::NovaCUVar);       // Time step
+  NovaExpr elt(0.0, NovaExpr::NovaCUMem);   // Element read from the APEs
+  NovaExpr cr(0, NovaExpr::NovaCUVar);      // Row of the next CU element
+  NovaExpr cc(0, NovaExpr::NovaCUVar);      // Column of the next CU element
+
+  // Element k leaves the lower-right APE at time k and reaches the APE in
+  // row r and column c at time k + (total_rows-1-r) + (total_cols-1-c).
+  k = reduce_ape_row + reduce_ape_col - (total_rows - 1) - (total_cols - 1);
+  const int latency = total_rows + total_cols - 2;
+  NovaCUForLoop(t, 0, n_elts + latency - 1, 1, [&]() {
+    global_get(row_acc, row_acc, getEast);
+    global_get(col_acc, col_acc, getSouth);
+    NovaApeIf(reduce_ape_col == total_cols - 1, [&]() {
+      row_acc = 0.0;
+    });
+    NovaApeIf(reduce_ape_row == total_rows - 1, [&]() {
+      col_acc = 0.0;
+    });
+    NovaApeIf(k >= 0 && k < n_elts, [&]() {
+      add_elt(row_acc, kr, kc);
+      ++kc;
+      NovaApeIf(kc == cols, [&]() {
+        kc = 0;
+        ++kr;
+      });
+    });
+    ++k;
+    col_acc += row_acc;
+
+    // The upper-left APE has finished element t - latency.
+    NovaCUIf(t >= latency, [&]() {
+      read_one_ape(elt, col_acc, 0, 0, 0, 0);
+      cu_array[cr][cc] = elt;
+      ++cc;
+      NovaCUIf(cc == cols, [&]() {
+        cc = 0;
+        ++cr;
+      });
+    });
+  });
+}
+
+// OR-reduce a value from all APEs to the CU, setting cu_var to 1 if
+// ape_var is nonzero on any APE and to 0 otherwise.  The CU reads the OR
+// of all APEs on a chip directly, so this takes one read per chip and no
+// neighbor gets.
+void or_reduce_apes_to_cu(const S1State& s1, NovaExpr* cu_var, const NovaTerm& ape_var)
+{
+  NovaProfileRegion profile("or_reduce_apes_to_cu");
+  // Read each chip's OR in turn, and combine them on the CU.
+  NovaExpr bits(0, NovaExpr::NovaCUVar);      // OR of all chips so far
   NovaExpr chip_or(0, NovaExpr::NovaCUMem);   // Per-chip OR result
   NovaCUForLoop(active_chip_row, 0, s1.chip_rows - 1, 1, [&]() {
     NovaCUForLoop(active_chip_col, 0, s1.chip_cols - 1, 1, [&]() {
-      // Compute an OR across all APEs on the current chip.
-      // eCUC(cuSet, active_ape_col.expr, _, -1);
+      active_ape_row = -1;
       active_ape_col = -1;
-      eCUC(cuSetRWAddress, _, _, MemAddress(chip_or.expr));
-      int apeRChanged = apeR1;  // Register indicating ape_var is nonzero for some APE on the current chip.
-      eControl(controlOpReserveApeReg, apeRChanged);
-      eApeX(apeSet, apeRChanged, _, ape_var.expr);
-      int propDelay = 4;  // This is plenty long.
-      eCUC(cuRead, _, rwIgnoreMasks|rwUseCUMemory, (propDelay<<8)|apeRChanged);
-      eControl(controlOpReleaseApeReg, apeRChanged);
-
-      // OR the per-chip value into cu_var.
-      CUIf(Ne(chip_or.expr, IntConst(0)));
-      *cu_var = 1;
-      CUFi();
+      read_active_ape(chip_or, ape_var);
+      bits |= chip_or;
     });
   });
+  *cu_var = 0;
+  NovaCUIf(bits != 0, [&]() {
+    *cu_var = 1;
+  });
 }
 
-// Convert an integer in [0, 65535] to an approx in [0, 1].
-NovaExpr int_to_approx01(const NovaExpr& i_val)
+// Tables for arithmetic, filled in by init_math_tables()
+static NovaExpr ln_center;    // ln(c) for the center c of each subinterval
+static NovaExpr ln_scale;     // 1/(65536*c) for each subinterval
+static NovaExpr nibble_value; // i as an Approx, for i in [0, 15]
+
+// Fill in the tables that int_to_approx01() and the ln_of_int() methods
+// read.  Every APE holds its own copy.
+void init_math_tables()
 {
-  NovaExpr a_val(0.0);
-  NovaExpr one(1);
-  for (int i = 0; i < 16; ++i) {
-    NovaApeIf((i_val>>i)&1 == 1, [&](){
-      double f = 1.0/double(1<<(16 - i));  // ..., 1/8, 1/4, 1/2
-      a_val += f;
-    });
+  ln_center = NovaExpr(0.0, NovaExpr::NovaApeMemVector, 32);
+  ln_scale = NovaExpr(0.0, NovaExpr::NovaApeMemVector, 32);
+  nibble_value = NovaExpr(0.0, NovaExpr::NovaApeMemVector, 16);
+  for (int i = 0; i < 32; ++i) {
+    double center = (32 + i)*1024 + 511.5;  // Times 65536
+    ln_center[i] = std::log(center/65536.0);
+    ln_scale[i] = 1.0/center;
   }
-  return a_val;
+  for (int i = 0; i < 16; ++i)
+    nibble_value[i] = double(i);
 }
 
-// Approximate cos(x) on [0, 2*pi] using 5 Chebyshev polynomials.
-NovaExpr cos_0_2pi(const NovaExpr& x)
+// Convert an integer in [0, 65535] to an approx in [0, 1], looking up
+// four bits at a time rather than testing each bit.  init_math_tables()
+// must have been called first.
+NovaExpr int_to_approx01(const NovaExpr& i_val)
 {
-  // Scale num from [0, 2*pi] to [-1, 1].
-  NovaExpr num((x*2.0 - TWO_PI)/TWO_PI);
-
-  // Instantiate the Chebyshev polynomials.
-  NovaExpr num2(num*2.0);
-  NovaExpr t0(1.0);
-  NovaExpr t1(num);
-  NovaExpr t2(num2*t1 - t0);
-  NovaExpr t3(num2*t2 - t1);
-  NovaExpr t4(num2*t3 - t2);
-
-  // Compute a linear combination of the Chebyshev polynomials.  We ignore
-  // the t1 and t3 terms here because their coefficients were too small in
-  // magnitude (<1e-6).
-  NovaExpr sum(t0*0.30420407768492924161);
-  sum += t4*-0.33194352475813920789;
-  sum += t2*0.97226055289980561902;
-  return sum;
+  NovaProfileRegion profile("int_to_approx01");
+  NovaExpr n3((i_val >> 12) & 15);
+  NovaExpr n2((i_val >> 8) & 15);
+  NovaExpr n1((i_val >> 4) & 15);
+  NovaExpr n0(i_val & 15);
+  NovaExpr a_val(nibble_value[n0]*0.0625 + nibble_value[n1]);
+  a_val = a_val*0.0625 + nibble_value[n2];
+  a_val = a_val*0.0625 + nibble_value[n3];
+  return a_val*0.0625;
 }
 
-// Approximate sin(x) on [0, 2*pi] using 6 Chebyshev polynomials.
-NovaExpr sin_0_2pi(const NovaExpr& x)
+// Approximate cos(2*pi*u) and sin(2*pi*u) for u in [0, 1] using 6
+// Chebyshev polynomials, which the two functions share.
+void cos_sin_2pi(const NovaExpr& u, NovaExpr& cos_val, NovaExpr& sin_val)
 {
-  // Scale num from [0, 2*pi] to [-1, 1].
-  NovaExpr num((x*2.0 - TWO_PI)/TWO_PI);
+  NovaProfileRegion profile("cos_sin_2pi");
+  // Scale num from [0, 1] to [-1, 1].
+  NovaExpr num(u*2.0 - 1.0);
 
   // Instantiate the Chebyshev polynomials.
   NovaExpr num2(num*2.0);
@@ -135,18 +302,31 @@ NovaExpr sin_0_2pi(const NovaExpr& x)
   NovaExpr t4(num2*t3 - t2);
   NovaExpr t5(num2*t4 - t3);
 
-  // Compute a linear combination of the Chebyshev polynomials.  We ignore
-  // the t0, t2, and t4 terms here because their coefficients were too
-  // small in magnitude (<1e-6).
-  NovaExpr sum(t1*-0.56923064009501811444);
-  sum += t3*0.66716913685894241315;
-  sum += t5*-0.11112410957439385062;
-  return sum;
+  // Compute linear combinations of the Chebyshev polynomials.  Cosine is
+  // even about u = 1/2 and sine is odd, so each ignores the other's terms,
+  // whose coefficients are too small in magnitude (<1e-6).
+  cos_val = t0*0.30420407768492924161;
+  cos_val += t4*-0.33194352475813920789;
+  cos_val += t2*0.97226055289980561902;
+  sin_val = t1*-0.56923064009501811444;
+  sin_val += t3*0.66716913685894241315;
+  sin_val += t5*-0.11112410957439385062;
 }
 
-// Compute ln(r) for r in [0, 65535].
-NovaExpr ln_of_int(const NovaExpr& r)
+// Return true if a < b when both 16-bit Ints are treated as unsigned.
+// Flipping the sign bits maps unsigned order onto signed order.
+static NovaTerm ape_ult(const NovaTerm& a, const NovaTerm& b)
+{
+  return (a ^ 0x8000) < (b ^ 0x8000);
+}
+
+// Compute ln(r/65535) for r in [0, 65535] by shift and subtract: r is
+// approximated by a product of factors 1 + 2^-j, whose logarithms are
+// known, taking each factor as often as the product stays within r.
+// r = 0 is treated as 1.
+NovaExpr ln_of_int_shift_subtract(const NovaExpr& r)
 {
+  NovaProfileRegion profile("ln_of_int_shift_subtract");
   // Hard-wire the number of iterations to perform.
   const int n = 5;
 
@@ -165,27 +345,28 @@ NovaExpr ln_of_int(const NovaExpr& r)
     // Unroll "while (a > b)" to a depth of 16.
     NovaExpr k(0, NovaExpr::NovaCUVar);
     NovaCUForLoop(k, 0, 15, 1, [&]() {
-      NovaApeIf(a[0] > b[0] || (a[0] == b[0] && a[1] >= b[1]), [&]() {
+      NovaApeIf(ape_ult(b[0], a[0]) || (a[0] == b[0] && !ape_ult(a[1], b[1])), [&]() {
         lg += std::log(1.0 + std::pow(2.0, -double(j)));
 
         // 32-bit a -= b
-        NovaApeIf(a[1] < b[1], [&]() {
+        NovaApeIf(ape_ult(a[1], b[1]), [&]() {
           --a[0];
         });
         a[0] -= b[0];
         a[1] -= b[1];
 
         // 32-bit a <<= j
-        a[0] = (a[0]<<j) | (a[1]>>(16 - j));  // Logical shift right
+        NovaExpr mask((1<<j) - 1);
+        a[0] = (a[0]<<j) | ((a[1]>>(16 - j)) & mask);  // Logical shift right
         a[1] <<= j;
 
         // 32-bit b += b<<j
         NovaExpr bj[2];   // b<<j
-        bj[0] = (b[0]<<j) | (b[1]>>(16 - j));  // Logical shift right
+        bj[0] = (b[0]<<j) | ((b[1]>>(16 - j)) & mask);  // Logical shift right
         bj[1] = b[1]<<j;
         b[0] += bj[0];
         NovaExpr b1(b[1] + bj[1]);
-        NovaApeIf(b1 < b[1], [&]() {  // Carry
+        NovaApeIf(ape_ult(b1, b[1]), [&]() {  // Carry
           ++b[0];
         });
         b[1] = b1;
@@ -198,3 +379,91 @@ NovaExpr ln_of_int(const NovaExpr& r)
   }
   return lg - std::log(65535.0);
 }
+
+// Shift m left until its top bit is set, finding the leading bit by binary
+// search, and count the shifts in k.  m = 0 is treated as 1.
+static void normalize_for_ln(NovaExpr& m, NovaExpr& k)
+{
+  NovaApeIf(m == 0, [&]() {
+    m = 1;
+  });
+  for (int s = 8; s >= 1; s /= 2) {
+    NovaApeIf(((m >> (16 - s)) & ((1 << s) - 1)) == 0, [&]() {
+      m <<= s;
+      k += s;
+    });
+  }
+}
+
+// Return ln(r/65535) given ln(m/65536) for the m and k to which
+// normalize_for_ln() reduced r.  The large terms are added last so that
+// their rounding is incurred only once.
+static NovaTerm denormalize_ln(const NovaTerm& ln_m, const NovaExpr& k)
+{
+  return ln_m + std::log(65536.0/65535.0) - nibble_value[k]*std::log(2.0);
+}
+
+// Compute ln(r/65535) for r in [0, 65535] by normalizing r to [1/2, 1) and
+// approximating ln(x) on [1/2, 1] using 6 Chebyshev polynomials.
+NovaExpr ln_of_int_chebyshev(const NovaExpr& r)
+{
+  NovaProfileRegion profile("ln_of_int_chebyshev");
+  NovaExpr m(r);
+  NovaExpr k(0);
+  normalize_for_ln(m, k);
+
+  // Scale num from [0.5, 1] to [-1, 1].
+  NovaExpr num(int_to_approx01(m)*4.0 - 3.0);
+
+  // Instantiate the Chebyshev polynomials.
+  NovaExpr num2(num*2.0);
+  NovaExpr t0(1.0);
+  NovaExpr t1(num);
+  NovaExpr t2(num2*t1 - t0);
+  NovaExpr t3(num2*t2 - t1);
+  NovaExpr t4(num2*t3 - t2);
+  NovaExpr t5(num2*t4 - t3);
+
+  // Compute a linear combination of the Chebyshev polynomials.
+  NovaExpr sum(t0*-0.31669436753229918136);
+  sum += t1*0.34314574980088347056;
+  sum += t2*-0.029437247099165869679;
+  sum += t3*0.00336706062487532971;
+  sum += t4*-0.00043308816054383157679;
+  sum += t5*5.8220244616304386799e-05;
+  return denormalize_ln(sum, k);
+}
+
+// Compute ln(r/65535) for r in [0, 65535] by normalizing r to m/65536 in
+// [1/2, 1) and splitting that interval into 32 subintervals.  If c is the
+// center of m's subinterval, ln(m/65536) = ln(c) + ln(1 + t) with
+// t = (m/65536 - c)/c, |t| < 1/64, and ln(1 + t) ~= t - t^2/2.  Only the
+// 10 bits of m below the table index need converting to an Approx, which
+// takes a table lookup per 4 bits rather than a conditional per bit.
+NovaExpr ln_of_int_table(const NovaExpr& r)
+{
+  NovaProfileRegion profile("ln_of_int_table");
+  NovaExpr m(r);
+  NovaExpr k(0);
+  normalize_for_ln(m, k);
+  NovaExpr idx((m >> 10) & 31);
+  NovaExpr n2((m >> 6) & 15);
+  NovaExpr n1((m >> 2) & 15);
+  NovaExpr n0(m & 3);
+  NovaExpr low((nibble_value[n2]*16.0 + nibble_value[n1])*4.0 + nibble_value[n0]);
+  NovaExpr t((low - 511.5)*ln_scale[idx]);
+  return denormalize_ln(ln_center[idx] + (t - t*t*0.5), k);
+}
+
+// Compute ln(r/65535) for r in [0, 65535] using the method selected at
+// build time.
+NovaExpr ln_of_int(const NovaExpr& r)
+{
+#if LN_METHOD == LN_SHIFT_SUBTRACT
+  return ln_of_int_shift_subtract(r);
+#elif LN_METHOD == LN_CHEBYSHEV
+  return ln_of_int_chebyshev(r);
+#else
+  return ln_of_int_table(r);
+#endif
+}